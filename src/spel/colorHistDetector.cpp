@@ -4,81 +4,16 @@
 namespace SPEL
 {
   // PartModel Constructor 
-  // Initialization "partHistogram" and "bgHistogram" with _nBins^3 elements capacity 3-D arrays 
+  // Initialization "partHistogram" and "bgHistogram" with _nBins^3 zero bins
   ColorHistDetector::PartModel::PartModel(uint8_t _nBins) : nBins(_nBins)
   {
-    partHistogram.resize(nBins);
-    bgHistogram.resize(nBins);
-    for (uint8_t r = 0; r < nBins; r++)
-    {
-      try
-      {
-        partHistogram.at(r).resize(nBins);
-      }
-      catch (...)
-      {
-        stringstream ss;
-        ss << "Couldn't find partHistogram " << "[" << r << "]";
-        throw logic_error(ss.str());
-      }
-      try
-      {
-        bgHistogram.at(r).resize(nBins);
-      }
-      catch (...)
-      {
-        stringstream ss;
-        ss << "Couldn't find bgHistogram " << "[" << r << "]";
-        throw logic_error(ss.str());
-      }
-      for (uint8_t g = 0; g < nBins; g++)
-      {
-        try
-        {
-          partHistogram.at(r).at(g).resize(nBins);
-        }
-        catch (...)
-        {
-          stringstream ss;
-          ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "]";
-          throw logic_error(ss.str());
-        }
-        try
-        {
-          bgHistogram.at(r).at(g).resize(nBins);
-        }
-        catch (...)
-        {
-          stringstream ss;
-          ss << "Couldn't find bgHistogram " << "[" << r << "][" << g << "]";
-          throw logic_error(ss.str());
-        }
-        for (int b = 0; b < nBins; b++)
-        {
-          try
-          {
-            partHistogram.at(r).at(g).at(b) = 0.0;
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            throw logic_error(ss.str());
-          }
-          try
-          {
-            bgHistogram.at(r).at(g).at(b) = 0.0;
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find bgHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            throw logic_error(ss.str());
-          }
-        }
-      }
-    }
+    auto binsCount = static_cast <size_t> (nBins) * nBins * nBins;
+    partHistogram.assign(binsCount, 0.0f);
+    bgHistogram.assign(binsCount, 0.0f);
     sizeFG = 0;
+    sizeBG = 0;
+    fgNumSamples = 0;
+    bgNumSamples = 0;
   }
 
   // Copy all fields of the "PartModel" structure
@@ -97,13 +32,11 @@ namespace SPEL
     return *this;
   }
 
-  // Constructor with initialization of constant field "nBins"
-  ColorHistDetector::ColorHistDetector(uint8_t _nBins) : nBins(_nBins)
+  ColorHistDetectorHelper::ColorHistDetectorHelper(void)
   {
-    id = 0x434844;
   }
 
-  ColorHistDetector::~ColorHistDetector(void)
+  ColorHistDetectorHelper::~ColorHistDetectorHelper(void)
   {
     for (auto &&p : pixelDistributions)
       p.second.release();
@@ -111,6 +44,20 @@ namespace SPEL
       p.second.release();
   }
 
+  // Constructor with initialization of constant field "nBins"
+  ColorHistDetector::ColorHistDetector(uint8_t _nBins) : nBins(_nBins)
+  {
+    id = 0x434844;
+    // Scaling of colorspace, the colour interval of each intensity
+    auto factor = static_cast <uint32_t> (ceil(pow(2, 8) / nBins));
+    for (uint32_t v = 0; v < 256; v++)
+      colourIntervals[v] = v / factor;
+  }
+
+  ColorHistDetector::~ColorHistDetector(void)
+  {
+  }
+
   // Returns unique ID of "ColorHistDetector" object
   int ColorHistDetector::getID(void) const
   {
@@ -172,7 +119,6 @@ namespace SPEL
       throw logic_error("No neither keyframes nor lockframes");
     }
 
-    tree <BodyPart> partTree;
     // Handling all frames
     for (vector <Frame*>::iterator frameNum = frames.begin(); frameNum != frames.end(); ++frameNum)
     {
@@ -181,349 +127,301 @@ namespace SPEL
         continue; // skip unmarked frames
       }
 
-      int originalSize = (*frameNum)->getFrameSize().height;
+      addFrameToModels(*frameNum);
+    }
+  }
+
+  // Folds the marked frames into the trained part models, the earlier training frames are not processed again
+  // The running sizes of the models keep the histograms normalised over all the added pixels
+  void ColorHistDetector::update(vector <Frame*> _frames, map <string, float> params)
+  {
+    if (partModels.empty())
+    {
+      train(_frames, params); // nothing to update yet
+      return;
+    }
+#ifdef DEBUG
+    const uint8_t debugLevel = 5;
+#else
+    const uint8_t debugLevel = 1;
+#endif // DEBUG
+    const string sDebugLevel = "debugLevel";
+    params.emplace(sDebugLevel, debugLevel);
+
+    debugLevelParam = static_cast <uint8_t> (params.at(sDebugLevel));
+
+    sort(_frames.begin(), _frames.end(), Frame::FramePointerComparer);
+    // The frames are resized to the height of the training
+    for (vector <Frame*>::iterator frameNum = _frames.begin(); frameNum != _frames.end(); ++frameNum)
+    {
+      if ((*frameNum)->getFrametype() != KEYFRAME && (*frameNum)->getFrametype() != LOCKFRAME)
+      {
+        continue; // skip unmarked frames
+      }
+
+      addFrameToModels(*frameNum);
+      frames.push_back(*frameNum);
+    }
+    sort(frames.begin(), frames.end(), Frame::FramePointerComparer); // sorting frames by id
+  }
+
+  // Adds the pixels of the marked frame to the part models, the models of the absent parts are created
+  void ColorHistDetector::addFrameToModels(Frame *frame)
+  {
+    Skeleton skeleton;
+    tree <BodyPart> partTree;
+    Frame *workFrame = 0;
+    if (frame->getFrametype() == KEYFRAME)
+      workFrame = new Keyframe();
+    else if (frame->getFrametype() == LOCKFRAME)
+      workFrame = new Lockframe();
+    else if (frame->getFrametype() == INTERPOLATIONFRAME)
+      workFrame = new Interpolation();
 
-      Frame *workFrame = 0;
-      if ((*frameNum)->getFrametype() == KEYFRAME)
-        workFrame = new Keyframe();
-      else if ((*frameNum)->getFrametype() == LOCKFRAME)
-        workFrame = new Lockframe();
-      else if ((*frameNum)->getFrametype() == INTERPOLATIONFRAME)
-        workFrame = new Interpolation();
+    workFrame = frame->clone(workFrame);
 
-      workFrame = (*frameNum)->clone(workFrame);
+    workFrame->Resize(maxFrameHeight);
 
-      workFrame->Resize(params.at(sMaxFrameHeight));
+    if (debugLevelParam >= 2)
+      cerr << "Training on frame " << workFrame->getID() << endl;
+    // Create local variables
+    auto binsCount = static_cast <size_t> (nBins) * nBins * nBins;
+    map <int32_t, vector <uint32_t>> partPixelBins; // not normalised histogram of the pixels of current body part
+    map <int32_t, uint32_t> partPixelsCount; // count of the pixels of current body part
+    map <int32_t, int> blankPixels;  // pixels outside the mask
+    // The background of the part are all the pixels outside of the polygons and the colour pixels of the other parts,
+    // so it is built from these two histograms and the own histogram of the part
+    vector <uint32_t> freePixelBins(binsCount, 0), ownedPixelBins(binsCount, 0);
+    uint32_t freePixelsCount = 0, ownedPixelsCount = 0;
+    skeleton = workFrame->getSkeleton(); // copy marking from current frame
+    vector <pair <int32_t, POSERECT <Point2f>>> polygons;  // polygons for this frame in the order of the part tree
+    vector <float> polyDepth; // used for evaluation of overlapped polygons
+    partTree = skeleton.getPartTree(); // the skeleton body parts
+    // Handling all bodyparts on the frames
+    for (tree <BodyPart>::iterator iteratorBodyPart = partTree.begin(); iteratorBodyPart != partTree.end(); ++iteratorBodyPart)
+    {
+      partPixelBins.insert(pair <int32_t, vector <uint32_t>>(iteratorBodyPart->getPartID(), vector <uint32_t>(binsCount, 0))); // container initialization for the histogram of each of body parts
+      partPixelsCount.insert(pair <int32_t, uint32_t>(iteratorBodyPart->getPartID(), 0));
+      blankPixels.insert(pair <int32_t, int>(iteratorBodyPart->getPartID(), 0)); // container initialization for counting blank pixels for each of body parts
+      Point2f j1, j0;  // temporary adjacent joints   
+      BodyJoint *joint = 0; // temporary conserve a joints
+      joint = skeleton.getBodyJoint(iteratorBodyPart->getParentJoint()); // the parent node of current body part pointer 
 
-      if (debugLevelParam >= 2)
-        cerr << "Training on frame " << workFrame->getID() << endl;
-      // Create local variables
-      map <int32_t, vector <Point3i>> partPixelColours; // the set of RGB-colours of pixel's for current body part
-      map <int32_t, vector <Point3i>> bgPixelColours; // the set of RGB-colours for a pixels of background
-      map <int32_t, int> blankPixels;  // pixels outside the mask
-      skeleton = workFrame->getSkeleton(); // copy marking from current frame
-      multimap <int32_t, POSERECT <Point2f>> polygons;  // polygons for this frame
-      multimap <int32_t, float> polyDepth; // used for evaluation of overlapped polygons
-      partTree = skeleton.getPartTree(); // the skeleton body parts
-      // Handling all bodyparts on the frames
-      for (tree <BodyPart>::iterator iteratorBodyPart = partTree.begin(); iteratorBodyPart != partTree.end(); ++iteratorBodyPart)
+      if (joint == 0)
       {
-        partPixelColours.insert(pair <int32_t, vector <Point3i>>(iteratorBodyPart->getPartID(), vector <Point3i>())); // container initialization for conserve colours set for each of body parts
-        bgPixelColours.insert(pair <int32_t, vector <Point3i>>(iteratorBodyPart->getPartID(), vector <Point3i>())); // container initialization for conserve background colours set for each of body parts
-        blankPixels.insert(pair <int32_t, int>(iteratorBodyPart->getPartID(), 0)); // container initialization for counting blank pixels for each of body parts
-        Point2f j1, j0;  // temporary adjacent joints   
-        BodyJoint *joint = 0; // temporary conserve a joints
-        joint = skeleton.getBodyJoint(iteratorBodyPart->getParentJoint()); // the parent node of current body part pointer 
-
-        if (joint == 0)
-        {
-          if (debugLevelParam >= 1)
-            cerr << ERROR_HEADER << "Invalid parent joint" << endl;
-          break; // a joint has no marking on the frame
-        }
-        j0 = joint->getImageLocation(); // coordinates of current joint
-        joint = 0;
-        joint = skeleton.getBodyJoint(iteratorBodyPart->getChildJoint()); // the child node of current body part pointer
-        if (joint == 0)
-        {
-          if (debugLevelParam >= 1)
-            cerr << ERROR_HEADER << "Invalid child joint" << endl;
-          break; // a joint has no marking on the frame
-        }
-        j1 = joint->getImageLocation(); // coordinates of current joint
-        float boneLength = getBoneLength(j0, j1); // distance between nodes
-        //TODO (Vitaliy Koshura): Check this!
-        float boneWidth;
-        try
-        { //currents body part polygon width 
-          boneWidth = getBoneWidth(boneLength, *iteratorBodyPart);
-        }
-        catch (...)
-        {
-          stringstream ss;
-          ss << "Can't get LWRatio value";
-          if (debugLevelParam >= 1)
-            cerr << ERROR_HEADER << ss.str() << endl;
-          throw logic_error(ss.str());
-        }
-        Point2f direction = j1 - j0; // used as estimation of the vector's direction
-        float rotationAngle = float(spelHelper::angle2D(1.0, 0, direction.x, direction.y) * (180.0 / M_PI)); //bodypart tilt angle 
-        iteratorBodyPart->setRotationSearchRange(rotationAngle);
-        POSERECT <Point2f> poserect = getBodyPartRect(*iteratorBodyPart, j0, j1);
-        polygons.insert(pair <int32_t, POSERECT <Point2f>>(iteratorBodyPart->getPartID(), poserect));
-        polyDepth.insert(pair <int32_t, float>(iteratorBodyPart->getPartID(), skeleton.getBodyJoint(iteratorBodyPart->getParentJoint())->getSpaceLocation().z));
+        if (debugLevelParam >= 1)
+          cerr << ERROR_HEADER << "Invalid parent joint" << endl;
+        break; // a joint has no marking on the frame
+      }
+      j0 = joint->getImageLocation(); // coordinates of current joint
+      joint = 0;
+      joint = skeleton.getBodyJoint(iteratorBodyPart->getChildJoint()); // the child node of current body part pointer
+      if (joint == 0)
+      {
+        if (debugLevelParam >= 1)
+          cerr << ERROR_HEADER << "Invalid child joint" << endl;
+        break; // a joint has no marking on the frame
+      }
+      j1 = joint->getImageLocation(); // coordinates of current joint
+      float boneLength = getBoneLength(j0, j1); // distance between nodes
+      //TODO (Vitaliy Koshura): Check this!
+      float boneWidth;
+      try
+      { //currents body part polygon width 
+        boneWidth = getBoneWidth(boneLength, *iteratorBodyPart);
+      }
+      catch (...)
+      {
+        stringstream ss;
+        ss << "Can't get LWRatio value";
+        if (debugLevelParam >= 1)
+          cerr << ERROR_HEADER << ss.str() << endl;
+        throw logic_error(ss.str());
       }
-      skeleton.setPartTree(partTree);
-      workFrame->setSkeleton(skeleton);
-      Mat maskMat = workFrame->getMask(); // copy mask from the current frame
-      Mat imgMat = workFrame->getImage(); // copy image from the current frame
-      // Range over all pixels of the frame
+      Point2f direction = j1 - j0; // used as estimation of the vector's direction
+      float rotationAngle = float(spelHelper::angle2D(1.0, 0, direction.x, direction.y) * (180.0 / M_PI)); //bodypart tilt angle 
+      iteratorBodyPart->setRotationSearchRange(rotationAngle);
+      POSERECT <Point2f> poserect = getBodyPartRect(*iteratorBodyPart, j0, j1);
+      polygons.push_back(pair <int32_t, POSERECT <Point2f>>(iteratorBodyPart->getPartID(), poserect));
+      // Only the flag of the nonzero depth has ever taken part in the overlapping test, so the trained models stay the same
+      polyDepth.push_back(skeleton.getBodyJoint(iteratorBodyPart->getParentJoint())->getSpaceLocation().z != 0 ? 1.0f : 0.0f);
+    }
+    skeleton.setPartTree(partTree);
+    workFrame->setSkeleton(skeleton);
+    Mat maskMat = workFrame->getMask(); // copy mask from the current frame
+    Mat imgMat = workFrame->getImage(); // copy image from the current frame
+    if (maskMat.size() != imgMat.size() || imgMat.type() != CV_8UC3)
+    {
+      stringstream ss;
+      ss << "Frame " << workFrame->getID() << " has incompatible image and mask";
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
+    // Each polygon is rasterized once, then the pixels are handled in the single pass
+    Mat partsOwnership = buildPartsOwnership(polygons, polyDepth, imgMat.size());
+    vector <uint32_t> rowBins(imgMat.cols); // histogram bins of the pixels of the current row
+    int32_t lastPartHit = -1;
+    vector <uint32_t> *lastPartBins = 0;
+    uint32_t *lastPartPixelsCount = 0;
+    for (int32_t j = 0; j < imgMat.rows; j++)
+    {
+      auto imgRow = imgMat.ptr<Vec3b>(j);
+      auto maskRow = maskMat.ptr<uint8_t>(j);
+      auto ownershipRow = partsOwnership.ptr<int32_t>(j);
+      quantizeRow(imgRow, imgMat.cols, rowBins.data());
       for (int32_t i = 0; i < imgMat.cols; i++)
       {
-        for (int32_t j = 0; j < imgMat.rows; j++)
+        auto bin = rowBins[i]; // the histogram bin of the current pixel colour
+        bool blackPixel = maskRow[i] < 10;
+        int32_t partHit = ownershipRow[i]; // -1 if there is no polygon, which contains the point
+        if (partHit != -1) // if was found polygon, that contains this pixel
         {
-          Vec3b intensity;
-          try
-          {
-            intensity = imgMat.at<Vec3b>(j, i);  // copy RGB color of current pixel
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't get imgMat value of indeces " << "[" << j << "][" << i << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-          // Copy the current pixel colour components
-          uint8_t blue = intensity.val[0];
-          uint8_t green = intensity.val[1];
-          uint8_t red = intensity.val[2];
-          uint8_t mintensity = 0;
-          try
-          {
-            mintensity = maskMat.at<uint8_t>(j, i);  // copy current pixel mask value 
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't get maskMat value of indeces " << "[" << j << "][" << i << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-          bool blackPixel = mintensity < 10;
-          int partHit = -1; // will be equal to -1 until is not found polygon, which contains the point
-          float depth = 0;
-          // Handling all poligons
-          for (tree <BodyPart>::iterator iteratorBodyPart = partTree.begin(); iteratorBodyPart != partTree.end(); ++iteratorBodyPart)
+          if (partHit != lastPartHit)
           {
-            uint32_t partNumber = iteratorBodyPart->getPartID();
-            bool bContainsPoint = false;
             try
             {
-              vector <POSERECT <Point2f>> partPolygons;
-              // Copy poligons to "PartPoligons"
-              multimap <int32_t, POSERECT <Point2f>>::iterator lower = polygons.lower_bound(partNumber), upper = polygons.upper_bound(partNumber);
-              transform(lower, upper, back_inserter(partPolygons), [](std::pair <int32_t, POSERECT<Point2f>> const &pair) { return pair.second; });
-              // Checking whether a pixel belongs to the current and to another polygons            
-              for (vector <POSERECT <Point2f>>::iterator iteratorPartPolygons = partPolygons.begin(); iteratorPartPolygons != partPolygons.end(); ++iteratorPartPolygons)
-              {
-                if ((bContainsPoint = iteratorPartPolygons->containsPoint(Point2f((float)i, (float)j)) > 0) == true)
-                {
-                  break;; // was found polygon, which contain current pixel
-                }
-              }
+              lastPartBins = &partPixelBins.at(partHit);
+              lastPartPixelsCount = &partPixelsCount.at(partHit);
+              lastPartHit = partHit;
             }
             catch (...)
             {
               stringstream ss;
-              ss << "There is no such polygon for body part " << partNumber;
+              ss << "There is no partPixelBins for body part " << partHit;
               if (debugLevelParam >= 1)
                 cerr << ERROR_HEADER << ss.str() << endl;
               throw logic_error(ss.str());
             }
+          }
+          if (!blackPixel) // if pixel color isn't black
+          {
+            (*lastPartBins)[bin]++; // add colour of this pixel to part[partHit] colours
+            (*lastPartPixelsCount)++;
+            ownedPixelBins[bin]++; // the pixel is the background for all other bodyparts
+            ownedPixelsCount++;
+          }
+          else
+          {
             try
             {
-              vector <float> partDepths;
-              multimap <int32_t, float>::iterator lower = polyDepth.lower_bound(partNumber), upper = polyDepth.upper_bound(partNumber);
-              transform(lower, upper, back_inserter(partDepths), [](std::pair <int32_t, bool> const &pair) { return pair.second; }); // copy "polyDepth" to "PartDepth"
-              // Checkig polygons overlapping
-              for (vector <float>::iterator iteratorPartDepths = partDepths.begin(); iteratorPartDepths != partDepths.end(); ++iteratorPartDepths)
-              {
-                if (bContainsPoint && partHit == -1)
-                {
-                  partHit = partNumber; // store the number of the first found polygon
-                  depth = *iteratorPartDepths;
-                }
-                else if (bContainsPoint && *iteratorPartDepths < depth) // How, for float tempDepthSign?/////////////////
-                {
-                  partHit = partNumber;
-                  depth = *iteratorPartDepths;
-                }
-              }
+              blankPixels.at(partHit)++; // otherwise take stock this pixel to blank pixel counter
             }
             catch (...)
             {
               stringstream ss;
-              ss << "There is no such polyDepth parameter for body part " << partNumber;
+              ss << "There is no such blankPixels for body part " << partHit;
               if (debugLevelParam >= 1)
                 cerr << ERROR_HEADER << ss.str() << endl;
               throw logic_error(ss.str());
             }
           }
-          if (partHit != -1) // if was found polygon, that contains this pixel
-          {
-            if (!blackPixel) // if pixel color isn't black
-            {
-              try
-              {
-                partPixelColours.at(partHit).push_back(Point3i(red, green, blue)); // add colour of this pixel to part[partHit] colours
-              }
-              catch (...)
-              {
-                stringstream ss;
-                ss << "There is no partPixelColours for body part " << partHit;
-                if (debugLevelParam >= 1)
-                  cerr << ERROR_HEADER << ss.str() << endl;
-                throw logic_error(ss.str());
-              }
-              // For all bodyparts
-              for (tree <BodyPart>::iterator p = partTree.begin(); p != partTree.end(); ++p)
-              {
-                if ((int32_t)p->getPartID() != partHit) // if current poligon wasn't found first in the previous enumeration???
-                {
-                  try
-                  {
-                    bgPixelColours.at(p->getPartID()).push_back(Point3i(red, green, blue)); // add colour of this pixel to part[partHit] background colours
-                  }
-                  catch (...)
-                  {
-                    stringstream ss;
-                    ss << "There is no such bgPixelColours for body part " << p->getPartID();
-                    if (debugLevelParam >= 1)
-                      cerr << ERROR_HEADER << ss.str() << endl;
-                    throw logic_error(ss.str());
-                  }
-                }
-              }
-            }
-            else
-            {
-              try
-              {
-                blankPixels.at(partHit)++; // otherwise take stock this pixel to blank pixel counter
-              }
-              catch (...)
-              {
-                stringstream ss;
-                ss << "There is no such blankPixels for body part " << partHit;
-                if (debugLevelParam >= 1)
-                  cerr << ERROR_HEADER << ss.str() << endl;
-                throw logic_error(ss.str());
-              }
-            }
-          }
-          else // if  not found polygon, that contains this pixel 
-          { // For all bodyparts
-            for (tree <BodyPart>::iterator p = partTree.begin(); p != partTree.end(); ++p)
-            {
-              try
-              {
-                bgPixelColours.at(p->getPartID()).push_back(Point3i(red, green, blue));
-              }
-              catch (...)
-              {
-                stringstream ss;
-                ss << "There is no such bgPixelColours for body part " << p->getPartID();
-                if (debugLevelParam >= 1)
-                  cerr << ERROR_HEADER << ss.str() << endl;
-                throw logic_error(ss.str());
-              }
-            }
-          }
+        }
+        else // if  not found polygon, that contains this pixel, it is the background for all bodyparts
+        {
+          freePixelBins[bin]++;
+          freePixelsCount++;
         }
       }
+    }
 
-      // Create model for each bodypart
-      for (tree <BodyPart>::iterator iteratorBodyPart = partTree.begin(); iteratorBodyPart != partTree.end(); ++iteratorBodyPart)
+    // Create model for each bodypart
+    vector <uint32_t> bgPixelBins(binsCount);
+    for (tree <BodyPart>::iterator iteratorBodyPart = partTree.begin(); iteratorBodyPart != partTree.end(); ++iteratorBodyPart)
+    {
+      int32_t partNumber = iteratorBodyPart->getPartID();
+      if (partModels.find(partNumber) == partModels.end())
+      {
+        PartModel model(nBins);
+        partModels.insert(pair <int32_t, PartModel>(partNumber, model)); //add a new model to end of models list
+      }
+      try
       {
-        int32_t partNumber = iteratorBodyPart->getPartID();
-        if (partModels.find(partNumber) == partModels.end())
+        PartModel &partModel = partModels.at(partNumber);
+        const vector <uint32_t> *partBins = 0;
+        uint32_t partCount, bgCount;
+        int blankPixelsCount;
+        try
+        {
+          partBins = &partPixelBins.at(partNumber); // part histogram for current bodypart
+          partCount = partPixelsCount.at(partNumber);
+        }
+        catch (...)
         {
-          PartModel model(nBins);
-          partModels.insert(pair <int32_t, PartModel>(partNumber, model)); //add a new model to end of models list
+          stringstream ss;
+          ss << "There is no such partPixelBins for body part " << partNumber;
+          if (debugLevelParam >= 1)
+            cerr << ERROR_HEADER << ss.str() << endl;
+          throw logic_error(ss.str());
         }
         try
         {
-          PartModel partModel = partModels.at(partNumber);
-          vector <Point3i> partPixelColoursVector; // temporary variable
-          vector <Point3i> bgPixelColoursVector; // temporary variable
-          int blankPixelsCount;
-          try
-          {
-            partPixelColoursVector = partPixelColours.at(partNumber); // copy part color set for current bodypart
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "There is no such partPixelColours for body part " << partNumber;
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-          try
-          {
-            blankPixelsCount = blankPixels.at(partNumber);  // copy blanck pixel count for current bodypart
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "There is no such blankPixels for body part " << partNumber;
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-          try
-          {
-            bgPixelColoursVector = bgPixelColours.at(partNumber); // copy background color set for current bodypart
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "There is no such bgPixelColours for body part " << partNumber;
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-          addPartHistogram(partModel, partPixelColoursVector, blankPixelsCount); // building histogram for current bodypart colours
-          addBackgroundHistogram(partModel, bgPixelColoursVector); // building histograms for current bodypart background colours
-          partModels.at(partNumber) = partModel; // copy result to part models set
-          if (debugLevelParam >= 2)
-            cerr << "Found part model: " << partNumber << endl;
+          blankPixelsCount = blankPixels.at(partNumber);  // copy blanck pixel count for current bodypart
         }
         catch (...)
         {
           stringstream ss;
-          ss << "Could not find part model " << partNumber;
+          ss << "There is no such blankPixels for body part " << partNumber;
           if (debugLevelParam >= 1)
             cerr << ERROR_HEADER << ss.str() << endl;
           throw logic_error(ss.str());
         }
-
+        // background histogram for current bodypart
+        for (size_t k = 0; k < binsCount; k++)
+          bgPixelBins[k] = freePixelBins[k] + ownedPixelBins[k] - (*partBins)[k];
+        bgCount = freePixelsCount + ownedPixelsCount - partCount;
+        addPartHistogram(partModel, *partBins, partCount, blankPixelsCount); // building histogram for current bodypart colours
+        addBackgroundHistogram(partModel, bgPixelBins, bgCount); // building histograms for current bodypart background colours
+        if (debugLevelParam >= 2)
+          cerr << "Found part model: " << partNumber << endl;
+      }
+      catch (...)
+      {
+        stringstream ss;
+        ss << "Could not find part model " << partNumber;
+        if (debugLevelParam >= 1)
+          cerr << ERROR_HEADER << ss.str() << endl;
+        throw logic_error(ss.str());
       }
-      delete workFrame;
+
     }
+    delete workFrame;
   }
 
-  // Returns a labels vector of possible body parts position
-  map <uint32_t, vector <LimbLabel> > ColorHistDetector::detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels)
+  // Builds the map of the part ID, owning each pixel of the image, or -1 for the pixels outside of all polygons
+  // The first polygon of the list, containing the pixel, owns it until the polygon with lower depth is found
+  Mat ColorHistDetector::buildPartsOwnership(const vector <pair <int32_t, POSERECT <Point2f>>> &polygons, const vector <float> &polyDepth, Size size) const
   {
-    const string sUseCSdet = "useCSdet";
-
-    params.emplace(sUseCSdet, useCSdet);
-
-    //now set actual param values
-    useCSdet = params.at(sUseCSdet);
-
-    pixelDistributions = buildPixelDistributions(frame); // matrix contains the probability that the particular pixel belongs to current bodypart
-    pixelLabels = buildPixelLabels(frame, pixelDistributions); // matrix contains relative estimations that the particular pixel belongs to current bodypart
-
-    auto result = Detector::detect(frame, params, limbLabels);
-
-    for (auto &&var : pixelDistributions)
+    if (polygons.size() != polyDepth.size())
     {
-      var.second.release();
+      stringstream ss;
+      ss << "There are " << polygons.size() << " polygons and " << polyDepth.size() << " depths";
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
     }
-    pixelDistributions.clear();
-
-    for (auto &&var : pixelLabels)
+    Mat partsOwnership(size, CV_32SC1, Scalar(-1));
+    Mat ownerDepth(size, CV_32FC1, Scalar(0));
+    for (size_t p = 0; p < polygons.size(); p++)
     {
-      var.second.release();
+      auto partID = polygons[p].first;
+      auto depth = polyDepth[p];
+      // Only the pixels strictly inside of the polygon are taken
+      polygons[p].second.ForEachRowSpan(Rect(0, 0, size.width, size.height), false, [&](int y, int xBegin, int xEnd)
+      {
+        auto ownershipRow = partsOwnership.ptr<int32_t>(y);
+        auto depthRow = ownerDepth.ptr<float>(y);
+        for (auto x = xBegin; x < xEnd; x++)
+        {
+          if (ownershipRow[x] == -1 || depth < depthRow[x])
+          {
+            ownershipRow[x] = partID;
+            depthRow[x] = depth;
+          }
+        }
+      });
     }
-    pixelLabels.clear();
-
-    return result;
+    return partsOwnership;
   }
 
   // Return nBins
@@ -532,22 +430,100 @@ namespace SPEL
     return nBins;
   }
 
+  namespace
+  {
+    // The colour intervals of 8, 16 and 32 bins are 32, 16 and 8 intensities wide,
+    // so both the quantization and the packing of the bin index are the constant shifts
+    template <uint32_t binsCount> void quantizeRowKernel(const Vec3b *pixels, uint32_t count, uint32_t *bins)
+    {
+      static_assert(binsCount == 8 || binsCount == 16 || binsCount == 32, "Only 8, 16 and 32 bins have the specialised kernel");
+      const uint32_t binBits = (binsCount == 8) ? 3 : ((binsCount == 16) ? 4 : 5);
+      const uint32_t intervalBits = 8 - binBits;
+      for (uint32_t i = 0; i < count; i++)
+      {
+        const auto &pixel = pixels[i];
+        bins[i] = ((static_cast <uint32_t> (pixel[2]) >> intervalBits) << (2 * binBits)) | ((static_cast <uint32_t> (pixel[1]) >> intervalBits) << binBits) | (static_cast <uint32_t> (pixel[0]) >> intervalBits);
+      }
+    }
+  }
+
+  // The bin of the pixel is getBinIndex of the colour intervals of its red, green and blue intensities
+  void ColorHistDetector::quantizeRow(const Vec3b *pixels, uint32_t count, uint32_t *bins) const
+  {
+    switch (nBins)
+    {
+    case 8:
+      quantizeRowKernel<8>(pixels, count, bins);
+      break;
+    case 16:
+      quantizeRowKernel<16>(pixels, count, bins);
+      break;
+    case 32:
+      quantizeRowKernel<32>(pixels, count, bins);
+      break;
+    default:
+      for (uint32_t i = 0; i < count; i++)
+      {
+        const auto &pixel = pixels[i];
+        bins[i] = (colourIntervals[pixel[2]] * nBins + colourIntervals[pixel[1]]) * nBins + colourIntervals[pixel[0]];
+      }
+    }
+  }
+
   // Returns relative frequency of the RGB-color reiteration in "PartModel" 
-  float ColorHistDetector::computePixelBelongingLikelihood(const PartModel &partModel, uint8_t r, uint8_t g, uint8_t b)
+  float ColorHistDetector::computePixelBelongingLikelihood(const PartModel &partModel, uint8_t r, uint8_t g, uint8_t b) const
   { // Scaling of colorspace, finding the colors interval, which now gets this color
     uint8_t factor = static_cast<uint8_t> (ceil(pow(2, 8) / partModel.nBins));
-    try
+    return partModel.partHistogram[partModel.getBinIndex(r / factor, g / factor, b / factor)]; // relative frequency of current color reiteration 
+  }
+
+  // Scales all the bins of the histogram, the contiguous loop is vectorized by the compiler
+  void ColorHistDetector::scaleHistogram(vector <float> &histogram, float multiplier, float divisor)
+  {
+    auto bins = histogram.data();
+    auto binsCount = histogram.size();
+    if (multiplier != 1.0f)
+      for (size_t i = 0; i < binsCount; i++)
+        bins[i] *= multiplier;
+    if (divisor != 1.0f)
+      for (size_t i = 0; i < binsCount; i++)
+        bins[i] /= divisor;
+  }
+
+  // Adds the colors to the not normalised histogram
+  void ColorHistDetector::accumulateHistogram(vector <float> &histogram, uint8_t modelBins, const vector <Point3i> &colors) const
+  {
+    auto factor = static_cast <int> (ceil(pow(2, 8) / modelBins)); // colorspace scaling coefficient
+    for (const auto &color : colors)
     {
-      return partModel.partHistogram.at(r / factor).at(g / factor).at(b / factor); // relative frequency of current color reiteration 
+      auto r = color.x / factor, g = color.y / factor, b = color.z / factor;
+      if (r < 0 || g < 0 || b < 0 || r >= modelBins || g >= modelBins || b >= modelBins)
+      {
+        stringstream ss;
+        ss << "Couldn't find histogram bin " << "[" << r << "][" << g << "][" << b << "]";
+        if (debugLevelParam >= 1)
+          cerr << ERROR_HEADER << ss.str() << endl;
+        throw logic_error(ss.str());
+      }
+      histogram[(static_cast <size_t> (r) * modelBins + g) * modelBins + b]++; // increment the frequency of interval, that this color have hit
     }
-    catch (...)
+  }
+
+  // Adds the pixels counts of the bins to the not normalised histogram
+  void ColorHistDetector::accumulateHistogram(vector <float> &histogram, const vector <uint32_t> &bins) const
+  {
+    if (histogram.size() != bins.size())
     {
       stringstream ss;
-      ss << "Couldn't find partHistogram " << "[" << (int)r / factor << "][" << (int)g / factor << "][" << (int)b / factor << "]";
+      ss << "Couldn't add " << bins.size() << " bins to the histogram of " << histogram.size() << " bins";
       if (debugLevelParam >= 1)
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
+    auto histogramBins = histogram.data();
+    auto binsCount = histogram.size();
+    for (size_t i = 0; i < binsCount; i++)
+      histogramBins[i] += static_cast <float> (bins[i]);
   }
 
   // Build into the "partModel" a histogram of the color set "partColors"
@@ -556,87 +532,17 @@ namespace SPEL
     // do not add sample if the number of pixels is zero
     if (partColors.size() == 0)
       return;
-    uint8_t factor = static_cast<uint8_t> (ceil(pow(2, 8) / partModel.nBins)); // colorspace scaling coefficient
     partModel.sizeFG = static_cast <uint32_t> (partColors.size());
     partModel.fgNumSamples = 1;
     partModel.fgSampleSizes.clear();
     partModel.fgSampleSizes.push_back(static_cast <uint32_t> (partColors.size()));
 
     // clear histogram first
-    for (uint8_t r = 0; r < partModel.nBins; r++)
-    {
-      for (uint8_t g = 0; g < partModel.nBins; g++)
-      {
-        for (uint8_t b = 0; b < partModel.nBins; b++)
-        {
-          try
-          {
-            partModel.partHistogram.at(r).at(g).at(b) = 0.0;
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-        }
-      }
-    }
+    fill(partModel.partHistogram.begin(), partModel.partHistogram.end(), 0.0f);
     // Scaling of colorspace, reducing the capacity and number of colour intervals that are used to construct the histogram
-    for (uint32_t i = 0; i < partColors.size(); i++)
-    {
-      uint8_t r, g, b;
-      try
-      {
-        r = static_cast<uint8_t> (partColors.at(i).x / factor);
-        g = static_cast<uint8_t> (partColors.at(i).y / factor);
-        b = static_cast<uint8_t> (partColors.at(i).z / factor);
-      }
-      catch (...)
-      {
-        stringstream ss;
-        ss << "Couldn't get partColors with index " << i;
-        if (debugLevelParam >= 1)
-          cerr << ERROR_HEADER << ss.str() << endl;
-        throw logic_error(ss.str());
-      }
-      try
-      {
-        partModel.partHistogram.at(r).at(g).at(b)++; // increment the frequency of interval, that this color have hit
-      }
-      catch (...)
-      {
-        stringstream ss;
-        ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "][" << b << "]";
-        if (debugLevelParam >= 1)
-          cerr << ERROR_HEADER << ss.str() << endl;
-        throw logic_error(ss.str());
-      }
-    }
-    for (uint8_t r = 0; r < partModel.nBins; r++)
-    {
-      for (uint8_t g = 0; g < partModel.nBins; g++)
-      {
-        for (uint8_t b = 0; b < partModel.nBins; b++)
-        {
-          // normalise the histograms
-          try
-          {
-            partModel.partHistogram.at(r).at(g).at(b) /= partModel.sizeFG;
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-        }
-      }
-    }
+    accumulateHistogram(partModel.partHistogram, partModel.nBins, partColors);
+    // normalise the histograms
+    scaleHistogram(partModel.partHistogram, 1.0f, static_cast <float> (partModel.sizeFG));
   }
 
   // Take stock of the additional set of colors in the histogram
@@ -644,97 +550,45 @@ namespace SPEL
   {
     if (partColors.size() == 0) //do not add sample if the number of pixels is zero
       return;
-    //un-normalise
-    for (uint8_t r = 0; r < partModel.nBins; r++)
-    {
-      for (uint8_t g = 0; g < partModel.nBins; g++)
-      {
-        for (uint8_t b = 0; b < partModel.nBins; b++)
-        {
-          try
-          {
-            partModel.partHistogram.at(r).at(g).at(b) *= partModel.sizeFG; // converting the colors relative frequency into the pixels number
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-        }
-      }
-    }
+    //un-normalise: converting the colors relative frequency into the pixels number
+    scaleHistogram(partModel.partHistogram, static_cast <float> (partModel.sizeFG), 1.0f);
 
-    int factor = (int)ceil(pow(2, 8) / partModel.nBins); // colorspace scaling coefficient
     partModel.sizeFG += static_cast <uint32_t> (partColors.size());
     partModel.fgNumSamples++;
     partModel.fgSampleSizes.push_back(static_cast <uint32_t> (partColors.size()));
 
     // Scaling of colorspace, reducing the capacity and number of colour intervals
     // Adjustment of the histogram
-    for (uint32_t i = 0; i < partColors.size(); i++)
-    {
-      Point3i color;
-      try
-      {
-        color = partColors.at(i);
-      }
-      catch (...)
-      {
-        stringstream ss;
-        ss << "Couldn't find partColor " << "[" << i << "]";
-        if (debugLevelParam >= 1)
-          cerr << ERROR_HEADER << ss.str() << endl;
-        throw logic_error(ss.str());
-      }
-      uint8_t r = static_cast<uint8_t> (color.x / factor);
-      uint8_t g = static_cast<uint8_t> (color.y / factor);
-      uint8_t b = static_cast<uint8_t> (color.z / factor);
-      try
-      {
-        partModel.partHistogram.at(r).at(g).at(b)++; // increment the frequency of interval, that this color have hit
-      }
-      catch (...)
-      {
-        stringstream ss;
-        ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "][" << b << "]";
-        if (debugLevelParam >= 1)
-          cerr << ERROR_HEADER << ss.str() << endl;
-        throw logic_error(ss.str());
-      }
-    }
+    accumulateHistogram(partModel.partHistogram, partModel.nBins, partColors);
 
     //renormalise
-    for (uint8_t r = 0; r < partModel.nBins; r++)
-    {
-      for (uint8_t g = 0; g < partModel.nBins; g++)
-      {
-        for (uint8_t b = 0; b < partModel.nBins; b++)
-        {
-          //normalise the histograms
-          try
-          {
-            partModel.partHistogram.at(r).at(g).at(b) /= partModel.sizeFG;
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-        }
-      }
-    }
+    scaleHistogram(partModel.partHistogram, 1.0f, static_cast <float> (partModel.sizeFG));
+
+    partModel.fgBlankSizes.push_back(nBlankPixels); // add the number of blank pixels for this model
+  }
+
+  // Take stock of the additional pixels, given by the not normalised histogram "partBins"
+  void ColorHistDetector::addPartHistogram(PartModel &partModel, const vector <uint32_t> &partBins, uint32_t partPixelsCount, uint32_t nBlankPixels)
+  {
+    if (partPixelsCount == 0) //do not add sample if the number of pixels is zero
+      return;
+    //un-normalise: converting the colors relative frequency into the pixels number
+    scaleHistogram(partModel.partHistogram, static_cast <float> (partModel.sizeFG), 1.0f);
+
+    partModel.sizeFG += partPixelsCount;
+    partModel.fgNumSamples++;
+    partModel.fgSampleSizes.push_back(partPixelsCount);
+
+    accumulateHistogram(partModel.partHistogram, partBins);
+
+    //renormalise
+    scaleHistogram(partModel.partHistogram, 1.0f, static_cast <float> (partModel.sizeFG));
 
     partModel.fgBlankSizes.push_back(nBlankPixels); // add the number of blank pixels for this model
   }
 
   // Totalization the number of used samples
-  float ColorHistDetector::getAvgSampleSizeFg(const PartModel &partModel)
+  float ColorHistDetector::getAvgSampleSizeFg(const PartModel &partModel) const
   {
     float sum = 0;
     for (uint32_t i = 0; i < partModel.fgSampleSizes.size(); i++)
@@ -757,7 +611,7 @@ namespace SPEL
   }
 
   // Averaging the number of samples, that united from two sets
-  float ColorHistDetector::getAvgSampleSizeFgBetween(const PartModel &partModel, uint32_t s1, uint32_t s2)
+  float ColorHistDetector::getAvgSampleSizeFgBetween(const PartModel &partModel, uint32_t s1, uint32_t s2) const
   {
     if (s1 >= partModel.fgSampleSizes.size() || s2 >= partModel.fgSampleSizes.size())
       return 0;
@@ -775,34 +629,24 @@ namespace SPEL
     }
   }
 
-  //TODO (Vitaliy Koshura): Need unit test
   // Euclidean distance between part histograms
-  float ColorHistDetector::matchPartHistogramsED(const PartModel &partModelPrev, const PartModel &partModel)
+  float ColorHistDetector::matchPartHistogramsED(const PartModel &partModelPrev, const PartModel &partModel) const
   {
-    float distance = 0;
-    for (uint8_t r = 0; r < partModel.nBins; r++)
+    if (partModel.partHistogram.size() != partModelPrev.partHistogram.size())
     {
-      for (uint8_t g = 0; g < partModel.nBins; g++)
-      {
-        for (uint8_t b = 0; b < partModel.nBins; b++)
-        {
-          // accumulation of the Euclidean distances between the points
-          try
-          {
-            distance += pow(partModel.partHistogram.at(r).at(g).at(b) - partModelPrev.partHistogram.at(r).at(g).at(b), 2);
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find partHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-        }
-      }
+      stringstream ss;
+      ss << "Couldn't match histograms with " << (int)partModelPrev.nBins << " and " << (int)partModel.nBins << " bins";
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
     }
-    return sqrt(distance);
+    if (partModel.partHistogram.size() == 0)
+      return 0;
+    // The vectorized L2 norm of OpenCV over the flat histograms
+    auto binsCount = static_cast <int> (partModel.partHistogram.size());
+    Mat histogram(1, binsCount, CV_32F, const_cast <float*> (partModel.partHistogram.data()));
+    Mat histogramPrev(1, binsCount, CV_32F, const_cast <float*> (partModelPrev.partHistogram.data()));
+    return static_cast <float> (norm(histogram, histogramPrev, NORM_L2));
   }
 
   // Background histogram
@@ -811,85 +655,62 @@ namespace SPEL
     if (bgColors.size() == 0)
       return;
     // unnormalise
-    for (uint8_t r = 0; r < partModel.nBins; r++)
-    {
-      for (uint8_t g = 0; g < partModel.nBins; g++)
-      {
-        for (uint8_t b = 0; b < partModel.nBins; b++)
-        {
-          try
-          {
-            partModel.bgHistogram.at(r).at(g).at(b) *= partModel.sizeBG;
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find bgHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-        }
-      }
-    }
-    uint32_t factor = (uint32_t)ceil(pow(2, 8) / partModel.nBins); // colorspace scaling coefficient
+    scaleHistogram(partModel.bgHistogram, static_cast <float> (partModel.sizeBG), 1.0f);
     partModel.sizeBG += static_cast <uint32_t> (bgColors.size());
     partModel.bgNumSamples++;
     partModel.bgSampleSizes.push_back(static_cast <uint32_t> (bgColors.size()));
-    for (uint32_t i = 0; i < bgColors.size(); i++)
+    accumulateHistogram(partModel.bgHistogram, partModel.nBins, bgColors);
+    // renormalise
+    scaleHistogram(partModel.bgHistogram, 1.0f, static_cast <float> (partModel.sizeBG));
+  }
+
+  // Background histogram, given by the not normalised histogram "bgBins"
+  void ColorHistDetector::addBackgroundHistogram(PartModel &partModel, const vector <uint32_t> &bgBins, uint32_t bgPixelsCount)
+  {
+    if (bgPixelsCount == 0)
+      return;
+    // unnormalise
+    scaleHistogram(partModel.bgHistogram, static_cast <float> (partModel.sizeBG), 1.0f);
+    partModel.sizeBG += bgPixelsCount;
+    partModel.bgNumSamples++;
+    partModel.bgSampleSizes.push_back(bgPixelsCount);
+    accumulateHistogram(partModel.bgHistogram, bgBins);
+    // renormalise
+    scaleHistogram(partModel.bgHistogram, 1.0f, static_cast <float> (partModel.sizeBG));
+  }
+
+  // Builds the likelihoods of all the colour intervals for the listed parts, the likelihoods of all parts for the same interval are adjacent
+  vector <float> ColorHistDetector::buildLikelihoodTable(const vector <int32_t> &partIDs) const
+  {
+    auto binsCount = static_cast <size_t> (nBins) * nBins * nBins;
+    auto partsCount = partIDs.size();
+    vector <float> likelihoodTable(binsCount * partsCount);
+    for (size_t p = 0; p < partsCount; p++)
     {
-      Point3i color;
-      try
-      {
-        color = bgColors.at(i);
-      }
-      catch (...)
+      auto partModel = partModels.find(partIDs[p]);
+      if (partModel == partModels.end() || partModel->second.partHistogram.size() != binsCount)
       {
         stringstream ss;
-        ss << "Couldn't find bgColors " << "[" << i << "]";
-        if (debugLevelParam >= 1)
-          cerr << ERROR_HEADER << ss.str() << endl;
-        throw logic_error(ss.str());
-      }
-      try
-      {
-        partModel.bgHistogram.at(color.x / factor).at(color.y / factor).at(color.z / factor)++; // increment the frequency of interval, that this color have hit
-      }
-      catch (...)
-      {
-        stringstream ss;
-        ss << "Couldn't find bgHistogram " << "[" << color.x / factor << "][" << color.y / factor << "][" << color.z / factor << "]";
+        ss << "Maybe couldn't find partModel " << partIDs[p];
         if (debugLevelParam >= 1)
           cerr << ERROR_HEADER << ss.str() << endl;
         throw logic_error(ss.str());
       }
+      auto histogram = partModel->second.partHistogram.data();
+      for (size_t bin = 0; bin < binsCount; bin++)
+        likelihoodTable[bin * partsCount + p] = histogram[bin];
     }
-    // renormalise
-    for (uint8_t r = 0; r < partModel.nBins; r++)
-    {
-      for (uint8_t g = 0; g < partModel.nBins; g++)
-      {
-        for (uint8_t b = 0; b < partModel.nBins; b++)
-        {
-          try
-          {
-            partModel.bgHistogram.at(r).at(g).at(b) /= (float)partModel.sizeBG;
-          }
-          catch (...)
-          {
-            stringstream ss;
-            ss << "Couldn't find bgHistogram " << "[" << r << "][" << g << "][" << b << "]";
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-        }
-      }
-    }
+    return likelihoodTable;
   }
 
   // Returns a matrix, that contains relative frequency of the pixels colors reiteration 
-  map <int32_t, Mat> ColorHistDetector::buildPixelDistributions(Frame *frame)
+  map <int32_t, Mat> ColorHistDetector::buildPixelDistributions(const Frame *frame) const
+  {
+    return buildPixelDistributions(frame, 1);
+  }
+
+  // The same, the rows of the frame are split between "threadsCount" threads by bands
+  map <int32_t, Mat> ColorHistDetector::buildPixelDistributions(const Frame *frame, uint32_t threadsCount) const
   {
     Skeleton skeleton = frame->getSkeleton(); // copy skeleton from the frame
     tree <BodyPart> partTree = skeleton.getPartTree(); // copy part tree from the skeleton
@@ -908,46 +729,165 @@ namespace SPEL
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
-    // For all bodyparts
+    vector <int32_t> partIDs;
     for (tree <BodyPart>::iterator iteratorBodyPart = partTree.begin(); iteratorBodyPart != partTree.end(); ++iteratorBodyPart)
+      partIDs.push_back(iteratorBodyPart->getPartID());
+    if (partIDs.empty())
+      return pixelDistributions;
+    // The pixel colour is quantized once, then the likelihoods of all bodyparts are taken from the adjacent cells of the table
+    auto likelihoodTable = buildLikelihoodTable(partIDs);
+    auto partsCount = partIDs.size();
+    vector <Mat> distributions;
+    for (size_t p = 0; p < partsCount; p++)
+      distributions.push_back(Mat(height, width, DataType <float>::type)); // create empty matrix
+
+    auto buildRows = [&](uint32_t firstRow, uint32_t lastRow)
     {
-      Mat t = Mat(height, width, DataType <float>::type); // create empty matrix
-      int partID = iteratorBodyPart->getPartID();
-      try
+      vector <float*> partRows(partsCount);
+      vector <uint32_t> rowBins(width);
+      for (auto y = firstRow; y < lastRow; y++)
       {
-        PartModel partModel = partModels.at(partID); // copy part model of current bodybart
-        // For all pixels
+        auto imgRow = imgMat.ptr<Vec3b>(y);
+        auto maskRow = maskMat.ptr<uint8_t>(y);
+        for (size_t p = 0; p < partsCount; p++)
+          partRows[p] = distributions[p].ptr<float>(y);
+        quantizeRow(imgRow, width, rowBins.data());
         for (uint32_t x = 0; x < width; x++)
         {
-          for (uint32_t y = 0; y < height; y++)
+          if (maskRow[x] < 10) // pixel is not significant if the mask value is less than this threshold
           {
-            Vec3b intensity = imgMat.at<Vec3b>(y, x);
-            // Copy components of the current pixel color
-            uint8_t blue = intensity.val[0];
-            uint8_t green = intensity.val[1];
-            uint8_t red = intensity.val[2];
-            uint8_t mintensity = maskMat.at<uint8_t>(y, x); // copy mask of the current pixel
-            bool blackPixel = mintensity < 10; // pixel is not significant if the mask value is less than this threshold
-
-            t.at<float>(y, x) = blackPixel ? 0 : computePixelBelongingLikelihood(partModel, red, green, blue); // relative frequency of the current pixel color reiteration 
+            for (size_t p = 0; p < partsCount; p++)
+              partRows[p][x] = 0;
+            continue;
           }
+          auto likelihoods = &likelihoodTable[rowBins[x] * partsCount]; // relative frequencies of the current pixel color reiteration
+          for (size_t p = 0; p < partsCount; p++)
+            partRows[p][x] = likelihoods[p];
         }
       }
-      catch (...)
+    };
+
+    forEachRowsBand(height, threadsCount, buildRows);
+
+    for (size_t p = 0; p < partsCount; p++)
+      pixelDistributions.insert(pair <int32_t, Mat>(partIDs[p], distributions[p])); // add the current bodypart matrix to the set 
+    return pixelDistributions;
+  }
+
+  // Builds the pixel distributions and the pixel labels at once as 16-bit fixed point fractions of "compactMapScale"
+  // Both maps depend only on the colour interval of the pixel, so the values of each interval are computed once
+  // with the same float operations as buildPixelDistributions and buildPixelLabels and then rounded,
+  // so every value differs from the CV_32F maps by at most 0.5 / compactMapScale
+  void ColorHistDetector::buildCompactPixelMaps(const Frame *frame, uint32_t threadsCount, map <int32_t, Mat> &pixelDistributions, map <int32_t, Mat> &pixelLabels) const
+  {
+    Skeleton skeleton = frame->getSkeleton(); // copy skeleton from the frame
+    tree <BodyPart> partTree = skeleton.getPartTree(); // copy part tree from the skeleton
+    Mat imgMat = frame->getImage(); // copy image from the frame
+    Mat maskMat = frame->getMask(); // copy mask from the frame
+    uint32_t width = imgMat.cols;
+    uint32_t height = imgMat.rows;
+    pixelDistributions.clear();
+    pixelLabels.clear();
+    if (width != static_cast <uint32_t> (maskMat.cols) || height != static_cast <uint32_t> (maskMat.rows)) // error if mask and image sizes don't match
+    {
+      stringstream ss;
+      ss << "Mask size not equal image size";
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
+    vector <int32_t> partIDs;
+    for (tree <BodyPart>::iterator iteratorBodyPart = partTree.begin(); iteratorBodyPart != partTree.end(); ++iteratorBodyPart)
+      partIDs.push_back(iteratorBodyPart->getPartID());
+    if (partIDs.empty())
+      return;
+    auto likelihoodTable = buildLikelihoodTable(partIDs);
+    auto partsCount = partIDs.size();
+    auto binsCount = likelihoodTable.size() / partsCount;
+    vector <uint16_t> distributionsTable(likelihoodTable.size()), labelsTable(likelihoodTable.size());
+    for (size_t bin = 0; bin < binsCount; bin++)
+    {
+      auto likelihoods = &likelihoodTable[bin * partsCount];
+      float top = 0;
+      for (size_t p = 0; p < partsCount; p++)
+        if (likelihoods[p] > top) // search max value of the bodyparts pixel color frequency
+          top = likelihoods[p];
+      for (size_t p = 0; p < partsCount; p++)
       {
-        stringstream ss;
-        ss << "Maybe couldn't find partModel " << partID;
-        if (debugLevelParam >= 1)
-          cerr << ERROR_HEADER << ss.str() << endl;
-        throw logic_error(ss.str());
+        distributionsTable[bin * partsCount + p] = saturate_cast <uint16_t> (likelihoods[p] * compactMapScale);
+        labelsTable[bin * partsCount + p] = saturate_cast <uint16_t> (((top == 0) ? 0 : likelihoods[p] / top) * compactMapScale);
       }
-      pixelDistributions.insert(pair <int32_t, Mat>(partID, t)); // add the current bodypart matrix to the set 
     }
-    return pixelDistributions;
+    vector <Mat> distributions, labels;
+    for (size_t p = 0; p < partsCount; p++)
+    {
+      distributions.push_back(Mat(height, width, CV_16UC1));
+      labels.push_back(Mat(height, width, CV_16UC1));
+    }
+
+    auto buildRows = [&](uint32_t firstRow, uint32_t lastRow)
+    {
+      vector <uint16_t*> distributionRows(partsCount), labelRows(partsCount);
+      vector <uint32_t> rowBins(width);
+      for (auto y = firstRow; y < lastRow; y++)
+      {
+        auto imgRow = imgMat.ptr<Vec3b>(y);
+        auto maskRow = maskMat.ptr<uint8_t>(y);
+        for (size_t p = 0; p < partsCount; p++)
+        {
+          distributionRows[p] = distributions[p].ptr<uint16_t>(y);
+          labelRows[p] = labels[p].ptr<uint16_t>(y);
+        }
+        quantizeRow(imgRow, width, rowBins.data());
+        for (uint32_t x = 0; x < width; x++)
+        {
+          if (maskRow[x] < 10) // pixel is not significant if the mask value is less than this threshold
+          {
+            for (size_t p = 0; p < partsCount; p++)
+              distributionRows[p][x] = labelRows[p][x] = 0;
+            continue;
+          }
+          auto binDistributions = &distributionsTable[rowBins[x] * partsCount];
+          auto binLabels = &labelsTable[rowBins[x] * partsCount];
+          for (size_t p = 0; p < partsCount; p++)
+          {
+            distributionRows[p][x] = binDistributions[p];
+            labelRows[p][x] = binLabels[p];
+          }
+        }
+      }
+    };
+    forEachRowsBand(height, threadsCount, buildRows);
+
+    for (size_t p = 0; p < partsCount; p++)
+    {
+      pixelDistributions.insert(pair <int32_t, Mat>(partIDs[p], distributions[p]));
+      pixelLabels.insert(pair <int32_t, Mat>(partIDs[p], labels[p]));
+    }
+  }
+
+  // Splits the rows [0, rowsCount) into "threadsCount" bands, the bands are processed by "job" concurrently
+  void ColorHistDetector::forEachRowsBand(uint32_t rowsCount, uint32_t threadsCount, function <void(uint32_t, uint32_t)> job)
+  {
+    auto bandsCount = min(max(threadsCount, 1U), max(rowsCount, 1U));
+    if (bandsCount <= 1)
+    {
+      job(0, rowsCount);
+      return;
+    }
+    vector <future <void>> futures;
+    for (uint32_t band = 0; band < bandsCount; band++)
+    {
+      auto firstRow = static_cast <uint32_t> (static_cast <uint64_t> (rowsCount) * band / bandsCount);
+      auto lastRow = static_cast <uint32_t> (static_cast <uint64_t> (rowsCount) * (band + 1) / bandsCount);
+      futures.push_back(async(launch::async, job, firstRow, lastRow));
+    }
+    for (auto &&f : futures)
+      f.get();
   }
 
 
-  map <int32_t, Mat> ColorHistDetector::buildPixelLabels(Frame *frame, map <int32_t, Mat> pixelDistributions)
+  map <int32_t, Mat> ColorHistDetector::buildPixelLabels(const Frame *frame, const map <int32_t, Mat> &pixelDistributions) const
   {
     Mat maskMat = frame->getMask(); // copy mask from the frame
     uint32_t width = maskMat.cols;
@@ -955,16 +895,12 @@ namespace SPEL
     Skeleton skeleton = frame->getSkeleton(); // copy skeleton from the frame
     tree <BodyPart> partTree = skeleton.getPartTree(); // copy part tree from the skeleton
     map <int32_t, Mat> pixelLabels;
+    vector <Mat> distributions, labels;
     // For all body parts
     for (tree <BodyPart>::iterator iteratorBodyPart = partTree.begin(); iteratorBodyPart != partTree.end(); ++iteratorBodyPart)
     {
-      Mat t = Mat(height, width, DataType <float>::type); // create empty matrix
-      Mat tt;
-      try
-      { // Matrix, that contains relative frequency of the pixels colors reiteration for current body part
-        tt = pixelDistributions.at(iteratorBodyPart->getPartID());
-      }
-      catch (...)
+      auto distribution = pixelDistributions.find(iteratorBodyPart->getPartID()); // matrix of the pixels colors frequency for current body part
+      if (distribution == pixelDistributions.end() || distribution->second.type() != DataType <float>::type || distribution->second.rows != static_cast <int> (height) || distribution->second.cols != static_cast <int> (width))
       {
         stringstream ss;
         ss << "Couldn't find distributions for body part " << iteratorBodyPart->getPartID();
@@ -972,115 +908,48 @@ namespace SPEL
           cerr << ERROR_HEADER << ss.str() << endl;
         throw logic_error(ss.str());
       }
-      // For all pixels
+      distributions.push_back(distribution->second);
+      labels.push_back(Mat(height, width, DataType <float>::type)); // create empty matrix
+      pixelLabels.insert(pair<int32_t, Mat>(iteratorBodyPart->getPartID(), labels.back())); // insert the resulting matrix into the set "pixelLabels" 
+    }
+    // The max value across the parts is found once for each pixel, then all the part labels are normalised by it
+    auto partsCount = distributions.size();
+    vector <const float*> distributionRows(partsCount);
+    vector <float*> labelRows(partsCount);
+    for (uint32_t y = 0; y < height; y++)
+    {
+      auto maskRow = maskMat.ptr<uint8_t>(y);
+      for (size_t p = 0; p < partsCount; p++)
+      {
+        distributionRows[p] = distributions[p].ptr<float>(y);
+        labelRows[p] = labels[p].ptr<float>(y);
+      }
       for (uint32_t x = 0; x < width; x++)
       {
-        for (uint32_t y = 0; y < height; y++)
+        bool blackPixel = maskRow[x] < 10; // pixel is not significant if the mask value is less than this threshold
+        float top = 0;
+        if (!blackPixel)
         {
-          uint8_t mintensity = maskMat.at<uint8_t>(y, x); //copy the current pixel mask value
-          bool blackPixel = mintensity < 10; // pixel is not significant if the mask value is less than this threshold
-          if (!blackPixel)
-          {
-            float top = 0;
-            float sum = 0;
-            // For all body parts
-            for (tree <BodyPart>::iterator i = partTree.begin(); i != partTree.end(); ++i)
-            {
-              Mat temp;
-              try
-              {
-                temp = pixelDistributions.at(i->getPartID()); // matrix of the pixels colors frequency for current body part
-              }
-              catch (...)
-              {
-                stringstream ss;
-                ss << "Couldn't find pixel distributions for body part " << i->getPartID();
-                if (debugLevelParam >= 1)
-                  cerr << ERROR_HEADER << ss.str() << endl;
-                throw logic_error(ss.str());
-              }
-              try
-              {
-                if (temp.at<float>(y, x) > top) // search max value of the current bodypart pixel color frequency
-                  top = temp.at<float>(y, x);
-                sum += temp.at<float>(y, x);
-              }
-              catch (...)
-              {
-                stringstream ss;
-                ss << "Couldn't find value of temp " << "[" << y << "][" << x << "]";
-                if (debugLevelParam >= 1)
-                  cerr << ERROR_HEADER << ss.str() << endl;
-                throw logic_error(ss.str());
-              }
-            }
-            try
-            {
-              t.at<float>(y, x) = (top == 0) ? 0 : tt.at<float>(y, x) / (float)top;
-            }
-            catch (...)
-            {
-              stringstream ss;
-              ss << "Couldn't find t " << "[" << y << "][" << x << "] or tt [" << y << "][" << x << "]";
-              if (debugLevelParam >= 1)
-                cerr << ERROR_HEADER << ss.str() << endl;
-              throw logic_error(ss.str());
-            }
-          }
-          else
-          {
-            try
-            {
-              t.at<float>(y, x) = 0;
-            }
-            catch (...)
-            {
-              stringstream ss;
-              ss << "Couldn't find value of t " << "[" << y << "][" << x << "]";
-              if (debugLevelParam >= 1)
-                cerr << ERROR_HEADER << ss.str() << endl;
-              throw logic_error(ss.str());
-            }
-          }
+          for (size_t p = 0; p < partsCount; p++)
+            if (distributionRows[p][x] > top) // search max value of the current bodypart pixel color frequency
+              top = distributionRows[p][x];
         }
+        for (size_t p = 0; p < partsCount; p++)
+          labelRows[p][x] = (top == 0) ? 0 : distributionRows[p][x] / top;
       }
-      pixelLabels.insert(pair<int32_t, Mat>(iteratorBodyPart->getPartID(), t)); // insert the resulting matrix into the set "pixelLabels" 
     }
     return pixelLabels;
   }
 
-  float ColorHistDetector::compare(void)
+  // Value of the pixel map of either CV_32F or 16-bit fixed point type
+  float ColorHistDetector::getPixelMapValue(const Mat &pixelMap, int32_t row, int32_t col)
   {
-    if (comparer_bodyPart == 0 || comparer_frame == 0 || comparer_j0 == 0 || comparer_j1 == 0)
-    {
-      stringstream ss;
-      ss << "Compare parameters are invalid: " << (comparer_bodyPart == 0 ? "comparer_bodyPart == 0 " : "") << (comparer_frame == 0 ? "comparer_frame == 0 " : "") << (comparer_j0 == 0 ? "comparer_j0 == 0" : "") << (comparer_j1 == 0 ? "comparer_j1 == 0" : "") << endl;
-      if (debugLevelParam >= 1)
-        cerr << ERROR_HEADER << ss.str() << endl;
-      throw logic_error(ss.str());
-    }
-    try
-    {
-      return compare(*comparer_bodyPart, *comparer_frame, pixelDistributions, pixelLabels, *comparer_j0, *comparer_j1);
-    }
-    catch (logic_error ex)
-    {
-      if (debugLevelParam >= 1)
-      {
-          string frameType;
-          if((*comparer_frame)->getFrametype()==KEYFRAME)
-              frameType="Keyframe";
-          else if((*comparer_frame)->getFrametype()==LOCKFRAME)
-              frameType="Lockframe";
-          else
-              frameType="Interpolation";
-        cerr << ERROR_HEADER << "Dirty Label: " << " Frame("<<frameType<< "): " << (*comparer_frame)->getID() << " Part: " << comparer_bodyPart->getPartID() << " " << ex.what() << endl;
-      }
-      return -1.0f;
-    }
+    if (pixelMap.type() == CV_16UC1)
+      return pixelMap.at<uint16_t>(row, col) / static_cast <float> (compactMapScale);
+    return pixelMap.at<float>(row, col);
   }
 
-  float ColorHistDetector::compare(BodyPart bodyPart, Frame *frame, map <int32_t, Mat> pixelDistributions, map <int32_t, Mat> pixelLabels, Point2f j0, Point2f j1)
+  float ColorHistDetector::compare(BodyPart bodyPart, const Frame *frame, const map <int32_t, Mat> &pixelDistributions, const map <int32_t, Mat> &pixelLabels, Point2f j0, Point2f j1) const
   {
     Mat maskMat = frame->getMask(); // copy mask from the frame 
     Mat imgMat = frame->getImage(); // copy image from the frame
@@ -1092,10 +961,10 @@ namespace SPEL
     float totalPixelLabelScore = 0;
     float pixDistAvg = 0;
     float pixDistNum = 0;
-    PartModel model;
+    const PartModel *model = 0;
     try
     {
-      model = partModels.at(bodyPart.getPartID()); // copy part model for the "bodyPart"
+      model = &partModels.at(bodyPart.getPartID()); // part model for the "bodyPart"
     }
     catch (...)
     {
@@ -1105,7 +974,7 @@ namespace SPEL
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
-    if (getAvgSampleSizeFg(model) == 0) // error if samples count is zero
+    if (getAvgSampleSizeFg(*model) == 0) // error if samples count is zero
     {
       stringstream ss;
       ss << "Couldn't get avgSampleSizeFg";
@@ -1113,8 +982,6 @@ namespace SPEL
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
-    float xmax, ymax, xmin, ymin;
-    rect.GetMinMaxXY <float>(xmin, ymin, xmax, ymax); // highlight the extreme points of the body part rect
     Mat bodyPartPixelDistribution;
     try
     {
@@ -1141,6 +1008,14 @@ namespace SPEL
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
+    if (bodyPartPixelDistribution.size() != maskMat.size() || bodyPartLixelLabels.size() != maskMat.size())
+    {
+      stringstream ss;
+      ss << "Can't get pixesDistribution and pixesLabels [" << bodyPart.getPartID() << "] of the mask size";
+      if (debugLevelParam >= 2)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
     // Scan the area near the bodypart center
 
     float searchXMin = boxCenter.x - boneLength * 0.5;
@@ -1148,68 +1023,22 @@ namespace SPEL
     float searchYMin = boxCenter.y - boneLength * 0.5;
     float searchYMax = boxCenter.y + boneLength * 0.5;
 
-    for (float i = searchXMin; i < searchXMax; i++)
+    forEachSampleSpan(rect, Point2f(searchXMin, searchYMin), Point2f(searchXMax, searchYMax), maskMat.size(), [&](int32_t row, int32_t colBegin, int32_t colEnd)
     {
-      for (float j = searchYMin; j < searchYMax; j++)
+      auto maskRow = maskMat.ptr<uint8_t>(row);
+      for (auto col = colBegin; col < colEnd; col++)
       {
-        if (i < maskMat.cols && j < maskMat.rows && i >= 0 && j >= 0) // if the point is within the image
+        totalPixels++; // counting of the contained pixels
+        bool blackPixel = maskRow[col] < 10; // pixel is not significant if the mask value is less than this threshold
+        if (!blackPixel)
         {
-          if (i <= xmax && i >= xmin && j <= ymax && j >= ymin) // if the point within the highlight area
-          {
-            if (rect.containsPoint(Point2f(i, j)) > 0) // if the point belongs to the rectangle
-            {
-              totalPixels++; // counting of the contained pixels
-              uint8_t mintensity = 0;
-              try
-              {
-                mintensity = maskMat.at<uint8_t>((int32_t)j, (int32_t)i); // copy current point mask value 
-              }
-              catch (...)
-              {
-                stringstream ss;
-                ss << "Can't get maskMat [" << (int32_t)j << "][" << (int32_t)i << "]";
-                if (debugLevelParam >= 2)
-                  cerr << ERROR_HEADER << ss.str() << endl;
-                throw logic_error(ss.str());
-              }
-              bool blackPixel = mintensity < 10; // pixel is not significant if the mask value is less than this threshold
-              if (!blackPixel)
-              {
-                try
-                {
-                  pixDistAvg += bodyPartPixelDistribution.at<float>(j, i); // Accumulation the "distributions" of contained pixels
-                }
-                catch (...)
-                {
-                  stringstream ss;
-                  ss << "Can't get pixesDistribution [" << bodyPart.getPartID() << "][" << (int32_t)j << "][" << (int32_t)i << "]";
-                  if (debugLevelParam >= 2)
-                    cerr << ERROR_HEADER << ss.str() << endl;
-                  throw logic_error(ss.str());
-                }
-                pixDistNum++; // counting of the all scanned pixels
-                try
-                {
-                  if (bodyPartLixelLabels.at<float>(j, i))
-                  {
-                    totalPixelLabelScore += bodyPartLixelLabels.at<float>(j, i); // Accumulation of the pixel labels
-                  }
-                }
-                catch (...)
-                {
-                  stringstream ss;
-                  ss << "Can't get pixesLabels [" << bodyPart.getPartID() << "][" << (int32_t)j << "][" << (int32_t)i << "]";
-                  if (debugLevelParam >= 2)
-                    cerr << ERROR_HEADER << ss.str() << endl;
-                  throw logic_error(ss.str());
-                }
-                pixelsInMask++; // counting pixels within the mask
-              }
-            }
-          }
+          pixDistAvg += getPixelMapValue(bodyPartPixelDistribution, row, col); // Accumulation the "distributions" of contained pixels
+          pixDistNum++; // counting of the all scanned pixels
+          totalPixelLabelScore += getPixelMapValue(bodyPartLixelLabels, row, col); // Accumulation of the pixel labels
+          pixelsInMask++; // counting pixels within the mask
         }
       }
-    }
+    });
     float supportScore = 0;
     float inMaskSupportScore = 0;
     pixDistAvg /= (float)pixDistNum;  // average "distributions"
@@ -1228,24 +1057,242 @@ namespace SPEL
     throw logic_error(ss.str());
   }
 
-  LimbLabel ColorHistDetector::generateLabel(BodyPart bodyPart, Frame *frame, Point2f j0, Point2f j1)
+  // Same score as the per-pixel compare, the part rectangle is scanned row by row and each row segment is summed with the row integrals
+  float ColorHistDetector::compare(BodyPart bodyPart, const Frame *frame, const ColorHistDetectorHelper &detectorHelper, Point2f j0, Point2f j1) const
+  {
+    Mat maskMat = frame->getMask(); // copy mask from the frame 
+    auto labelsIntegral = detectorHelper.pixelLabelsIntegrals.find(bodyPart.getPartID());
+    if (labelsIntegral == detectorHelper.pixelLabelsIntegrals.end() || detectorHelper.maskIntegral.rows != maskMat.rows || detectorHelper.maskIntegral.cols != maskMat.cols + 1)
+      return compare(bodyPart, frame, detectorHelper.pixelDistributions, detectorHelper.pixelLabels, j0, j1); // the integrals were not built for this frame
+    const PartModel *model = 0;
+    try
+    {
+      model = &partModels.at(bodyPart.getPartID());
+    }
+    catch (...)
+    {
+      stringstream ss;
+      ss << "Couldn't get partModel of bodyPart " << bodyPart.getPartID();
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
+    if (getAvgSampleSizeFg(*model) == 0) // error if samples count is zero
+    {
+      stringstream ss;
+      ss << "Couldn't get avgSampleSizeFg";
+      if (debugLevelParam >= 2)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
+    Point2f boxCenter = j0 * 0.5 + j1 * 0.5; // segment center
+    float boneLength = getBoneLength(j0, j1); // distance between joints
+    POSERECT <Point2f> rect = getBodyPartRect(bodyPart, j0, j1); // expected bodypart location area
+    float searchXMin = boxCenter.x - boneLength * 0.5;
+    float searchXMax = boxCenter.x + boneLength * 0.5;
+    float searchYMin = boxCenter.y - boneLength * 0.5;
+    float searchYMax = boxCenter.y + boneLength * 0.5;
+
+    uint32_t totalPixels = 0;
+    uint32_t pixelsInMask = 0;
+    float totalPixelLabelScore = 0;
+    int64_t totalPixelLabelUnits = 0; // the sum of the fixed point labels is exact
+    auto compactLabels = labelsIntegral->second.type() == DataType <int32_t>::type;
+    // The same sample points as the per-pixel scan, each row segment is summed at once
+    forEachSampleSpan(rect, Point2f(searchXMin, searchYMin), Point2f(searchXMax, searchYMax), maskMat.size(), [&](int32_t row, int32_t colBegin, int32_t colEnd)
+    {
+      totalPixels += static_cast <uint32_t> (colEnd - colBegin); // counting of the contained pixels
+      pixelsInMask += detectorHelper.maskIntegral.at<int32_t>(row, colEnd) - detectorHelper.maskIntegral.at<int32_t>(row, colBegin); // counting pixels within the mask
+      if (compactLabels)
+        totalPixelLabelUnits += labelsIntegral->second.at<int32_t>(row, colEnd) - labelsIntegral->second.at<int32_t>(row, colBegin);
+      else
+        totalPixelLabelScore += labelsIntegral->second.at<float>(row, colEnd) - labelsIntegral->second.at<float>(row, colBegin); // Accumulation of the pixel labels
+    });
+    if (compactLabels)
+      totalPixelLabelScore = static_cast <float> (static_cast <double> (totalPixelLabelUnits) / compactMapScale);
+    float inMaskSuppWeight = 0.5;
+    if (totalPixelLabelScore > 0 && totalPixels > 10)
+    {
+      float supportScore = (float)totalPixelLabelScore / (float)totalPixels;
+      float inMaskSupportScore = (float)totalPixelLabelScore / (float)pixelsInMask;
+      float score = 1.0f - ((1.0f - inMaskSuppWeight) * supportScore + inMaskSuppWeight * inMaskSupportScore);
+      return score;
+    }
+    stringstream ss;
+    ss << "Dirty label!";
+    if (debugLevelParam >= 2)
+      cerr << ERROR_HEADER << ss.str() << endl;
+    throw logic_error(ss.str());
+  }
+
+  // The sample points of compare are (searchMin.x + k, searchMin.y + m) for the integer k and m, which are below "searchMax",
+  // inside of the image and strictly inside of the rectangle, each sample takes the pixel of its truncated coordinates
+  void ColorHistDetector::forEachSampleSpan(const POSERECT <Point2f> &rect, Point2f searchMin, Point2f searchMax, Size imageSize, function <void(int32_t, int32_t, int32_t)> spanFunction)
+  {
+    auto ymin = min(min(rect.point1.y, rect.point2.y), min(rect.point3.y, rect.point4.y));
+    auto ymax = max(max(rect.point1.y, rect.point2.y), max(rect.point3.y, rect.point4.y));
+    for (float j = searchMin.y; j < searchMax.y; j++)
+    {
+      float left, right;
+      if (j < 0 || j >= imageSize.height || j <= ymin || j >= ymax || !rect.GetRowSpan(j, left, right))
+        continue;
+      auto kFirst = max(max(0.0f, floor(left - searchMin.x) + 1.0f), ceil(-searchMin.x)); // first sample to the right of the left border and inside the image
+      auto kLast = min(min(ceil(right - searchMin.x), ceil(searchMax.x - searchMin.x)), ceil(imageSize.width - searchMin.x)) - 1.0f; // last sample to the left of the right border and inside the image
+      if (kFirst > kLast)
+        continue;
+      auto colBegin = static_cast <int32_t> (searchMin.x + kFirst);
+      auto colEnd = min(colBegin + static_cast <int32_t> (kLast - kFirst) + 1, imageSize.width);
+      spanFunction(static_cast <int32_t> (j), colBegin, colEnd);
+    }
+  }
+
+  // Builds the row integrals of the mask and of the pixel labels inside the mask
+  void ColorHistDetector::buildIntegrals(const Frame *frame, const map <int32_t, Mat> &pixelLabels, Mat &maskIntegral, map <int32_t, Mat> &pixelLabelsIntegrals) const
+  {
+    Mat maskMat = frame->getMask(); // copy mask from the frame
+    auto width = maskMat.cols;
+    auto height = maskMat.rows;
+    maskIntegral = Mat(height, width + 1, DataType <int32_t>::type);
+    for (auto y = 0; y < height; y++)
+    {
+      auto mask = maskMat.ptr<uint8_t>(y);
+      auto integral = maskIntegral.ptr<int32_t>(y);
+      integral[0] = 0;
+      for (auto x = 0; x < width; x++)
+        integral[x + 1] = integral[x] + (mask[x] < 10 ? 0 : 1); // pixel is not significant if the mask value is less than this threshold
+    }
+    pixelLabelsIntegrals.clear();
+    for (auto &&partLabels : pixelLabels)
+    {
+      if (partLabels.second.rows != height || partLabels.second.cols != width)
+      {
+        stringstream ss;
+        ss << "Pixel labels size of body part " << partLabels.first << " not equal mask size";
+        if (debugLevelParam >= 1)
+          cerr << ERROR_HEADER << ss.str() << endl;
+        throw logic_error(ss.str());
+      }
+      Mat t;
+      if (partLabels.second.type() == CV_16UC1)
+      {
+        // The fixed point labels are summed exactly, the sum of the row fits into int32_t while the row is shorter than 2^15 pixels
+        if (width >= (1 << 15))
+        {
+          stringstream ss;
+          ss << "Compact pixel labels of the frame with width " << width << " can't be integrated";
+          if (debugLevelParam >= 1)
+            cerr << ERROR_HEADER << ss.str() << endl;
+          throw logic_error(ss.str());
+        }
+        t = Mat(height, width + 1, DataType <int32_t>::type);
+        for (auto y = 0; y < height; y++)
+        {
+          auto mask = maskMat.ptr<uint8_t>(y);
+          auto labels = partLabels.second.ptr<uint16_t>(y);
+          auto integral = t.ptr<int32_t>(y);
+          integral[0] = 0;
+          for (auto x = 0; x < width; x++)
+            integral[x + 1] = integral[x] + (mask[x] < 10 ? 0 : labels[x]);
+        }
+      }
+      else
+      {
+        t = Mat(height, width + 1, DataType <float>::type);
+        for (auto y = 0; y < height; y++)
+        {
+          auto mask = maskMat.ptr<uint8_t>(y);
+          auto labels = partLabels.second.ptr<float>(y);
+          auto integral = t.ptr<float>(y);
+          integral[0] = 0;
+          for (auto x = 0; x < width; x++)
+            integral[x + 1] = integral[x] + (mask[x] < 10 ? 0 : labels[x]);
+        }
+      }
+      pixelLabelsIntegrals.insert(pair <int32_t, Mat>(partLabels.first, t));
+    }
+  }
+
+  // Builds the pixel maps of the frame, that are used by all the candidates of the current detect call
+  DetectorHelper *ColorHistDetector::createDetectorHelper(const Frame *frame, map <string, float> params) const
+  {
+    const string sUseCSdet = "useCSdet";
+    const string sDetectThreads = "detectThreads"; // the same workers count as for the candidates scoring, 0 - use all available cores
+
+    const string sCompactPixelMaps = "compactPixelMaps"; // 1 - keep the pixel maps as 16-bit fixed point, the rounding of the labels changes the scores by less than 1e-5
+
+    params.emplace(sUseCSdet, useCSdet);
+    params.emplace(sDetectThreads, 1.0f);
+    params.emplace(sCompactPixelMaps, 0.0f);
+
+    auto threadsCount = params.at(sDetectThreads) > 0 ? static_cast <uint32_t> (params.at(sDetectThreads)) : thread::hardware_concurrency();
+
+    unique_ptr <ColorHistDetectorHelper> detectorHelper(new ColorHistDetectorHelper());
+    detectorHelper->useCSdet = params.at(sUseCSdet);
+    if (params.at(sCompactPixelMaps) != 0)
+      buildCompactPixelMaps(frame, threadsCount, detectorHelper->pixelDistributions, detectorHelper->pixelLabels);
+    else
+    {
+      detectorHelper->pixelDistributions = buildPixelDistributions(frame, threadsCount); // matrix contains the probability that the particular pixel belongs to current bodypart
+      detectorHelper->pixelLabels = buildPixelLabels(frame, detectorHelper->pixelDistributions); // matrix contains relative estimations that the particular pixel belongs to current bodypart
+    }
+    buildIntegrals(frame, detectorHelper->pixelLabels, detectorHelper->maskIntegral, detectorHelper->pixelLabelsIntegrals); // region sums of the candidates
+    return detectorHelper.release();
+  }
+
+  float ColorHistDetector::score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const
+  {
+    auto helper = dynamic_cast <ColorHistDetectorHelper*> (detectorHelper);
+    if (helper == 0)
+    {
+      stringstream ss;
+      ss << "Wrong type of detectorHelper";
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
+    return compare(bodyPart, &frame, *helper, j0, j1);
+  }
+
+  LimbLabel ColorHistDetector::generateLabel(BodyPart bodyPart, const Frame *frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const
   {
     stringstream detectorName;
     detectorName << getID();
 
-    comparer_bodyPart = &bodyPart;
-    comparer_frame = &frame;
-    comparer_j0 = &j0;
-    comparer_j1 = &j1;
-
-    LimbLabel label = Detector::generateLabel(bodyPart, j0, j1, detectorName.str(), useCSdet);
+    auto helper = dynamic_cast <ColorHistDetectorHelper*> (detectorHelper);
+    if (helper == 0)
+    {
+      stringstream ss;
+      ss << "Wrong type of detectorHelper";
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
 
-    comparer_bodyPart = 0;
-    comparer_frame = 0;
-    comparer_j0 = 0;
-    comparer_j1 = 0;
+    // All the compare arguments live on the stack of the current call, so the labels can be generated concurrently
+    auto comparer = [&]() -> float
+    {
+      try
+      {
+        return compare(bodyPart, frame, *helper, j0, j1);
+      }
+      catch (logic_error ex)
+      {
+        if (debugLevelParam >= 1)
+        {
+          string frameType;
+          if (frame->getFrametype() == KEYFRAME)
+            frameType = "Keyframe";
+          else if (frame->getFrametype() == LOCKFRAME)
+            frameType = "Lockframe";
+          else
+            frameType = "Interpolation";
+          cerr << ERROR_HEADER << "Dirty Label: " << " Frame(" << frameType << "): " << frame->getID() << " Part: " << bodyPart.getPartID() << " " << ex.what() << endl;
+        }
+        return -1.0f;
+      }
+    };
 
-    return label;
+    return Detector::generateLabel(bodyPart, j0, j1, detectorName.str(), helper->useCSdet, comparer);
   }
 
   //Used only as prevent a warning for "const uint8_t nBins";
@@ -17,6 +17,21 @@ namespace SPEL
 {
   using namespace std;
   using namespace cv;
+
+  class ColorHistDetectorHelper : public DetectorHelper
+  {
+  public:
+    ColorHistDetectorHelper(void);
+    virtual ~ColorHistDetectorHelper(void);
+    // CV_32F maps or, with the "compactPixelMaps" param, CV_16U fractions of ColorHistDetector::compactMapScale
+    map <int32_t, Mat> pixelDistributions;
+    map <int32_t, Mat> pixelLabels;
+    // Row integrals: element (y, x) holds the sum over the pixels [0, x) of the row y, so any row segment costs O(1)
+    map <int32_t, Mat> pixelLabelsIntegrals; // pixel labels of the mask pixels, CV_32F or CV_32S for the compact labels
+    Mat maskIntegral; // count of the mask pixels, CV_32S
+    float useCSdet = 1.0f;
+  };
+
   class ColorHistDetector : public Detector
   {
   protected:
@@ -24,8 +39,9 @@ namespace SPEL
     {
       PartModel(uint8_t _nBins = 8);
       uint8_t nBins;
-      vector <vector <vector <float>>> partHistogram;
-      vector <vector <vector <float>>> bgHistogram;
+      // nBins^3 bins in the single contiguous buffer, the bin of the colour interval (r, g, b) is getBinIndex(r, g, b)
+      vector <float> partHistogram;
+      vector <float> bgHistogram;
       uint32_t sizeFG;
       uint32_t sizeBG;
       uint32_t fgNumSamples;
@@ -34,6 +50,10 @@ namespace SPEL
       vector <uint32_t> bgSampleSizes;
       vector <uint32_t> fgBlankSizes;
       virtual PartModel &operator=(const PartModel &model);
+      inline size_t getBinIndex(uint32_t r, uint32_t g, uint32_t b) const
+      {
+        return (static_cast <size_t> (r) * nBins + g) * nBins + b;
+      }
     };
   public:
     ColorHistDetector(uint8_t _nBins = 8);  // default is 8 for 32 bit colourspace
@@ -41,7 +61,10 @@ namespace SPEL
     virtual int getID(void) const;
     virtual void setID(int _id);
     virtual void train(vector <Frame*> _frames, map <string, float> params);
-    virtual map <uint32_t, vector <LimbLabel> > detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels);
+    // Adds the keyframes and lockframes of "_frames" to the trained models without retraining on the earlier frames
+    virtual void update(vector <Frame*> _frames, map <string, float> params);
+    virtual float score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const;
+    using Detector::score;
     virtual uint8_t getNBins(void) const;
     virtual vector <Frame*> getFrames(void) const;
     virtual ColorHistDetector &operator=(const ColorHistDetector &c);
@@ -59,36 +82,56 @@ namespace SPEL
     FRIEND_TEST(colorHistDetectorTest, buildPixelDistributions);
     FRIEND_TEST(colorHistDetectorTest, BuildPixelLabels);
     FRIEND_TEST(colorHistDetectorTest, generateLabel);
+    FRIEND_TEST(colorHistDetectorTest, compareIntegrals);
     FRIEND_TEST(colorHistDetectorTest, detect);
     FRIEND_TEST(colorHistDetectorTest, Train);
+    FRIEND_TEST(colorHistDetectorTest, buildPartsOwnership);
+    FRIEND_TEST(colorHistDetectorTest, addHistogramBins);
+    FRIEND_TEST(colorHistDetectorTest, buildPixelDistributionsThreads);
+    FRIEND_TEST(colorHistDetectorTest, update);
+    FRIEND_TEST(colorHistDetectorTest, compactPixelMaps);
+    FRIEND_TEST(colorHistDetectorTest, quantizeRow);
 #endif  // DEBUG
     int id;
+  public:
+    static const uint32_t compactMapScale = 65535; // value of 1.0 in the compact pixel maps
   protected:
     const uint8_t nBins;
+    uint32_t colourIntervals[256]; // colour interval of each intensity, used by the quantization of the bin counts without the specialised kernel
     map <int32_t, PartModel> partModels;
     float useCSdet = 1.0f;
-    map <int32_t, Mat> pixelDistributions;
-    map <int32_t, Mat> pixelLabels;
 
-    virtual float computePixelBelongingLikelihood(const PartModel &partModel, uint8_t r, uint8_t g, uint8_t b);
+    // Writes the histogram bins of "count" pixels into "bins", the bin counts 8, 16 and 32 use the kernels specialised at compile time
+    virtual void quantizeRow(const Vec3b *pixels, uint32_t count, uint32_t *bins) const;
+    virtual float computePixelBelongingLikelihood(const PartModel &partModel, uint8_t r, uint8_t g, uint8_t b) const;
+    static void scaleHistogram(vector <float> &histogram, float multiplier, float divisor);
+    virtual void accumulateHistogram(vector <float> &histogram, uint8_t modelBins, const vector <Point3i> &colors) const;
+    virtual void accumulateHistogram(vector <float> &histogram, const vector <uint32_t> &bins) const;
     virtual void setPartHistogram(PartModel &partModel, const vector <Point3i> &partColors);
     virtual void addPartHistogram(PartModel &partModel, const vector <Point3i> &partColors, uint32_t nBlankPixels);
+    virtual void addPartHistogram(PartModel &partModel, const vector <uint32_t> &partBins, uint32_t partPixelsCount, uint32_t nBlankPixels);
     virtual void addBackgroundHistogram(PartModel &partModel, const vector <Point3i> &bgColors);
-    virtual float getAvgSampleSizeFg(const PartModel &partModel);
-    virtual float getAvgSampleSizeFgBetween(const PartModel &partModel, uint32_t s1, uint32_t s2);
-    virtual float matchPartHistogramsED(const PartModel &partModelPrev, const PartModel &partModel);
-    virtual map <int32_t, Mat> buildPixelDistributions(Frame *frame);
-    virtual map <int32_t, Mat> buildPixelLabels(Frame *frame, map <int32_t, Mat> pixelDistributions);
-    virtual LimbLabel generateLabel(BodyPart bodyPart, Frame *frame, Point2f j0, Point2f j1);
-
-    // Variables for score comparer
-    BodyPart *comparer_bodyPart = 0;
-    Frame **comparer_frame = 0;
-    Point2f *comparer_j0 = 0;
-    Point2f *comparer_j1 = 0;
+    virtual void addBackgroundHistogram(PartModel &partModel, const vector <uint32_t> &bgBins, uint32_t bgPixelsCount);
+    virtual void addFrameToModels(Frame *frame);
+    virtual Mat buildPartsOwnership(const vector <pair <int32_t, POSERECT <Point2f>>> &polygons, const vector <float> &polyDepth, Size size) const;
+    virtual float getAvgSampleSizeFg(const PartModel &partModel) const;
+    virtual float getAvgSampleSizeFgBetween(const PartModel &partModel, uint32_t s1, uint32_t s2) const;
+    virtual float matchPartHistogramsED(const PartModel &partModelPrev, const PartModel &partModel) const;
+    virtual vector <float> buildLikelihoodTable(const vector <int32_t> &partIDs) const;
+    virtual map <int32_t, Mat> buildPixelDistributions(const Frame *frame) const;
+    virtual map <int32_t, Mat> buildPixelDistributions(const Frame *frame, uint32_t threadsCount) const;
+    virtual map <int32_t, Mat> buildPixelLabels(const Frame *frame, const map <int32_t, Mat> &pixelDistributions) const;
+    virtual void buildCompactPixelMaps(const Frame *frame, uint32_t threadsCount, map <int32_t, Mat> &pixelDistributions, map <int32_t, Mat> &pixelLabels) const;
+    static void forEachRowsBand(uint32_t rowsCount, uint32_t threadsCount, function <void(uint32_t, uint32_t)> job);
+    // Calls spanFunction(row, colBegin, colEnd) for the pixels of the compare samples inside of "rect", row by row
+    static void forEachSampleSpan(const POSERECT <Point2f> &rect, Point2f searchMin, Point2f searchMax, Size imageSize, function <void(int32_t, int32_t, int32_t)> spanFunction);
+    static float getPixelMapValue(const Mat &pixelMap, int32_t row, int32_t col);
+    virtual void buildIntegrals(const Frame *frame, const map <int32_t, Mat> &pixelLabels, Mat &maskIntegral, map <int32_t, Mat> &pixelLabelsIntegrals) const;
+    virtual DetectorHelper *createDetectorHelper(const Frame *frame, map <string, float> params) const;
+    virtual LimbLabel generateLabel(BodyPart bodyPart, const Frame *frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const;
 
-    virtual float compare(void);
-    virtual float compare(BodyPart bodyPart, Frame *frame, map <int32_t, Mat> pixelDistributions, map <int32_t, Mat> pixelLabels, Point2f j0, Point2f j1);
+    virtual float compare(BodyPart bodyPart, const Frame *frame, const map <int32_t, Mat> &pixelDistributions, const map <int32_t, Mat> &pixelLabels, Point2f j0, Point2f j1) const;
+    virtual float compare(BodyPart bodyPart, const Frame *frame, const ColorHistDetectorHelper &detectorHelper, Point2f j0, Point2f j1) const;
   };
 }
 #endif  // _LIBPOSE_COLORHISTDETECTOR_HPP_
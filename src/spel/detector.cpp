@@ -3,6 +3,14 @@
 #define ERROR_HEADER __FILE__ << ":" << __LINE__ << ": "
 namespace SPEL
 {
+  DetectorHelper::DetectorHelper(void)
+  {
+  }
+
+  DetectorHelper::~DetectorHelper(void)
+  {
+  }
+
   Detector::Detector(void)
   {
   }
@@ -11,12 +19,12 @@ namespace SPEL
   {
   }
 
-  float Detector::getBoneLength(Point2f begin, Point2f end)
+  float Detector::getBoneLength(Point2f begin, Point2f end) const
   {
     return (begin == end) ? 1.0f : (float)sqrt(spelHelper::distSquared(begin, end));
   }
 
-  float Detector::getBoneWidth(float length, BodyPart bodyPart)
+  float Detector::getBoneWidth(float length, BodyPart bodyPart) const
   {
     auto ratio = bodyPart.getLWRatio();
     if (ratio == 0)
@@ -31,7 +39,7 @@ namespace SPEL
     return length / ratio;
   }
 
-  POSERECT <Point2f> Detector::getBodyPartRect(BodyPart bodyPart, Point2f j0, Point2f j1, Size blockSize)
+  POSERECT <Point2f> Detector::getBodyPartRect(BodyPart bodyPart, Point2f j0, Point2f j1, Size blockSize) const
   {
     Point2f boxCenter = j0 * 0.5 + j1 * 0.5;
     auto boneLength = getBoneLength(j0, j1);
@@ -80,43 +88,93 @@ namespace SPEL
     return POSERECT <Point2f>(c1, c2, c3, c4);
   }
 
-  Mat Detector::rotateImageToDefault(Mat imgSource, POSERECT <Point2f> &initialRect, float angle, Size size)
+  namespace
   {
-    auto partImage = Mat(size, CV_8UC3, Scalar(0, 0, 0));
-    auto center = initialRect.GetCenter<Point2f>();
-    auto newCenter = Point2f(0.5f * size.width, 0.5f * size.height);
-    auto width = imgSource.size().width; // !!! For testing
-    auto height = imgSource.size().height; // !!! For testing
-    for (auto x = 0; x < size.width; x++)
+    // Takes the nearest source pixel for every pixel of the part image except the last row and column,
+    // "xCos" and "xSin" are the column parts of the transform
+    template <typename Pixel> void sampleRotatedPart(const Mat &imgSource, Mat &partImage, const vector <float> &xCos, const vector <float> &xSin, float cosAngle, float sinAngle, Point2f center, Point2f newCenter)
     {
-      for (auto y = 0; y < size.height; y++)
+      auto width = imgSource.size().width;
+      auto height = imgSource.size().height;
+      // The last row and column of the part image stay black
+      for (auto y = 0; y < partImage.rows - 1; y++)
       {
-        auto p = Point2f((float)x, (float)y);
-        try
+        auto dy = static_cast <float> (y) - newCenter.y;
+        auto ySin = dy * sinAngle;
+        auto yCos = dy * cosAngle;
+        auto partRow = partImage.ptr<Pixel>(y);
+        for (auto x = 0; x < partImage.cols - 1; x++)
         {
-          p = spelHelper::rotatePoint2D(p, newCenter, angle) + center - newCenter;
-          if (0 <= p.x && 0 <= p.y && p.x < width - 1 && p.y < height - 1) // !!! For testing
-            if (0 <= x && x < size.width - 1 && 0 <= y && y < size.height - 1) // !!! For testing
-            {
-              auto color = imgSource.at<Vec3b>((int)round(p.y), (int)round(p.x));
-              partImage.at<Vec3b>(y, x) = color;
-            }
+          auto px = xCos[x] - ySin + newCenter.x + center.x - newCenter.x;
+          auto py = xSin[x] + yCos + newCenter.y + center.y - newCenter.y;
+          if (0 <= px && 0 <= py && px < width - 1 && py < height - 1)
+            partRow[x] = imgSource.ptr<Pixel>(static_cast <int> (round(py)))[static_cast <int> (round(px))];
         }
-        catch (...)
-        {
-          stringstream ss;
-          ss << "Couldn't get value of indeces " << "[" << x << "][" << y << "] from indeces [" << p.x << "][" << p.y << "]";
+      }
+    }
+  }
+
+  // The part image has the type of the source image, the colour (CV_8UC3) and the gray (CV_8UC1) images are supported
+  Mat Detector::rotateImageToDefault(Mat imgSource, POSERECT <Point2f> &initialRect, float angle, Size size) const
+  {
+    auto partImage = Mat(size, imgSource.type() == CV_8UC1 ? CV_8UC1 : CV_8UC3, Scalar(0, 0, 0));
+    auto center = initialRect.GetCenter<Point2f>();
+    auto newCenter = Point2f(0.5f * size.width, 0.5f * size.height);
+    if (size.width <= 1 || size.height <= 1)
+      return partImage;
+    if (imgSource.type() != CV_8UC3 && imgSource.type() != CV_8UC1)
+    {
+      stringstream ss;
+      ss << "Only CV_8UC3 and CV_8UC1 images can be rotated";
 #ifdef DEBUG
-          cerr << ERROR_HEADER << ss.str() << endl;
+      cerr << ERROR_HEADER << ss.str() << endl;
 #endif  // DEBUG
-          throw logic_error(ss.str());
-        }
-      }
+      throw logic_error(ss.str());
     }
+    // The affine transform of the output pixel into the source image, the same float operations as spelHelper::rotatePoint2D
+    float radians = angle * M_PI / 180.0;
+    auto cosAngle = cosf(radians);
+    auto sinAngle = sinf(radians);
+    vector <float> xCos(size.width - 1), xSin(size.width - 1); // the column parts of the transform
+    for (auto x = 0; x < size.width - 1; x++)
+    {
+      auto dx = static_cast <float> (x) - newCenter.x;
+      xCos[x] = dx * cosAngle;
+      xSin[x] = dx * sinAngle;
+    }
+    if (imgSource.type() == CV_8UC1)
+      sampleRotatedPart<uint8_t>(imgSource, partImage, xCos, xSin, cosAngle, sinAngle, center, newCenter);
+    else
+      sampleRotatedPart<Vec3b>(imgSource, partImage, xCos, xSin, cosAngle, sinAngle, center, newCenter);
     return partImage;
   }
 
-  map <uint32_t, vector <LimbLabel>> Detector::merge(map <uint32_t, vector <LimbLabel>> first, map <uint32_t, vector <LimbLabel>> second, map <uint32_t, vector <LimbLabel>> secondUnfiltered)
+  Detector::LabelKey::LabelKey(const LimbLabel &label) : limbID(label.getLimbID()), polygon(label.getPolygon())
+  {
+  }
+
+  bool Detector::LabelKey::operator==(const LabelKey &key) const
+  {
+    return limbID == key.limbID && polygon == key.polygon;
+  }
+
+  size_t Detector::LabelKeyHash::operator()(const LabelKey &key) const
+  {
+    auto h = hash <int>()(key.limbID);
+    for (const auto &p : key.polygon) // "+ 0.0f" gives the same hash for -0 and 0, which are equal
+    {
+      h ^= hash <float>()(p.x + 0.0f) + 0x9e3779b9 + (h << 6) + (h >> 2);
+      h ^= hash <float>()(p.y + 0.0f) + 0x9e3779b9 + (h << 6) + (h >> 2);
+    }
+    return h;
+  }
+
+  map <uint32_t, vector <LimbLabel>> Detector::merge(const map <uint32_t, vector <LimbLabel>> &first, const map <uint32_t, vector <LimbLabel>> &second, const map <uint32_t, vector <LimbLabel>> &secondUnfiltered) const
+  {
+    return merge(map <uint32_t, vector <LimbLabel>>(first), map <uint32_t, vector <LimbLabel>>(second), secondUnfiltered);
+  }
+
+  map <uint32_t, vector <LimbLabel>> Detector::merge(map <uint32_t, vector <LimbLabel>> &&first, map <uint32_t, vector <LimbLabel>> &&second, const map <uint32_t, vector <LimbLabel>> &secondUnfiltered) const
   {
     if (first.size() != second.size() && first.size() > 0 && second.size() > 0)
     {
@@ -129,146 +187,106 @@ namespace SPEL
     }
     if (first.size() == 0)
     {
-      return second;
+      return move(second);
     }
     if (second.size() == 0)
     {
-      return first;
+      return move(first);
     }
 
     map <string, float> detectorNames;
 
     map <uint32_t, vector <LimbLabel>> result;
 
-    for (auto part : first) //for each part
+    map <int, LabelIndex> unfilteredIndices; // built on demand for every limb of "secondUnfiltered"
+
+    for (auto &part : first) //for each part
     {
       vector<LimbLabel> partResult;
+      auto secondPart = second.find(part.first);
+
+      LabelIndex secondIndex;
+      if (secondPart != second.end())
+      {
+        secondIndex.reserve(secondPart->second.size());
+        for (auto i = 0U; i < secondPart->second.size(); ++i)
+          secondIndex.emplace(LabelKey(secondPart->second[i]), i); // the first of the equal labels is matched
+      }
+      LabelIndex resultIndex;
+      resultIndex.reserve(part.second.size() + secondIndex.size());
+      partResult.reserve(part.second.size() + secondIndex.size());
 
       //iterate through first list, compare to second list, any labels that are matched are combined and pushed
       //any labels that are not found, are added
-      for (auto firstIter : part.second) //for each label in first
+      for (auto &firstLabel : part.second) //for each label in first
       {
-        auto isFound = false;
-
-        LimbLabel foundLabel;
-        try
+        LabelKey key(firstLabel);
+        auto newLabelScores = firstLabel.getScores();
+        auto found = secondIndex.find(key);
+        if (found != secondIndex.end()) //if label was found, add a score from other label to it
         {
-          auto s = second.at(part.first);
-          for (auto secondIter : s)
-          {
-            if (firstIter.getLimbID() == secondIter.getLimbID() && firstIter.getPolygon() == secondIter.getPolygon())
-            {
-              isFound = true;
-              foundLabel = secondIter;
-              break;
-            }
-          }
-        }
-        catch (...)
-        {
-          isFound = false;
-        }
-
-        if (isFound) //if label was found, create a copy, and add a score from other label to it
-        {
-          auto newLabel(firstIter);
-          auto sl(foundLabel);
           //check any score differences, and push them
-          auto secondScores = sl.getScores();
-          auto firstScores = newLabel.getScores();
-
-          for (auto i : secondScores)
+          auto firstScoresCount = newLabelScores.size();
+          for (const auto &i : secondPart->second[found->second].getScores())
           {
-            auto scoreFound = false;
-            for (auto j : firstScores)
-            {
-              if (i == j)
-              {
-                scoreFound = true;
-                break;
-              }
-            }
-
-            if (!scoreFound) //add if not found
-              newLabel.addScore(i);
+            if (find(newLabelScores.begin(), newLabelScores.begin() + firstScoresCount, i) == newLabelScores.begin() + firstScoresCount) //add if not found
+              newLabelScores.push_back(i);
           }
           //emplace scores
-          auto newLabelScores = newLabel.getScores();
-          for (auto i : newLabelScores)
+          for (const auto &i : newLabelScores)
             detectorNames.emplace(i.getDetName(), i.getCoeff());
-          newLabel.setScores(newLabelScores);
-          partResult.push_back(newLabel);
-
         }
-        else //if label wasn't found, create and push to vector
+        else //if label wasn't found, push the label and the scores of the unfiltered second label if any
         {
-          auto newLabel(firstIter);
           //emplace scores
-          auto newLabelScores = newLabel.getScores();
-          for (auto i : newLabelScores)
+          for (const auto &i : newLabelScores)
             detectorNames.emplace(i.getDetName(), i.getCoeff());
-                    
-          auto foundUnfiltered = secondUnfiltered.find(firstIter.getLimbID());
+
+          auto foundUnfiltered = secondUnfiltered.find(firstLabel.getLimbID());
           if (foundUnfiltered != secondUnfiltered.end())
           {
-            auto bFound = false;
-            LimbLabel foundLabel;
-            for (auto l : foundUnfiltered->second)
+            auto unfilteredIndex = unfilteredIndices.find(foundUnfiltered->first);
+            if (unfilteredIndex == unfilteredIndices.end())
             {
-              if (l.getLimbID() == firstIter.getLimbID() && l.getPolygon() == firstIter.getPolygon())
-              {
-                bFound = true;
-                foundLabel = l;
-                break;
-              }
+              unfilteredIndex = unfilteredIndices.emplace(foundUnfiltered->first, LabelIndex()).first;
+              unfilteredIndex->second.reserve(foundUnfiltered->second.size());
+              for (auto i = 0U; i < foundUnfiltered->second.size(); ++i)
+                unfilteredIndex->second.emplace(LabelKey(foundUnfiltered->second[i]), i);
             }
-            if (bFound)
+            auto foundLabel = unfilteredIndex->second.find(key);
+            if (foundLabel != unfilteredIndex->second.end())
             {
-              for (auto i : foundLabel.getScores())
+              for (const auto &i : foundUnfiltered->second[foundLabel->second].getScores())
               {
                 newLabelScores.push_back(i);
                 detectorNames.emplace(i.getDetName(), i.getCoeff());
               }
             }
           }
-          newLabel.setScores(newLabelScores);
-          partResult.push_back(newLabel);
         }
+        firstLabel.setScores(move(newLabelScores));
+        resultIndex.emplace(move(key), static_cast <uint32_t> (partResult.size()));
+        partResult.push_back(move(firstLabel));
       }
 
       //now iterate through the second list, and push back any labels that are not found in result vector
-      try
+      if (secondPart != second.end())
       {
-        auto s = second.at(part.first);
-
-        for (auto secondIter : s)
+        for (auto &secondLabel : secondPart->second)
         {
-          auto isFound = false;
-          for (auto resIter : partResult)
+          LabelKey key(secondLabel);
+          if (resultIndex.find(key) == resultIndex.end()) //if label not found, push it to result vector
           {
-            if (secondIter.getLimbID() == resIter.getLimbID() && secondIter.getPolygon() == resIter.getPolygon())
-            {
-              isFound = true;
-              break;
-            }
-          }
-          if (!isFound) //if label not found, push it to result vector
-          {
-            auto newLabel(secondIter);
-            auto newLabelScores = newLabel.getScores();
             //emplace scores
-            for (auto i : newLabelScores)
+            for (const auto &i : secondLabel.getScores())
               detectorNames.emplace(i.getDetName(), i.getCoeff());
-            newLabel.setScores(newLabelScores);
-            partResult.push_back(newLabel);
+            resultIndex.emplace(move(key), static_cast <uint32_t> (partResult.size()));
+            partResult.push_back(move(secondLabel));
           }
         }
       }
-      catch (...)
-      {
-      }
 
-      result.insert(pair < uint32_t, vector <LimbLabel>>(part.first, partResult));
+      result.emplace(part.first, move(partResult));
     }
 
     //now the vectors are merged, but there may be score mismatches
@@ -282,7 +300,7 @@ namespace SPEL
       {
         auto scores = l.getScores();
 
-        for (auto m : detectorNames) //for each detector, check whether label has a score for it
+        for (const auto &m : detectorNames) //for each detector, check whether label has a score for it
         {
           auto detFound = false;
 
@@ -299,7 +317,7 @@ namespace SPEL
           if (!detFound) //this detector score is missing
             scores.push_back(Score(1.0f, m.first, m.second));
         }
-        l.setScores(scores);
+        l.setScores(move(scores));
       }
     }
     //finally, sort the labels
@@ -311,19 +329,19 @@ namespace SPEL
     return result;
   }
 
-  LimbLabel Detector::generateLabel(BodyPart bodyPart, Point2f j0, Point2f j1, string detectorName, float _usedet)
+  LimbLabel Detector::generateLabel(BodyPart bodyPart, Point2f j0, Point2f j1, string detectorName, float _usedet, function <float(void)> comparer) const
   {
     auto boxCenter = j0 * 0.5 + j1 * 0.5;
     auto rot = float(spelHelper::angle2D(1, 0, j1.x - j0.x, j1.y - j0.y) * (180.0 / M_PI));
     auto rect = getBodyPartRect(bodyPart, j0, j1);
 
-    auto score = compare();
+    auto score = comparer();
     vector <Score> s;
     s.push_back(Score(score, detectorName, _usedet));
     return LimbLabel(bodyPart.getPartID(), boxCenter, rot, rect.asVector(), s, score == -1.0f);
   }
 
-  Frame *Detector::getFrame(uint32_t frameId)
+  Frame *Detector::getFrame(uint32_t frameId) const
   {
     for (auto f : frames)
     {
@@ -333,7 +351,20 @@ namespace SPEL
     return 0;
   }
 
-  map <uint32_t, vector <LimbLabel>> Detector::detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels)
+  float Detector::score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1) const
+  {
+    unique_ptr <DetectorHelper> detectorHelper(createDetectorHelper(&frame, map <string, float>()));
+    return score(bodyPart, frame, j0, j1, detectorHelper.get());
+  }
+
+  map <uint32_t, vector <LimbLabel>> Detector::detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels) const
+  {
+    // the helper lives on the stack of the current call, so the concurrent calls don't share any state
+    unique_ptr <DetectorHelper> detectorHelper(createDetectorHelper(frame, params));
+    return detect(frame, params, limbLabels, detectorHelper.get());
+  }
+
+  map <uint32_t, vector <LimbLabel>> Detector::detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels, DetectorHelper *detectorHelper) const
   {
     auto searchDistCoeff = 0.5f;
     const string sSearchDistCoeff = "searchDistCoeff";
@@ -375,6 +406,24 @@ namespace SPEL
     auto searchStepCoeff = 0.2f;
     const string sSearchStepCoeff = "searchStepCoeff";
 
+    auto detectThreads = 1.0f; // number of worker threads for candidates scoring, 0 - use all available cores
+    const string sDetectThreads = "detectThreads";
+
+    auto pyramidLevels = 1.0f; // levels of the coarse-to-fine search, 1 - scan the full grid
+    const string sPyramidLevels = "pyramidLevels";
+
+    auto pyramidTopK = 10.0f; // count of the best candidates of the part that are refined on the next level
+    const string sPyramidTopK = "pyramidTopK";
+
+    auto pyramidRefineFactor = 2.0f; // the linear and angular steps are divided by this factor on every next level
+    const string sPyramidRefineFactor = "pyramidRefineFactor";
+
+    auto rotationBankSize = 0.0f; // count of the rotated tiles cached for the frame, 0 - rotate every candidate separately
+    const string sRotationBankSize = "rotationBankSize";
+
+    auto partLabelsLimit = 0.0f; // count of the best candidates of the part kept while scanning, 0 - keep all the candidates
+    const string sPartLabelsLimit = "partLabelsLimit";
+
     // first we need to check all used params
     params.emplace(sSearchDistCoeff, searchDistCoeff);
     params.emplace(sMinTheta, minTheta);
@@ -389,6 +438,12 @@ namespace SPEL
     params.emplace(sRotationThreshold, rotationThreshold);
     params.emplace(sisWeakThreshold, isWeakThreshold);
     params.emplace(sSearchStepCoeff, searchStepCoeff);
+    params.emplace(sDetectThreads, detectThreads);
+    params.emplace(sPyramidLevels, pyramidLevels);
+    params.emplace(sPyramidTopK, pyramidTopK);
+    params.emplace(sPyramidRefineFactor, pyramidRefineFactor);
+    params.emplace(sRotationBankSize, rotationBankSize);
+    params.emplace(sPartLabelsLimit, partLabelsLimit);
 
     //now set actual param values
     searchDistCoeff = params.at(sSearchDistCoeff);
@@ -403,21 +458,21 @@ namespace SPEL
     rotationThreshold = params.at(sRotationThreshold);
     isWeakThreshold = params.at(sisWeakThreshold);
     searchStepCoeff = params.at(sSearchStepCoeff);
-    debugLevelParam = static_cast <uint8_t> (params.at(sDebugLevel));
+    detectThreads = params.at(sDetectThreads);
+    pyramidLevels = params.at(sPyramidLevels);
+    pyramidTopK = params.at(sPyramidTopK);
+    pyramidRefineFactor = params.at(sPyramidRefineFactor);
+    rotationBankSize = params.at(sRotationBankSize);
+    partLabelsLimit = params.at(sPartLabelsLimit);
 
     auto originalSize = frame->getFrameSize().height;
 
-    Frame *workFrame = 0;
-    if (frame->getFrametype() == KEYFRAME)
-      workFrame = new Keyframe();
-    else if (frame->getFrametype() == LOCKFRAME)
-      workFrame = new Lockframe();
-    else if (frame->getFrametype() == INTERPOLATIONFRAME)
-      workFrame = new Interpolation();
-
-    workFrame = frame->clone(workFrame);
+    // The resized copy of the frame is shared with the other detectors, that process this frame
+    auto resizeFactor = 1.0f;
+    auto workFrame = ResizedFrameCache::getFrame(frame, maxFrameHeight, resizeFactor);
 
-    auto resizeFactor = workFrame->Resize(maxFrameHeight);
+    if (rotationBankSize > 0 && !detectorHelper->rotatedImageBank)
+      detectorHelper->rotatedImageBank = RotatedImageBank::getBank(workFrame->getID(), workFrame->getImage(), static_cast <uint32_t> (rotationBankSize));
 
     map <uint32_t, vector <LimbLabel> > tempLabelVector;
     auto skeleton = workFrame->getSkeleton(); // copy skeleton from the frame
@@ -430,11 +485,23 @@ namespace SPEL
 
     map <uint32_t, vector <LimbLabel>> sortedLabelsMap;
 
+    // Search area of the single body part
+    struct PartSearch
+    {
+      BodyPart bodyPart;
+      float boneLength;
+      float theta;
+      float minLocalTheta;
+      float maxLocalTheta;
+      float minDist;
+      float searchXMin, searchXMax, searchYMin, searchYMax;
+      Point2f suggestStart;
+    };
+    vector <PartSearch> partSearches;
+
     // For all body parts
     for (auto iteratorBodyPart : partTree)
     { //Temporary variables
-      vector <LimbLabel> labels;
-      vector <LimbLabel> sortedLabels;
       Point2f j0, j1;
 
       try
@@ -446,11 +513,13 @@ namespace SPEL
       {
         stringstream ss;
         ss << "Can't get joints";
-        if (debugLevelParam >= 1)
+        if (debugLevel >= 1)
           cerr << ERROR_HEADER << ss.str() << endl;
         throw logic_error(ss.str());
       }
 
+      PartSearch partSearch;
+      partSearch.bodyPart = iteratorBodyPart;
       auto boneLength = getBoneLength(j0, j1); // distance between nodes
       auto boxWidth = getBoneWidth(boneLength, iteratorBodyPart); // current body part polygon width
       auto direction = j1 - j0; // direction of bodypart vector
@@ -467,58 +536,341 @@ namespace SPEL
       {
         stringstream ss;
         ss << "Maybe there is no '" << sSearchDistCoeff << "' param";
-        if (debugLevelParam >= 1)
+        if (debugLevel >= 1)
           cerr << ERROR_HEADER << ss.str() << endl;
         throw logic_error(ss.str());
       }
       if (searchDistance <= 0)
         searchDistance = minDist + 1;
       auto suggestStart = 0.5 * j1 + 0.5 * j0; // reference point - the bodypart center
-      auto searchXMin = suggestStart.x - searchDistance * 0.5f;
-      auto searchXMax = suggestStart.x + searchDistance * 0.5f;
-      auto searchYMin = suggestStart.y - searchDistance * 0.5f;
-      auto searchYMax = suggestStart.y + searchDistance * 0.5f;
-      // Scan the area around the reference point
-      for (auto x = searchXMin; x < searchXMax; x += minDist)
-      {
-        for (auto y = searchYMin; y < searchYMax; y += minDist)
+      auto deltaTheta = abs(iteratorBodyPart.getRotationSearchRange());// + abs(rotationThreshold);
+      partSearch.boneLength = boneLength;
+      partSearch.theta = theta;
+      partSearch.maxLocalTheta = iteratorBodyPart.getRotationSearchRange() == 0 ? maxTheta : deltaTheta;
+      partSearch.minLocalTheta = iteratorBodyPart.getRotationSearchRange() == 0 ? minTheta : deltaTheta;
+      partSearch.minDist = minDist;
+      partSearch.searchXMin = suggestStart.x - searchDistance * 0.5f;
+      partSearch.searchXMax = suggestStart.x + searchDistance * 0.5f;
+      partSearch.searchYMin = suggestStart.y - searchDistance * 0.5f;
+      partSearch.searchYMax = suggestStart.y + searchDistance * 0.5f;
+      partSearch.suggestStart = suggestStart;
+      partSearches.push_back(partSearch);
+    }
+
+    // Checks that the point is inside the mask
+    auto isMaskPoint = [&](float x, float y) -> bool
+    {
+      if (x < maskMat.cols && y < maskMat.rows && x >= 0 && y >= 0)
+      {
+        uint8_t mintensity = 0;
+        try
         {
-          if (x < maskMat.cols && y < maskMat.rows && x >= 0 && y >= 0)
-          {
-            uint8_t mintensity = 0;
-            try
+          mintensity = maskMat.at<uint8_t>((int)y, (int)x); // copy mask at current pixel
+        }
+        catch (...)
+        {
+          stringstream ss;
+          ss << "Can't get value in maskMat at " << "[" << (int)y << "][" << (int)x << "]";
+          if (debugLevel >= 1)
+            cerr << ERROR_HEADER << ss.str() << endl;
+          throw logic_error(ss.str());
+        }
+        return mintensity >= 10; // pixel is not significant if the mask value is less than this threshold
+      }
+      return false;
+    };
+
+    auto threadsCount = detectThreads > 0 ? static_cast <uint32_t> (detectThreads) : thread::hardware_concurrency();
+    if (threadsCount == 0)
+      threadsCount = 1;
+
+    // Runs the job(index, worker) for every index, each worker takes every workersCount-th index, so the neighbouring (and equally expensive) jobs are spread between workers.
+    // Worker numbers are less than threadsCount
+    auto parallelFor = [&](size_t count, function <void(size_t, size_t)> job)
+    {
+      auto workersCount = min(static_cast <size_t> (threadsCount), count);
+      if (workersCount <= 1)
+      {
+        for (auto i = 0U; i < count; ++i)
+          job(i, 0);
+        return;
+      }
+      vector <future <void>> futures;
+      for (auto t = 0U; t < workersCount; ++t)
+      {
+        futures.push_back(async(launch::async, [&, t]()
+        {
+          for (auto i = static_cast <size_t> (t); i < count; i += workersCount)
+            job(i, t);
+        }));
+      }
+      for (auto &&f : futures)
+        f.get();
+    };
+
+    // Bounded collection of the candidates: only the best "partLabelsLimit" labels of every part are kept while scanning.
+    // Of the rest only the labels that "merge" may look for, i.e. of the same limb and polygon as the labels of the previous detectors, are kept.
+    // Every worker has its own collectors, they are merged into the collectors of the worker 0 after the scan, so the scoring takes no locks
+    struct PartCollector
+    {
+      vector <pair <uint64_t, LimbLabel>> labels; // (scan order, label) heap, the worst label is on the top
+      vector <pair <uint64_t, LimbLabel>> unfiltered; // the best scored label of every key (merge takes the first one of the sorted labels), the order is 0 if not scanned
+    };
+    auto labelsLimit = static_cast <uint32_t> (partLabelsLimit);
+    vector <LabelIndex> unfilteredIndices(labelsLimit > 0 ? partSearches.size() : 0); // keys of the labels of the previous detectors -> index in "unfiltered", shared by the workers
+    vector <vector <PartCollector>> collectors(labelsLimit > 0 ? threadsCount : 0, vector <PartCollector>(partSearches.size())); // worker -> part -> collector
+    if (labelsLimit > 0)
+    {
+      map <int, uint32_t> partIndices; // limb id -> index of the part search
+      for (auto i = 0U; i < partSearches.size(); ++i)
+        partIndices.emplace(partSearches[i].bodyPart.getPartID(), i);
+      for (const auto &part : limbLabels)
+      {
+        for (const auto &label : part.second)
+        {
+          auto partIndex = partIndices.find(label.getLimbID());
+          if (partIndex == partIndices.end())
+            continue;
+          auto &unfilteredIndex = unfilteredIndices[partIndex->second];
+          unfilteredIndex.emplace(LabelKey(label), static_cast <uint32_t> (unfilteredIndex.size()));
+        }
+      }
+    }
+    // Ranks by score, the scan order breaks the ties, so the result doesn't depend on the threads count
+    auto isBetter = [](const pair <uint64_t, LimbLabel> &a, const pair <uint64_t, LimbLabel> &b) -> bool
+    {
+      if (a.second < b.second)
+        return true;
+      if (b.second < a.second)
+        return false;
+      return a.first < b.first;
+    };
+    // Adds the candidate to the collector of the part of the worker. Orders are counted from 1
+    auto collectCandidate = [&](size_t worker, uint32_t part, pair <uint64_t, LimbLabel> candidate)
+    {
+      auto &collector = collectors[worker][part];
+      const auto &unfilteredIndex = unfilteredIndices[part];
+      if (unfilteredIndex.size() > 0)
+      {
+        auto index = unfilteredIndex.find(LabelKey(candidate.second));
+        if (index != unfilteredIndex.end())
+        {
+          if (collector.unfiltered.size() == 0)
+            collector.unfiltered.resize(unfilteredIndex.size(), pair <uint64_t, LimbLabel>(0, LimbLabel()));
+          auto &unfiltered = collector.unfiltered[index->second];
+          if (unfiltered.first == 0 || isBetter(candidate, unfiltered))
+            unfiltered = candidate;
+        }
+      }
+      if (collector.labels.size() < labelsLimit)
+      {
+        collector.labels.push_back(move(candidate));
+        push_heap(collector.labels.begin(), collector.labels.end(), isBetter);
+      }
+      else if (isBetter(candidate, collector.labels.front()))
+      {
+        pop_heap(collector.labels.begin(), collector.labels.end(), isBetter);
+        collector.labels.back() = move(candidate);
+        push_heap(collector.labels.begin(), collector.labels.end(), isBetter);
+      }
+    };
+    auto collectLabel = [&](size_t worker, uint32_t part, uint64_t order, const LimbLabel &label)
+    {
+      collectCandidate(worker, part, pair <uint64_t, LimbLabel>(order, label));
+    };
+    // Moves the candidates of the other workers to the collectors of the worker 0, the kept labels don't depend on how the scan was split between workers
+    auto mergeCollectors = [&]()
+    {
+      for (auto worker = 1U; worker < collectors.size(); ++worker)
+      {
+        for (auto part = 0U; part < collectors[worker].size(); ++part)
+        {
+          auto &collector = collectors[worker][part];
+          auto &target = collectors[0][part];
+          if (target.unfiltered.size() == 0)
+            target.unfiltered.swap(collector.unfiltered);
+          for (auto k = 0U; k < collector.unfiltered.size(); ++k)
+            if (collector.unfiltered[k].first != 0 && (target.unfiltered[k].first == 0 || isBetter(collector.unfiltered[k], target.unfiltered[k])))
+              target.unfiltered[k] = move(collector.unfiltered[k]);
+          for (auto &label : collector.labels)
+            collectCandidate(0, part, move(label));
+          vector <pair <uint64_t, LimbLabel>>().swap(collector.labels);
+          vector <pair <uint64_t, LimbLabel>>().swap(collector.unfiltered);
+        }
+      }
+    };
+
+    vector <vector <LimbLabel>> partsLabels(partSearches.size());
+    if (pyramidLevels <= 1)
+    {
+      vector <pair <uint32_t, float>> searchColumns; // (index of the part search, x) in the order of the serial scan
+      vector <vector <float>> partsYs(partSearches.size());
+      for (auto i = 0U; i < partSearches.size(); ++i)
+      {
+        const auto &partSearch = partSearches[i];
+        // Grid coordinates are accumulated exactly as the serial scan does, so every mode visits the same points
+        for (auto y = partSearch.searchYMin; y < partSearch.searchYMax; y += partSearch.minDist)
+          partsYs[i].push_back(y);
+        for (auto x = partSearch.searchXMin; x < partSearch.searchXMax; x += partSearch.minDist)
+          searchColumns.push_back(pair <uint32_t, float>(i, x));
+      }
+
+      // Scan the single column of the area around the reference point
+      vector <vector <LimbLabel>> columnsLabels(searchColumns.size());
+      parallelFor(searchColumns.size(), [&](size_t i, size_t worker)
+      {
+        const auto &partSearch = partSearches.at(searchColumns[i].first);
+        auto x = searchColumns[i].second;
+        auto &columnLabels = columnsLabels[i];
+        for (auto y : partsYs[searchColumns[i].first])
+        {
+          if (isMaskPoint(x, y))
+          { // Scan the possible rotation zone
+            for (auto rot = partSearch.theta - partSearch.minLocalTheta; rot < partSearch.theta + partSearch.maxLocalTheta; rot += stepTheta)
             {
-              mintensity = maskMat.at<uint8_t>((int)y, (int)x); // copy mask at current pixel
+              // build  the vector label
+              columnLabels.push_back(generateLabel(partSearch.boneLength, rot, x, y, partSearch.bodyPart, workFrame.get(), detectorHelper)); // add label to current bodypart labels
             }
-            catch (...)
+          }
+        }
+        if (labelsLimit > 0)
+        {
+          for (auto k = 0U; k < columnLabels.size(); ++k)
+            collectLabel(worker, searchColumns[i].first, (static_cast <uint64_t> (i) << 32) + k + 1, columnLabels[k]);
+          vector <LimbLabel>().swap(columnLabels);
+        }
+      });
+      if (labelsLimit > 0)
+        mergeCollectors();
+
+      // Gather the columns of every part in the order of the serial scan
+      for (auto column = 0U; column < searchColumns.size(); ++column)
+      {
+        auto &labels = partsLabels[searchColumns[column].first];
+        labels.insert(labels.end(), make_move_iterator(columnsLabels[column].begin()), make_move_iterator(columnsLabels[column].end()));
+        vector <LimbLabel>().swap(columnsLabels[column]);
+      }
+    }
+    else
+    {
+      // Coarse-to-fine search: the coarsest grid is scanned in full, the next levels only refine the neighbourhood of the best candidates of the previous level
+      struct SearchPoint
+      {
+        uint32_t part;
+        float x, y, rot;
+      };
+      auto levelsCount = static_cast <int> (pyramidLevels);
+      auto refineFactor = pyramidRefineFactor > 1.0f ? pyramidRefineFactor : 2.0f;
+      auto refineRadius = max(1, static_cast <int> (refineFactor / 2)); // neighbours of the refined point in every direction, they cover the cell of the previous level
+      auto topK = max(1U, static_cast <uint32_t> (pyramidTopK));
+
+      set <tuple <uint32_t, long, long, long>> visitedPoints; // avoids scoring the same point twice, coordinates are rounded to 0.01
+      auto addPoint = [&](vector <SearchPoint> &points, uint32_t part, float x, float y, float rot)
+      {
+        if (visitedPoints.insert(make_tuple(part, lround(x * 100.0f), lround(y * 100.0f), lround(rot * 100.0f))).second)
+        {
+          SearchPoint point = { part, x, y, rot };
+          points.push_back(point);
+        }
+      };
+
+      vector <SearchPoint> points;
+      auto levelScale = static_cast <float> (pow(refineFactor, levelsCount - 1));
+      for (auto i = 0U; i < partSearches.size(); ++i)
+      {
+        const auto &partSearch = partSearches[i];
+        auto step = partSearch.minDist * levelScale;
+        for (auto x = partSearch.searchXMin; x < partSearch.searchXMax; x += step)
+          for (auto y = partSearch.searchYMin; y < partSearch.searchYMax; y += step)
+            if (isMaskPoint(x, y))
+              for (auto rot = partSearch.theta - partSearch.minLocalTheta; rot < partSearch.theta + partSearch.maxLocalTheta; rot += stepTheta * levelScale)
+                addPoint(points, i, x, y, rot);
+      }
+
+      uint64_t pointsOrder = 0;
+      for (auto level = levelsCount - 1; level >= 0 && points.size() > 0; --level)
+      {
+        vector <LimbLabel> pointsLabels(points.size());
+        parallelFor(points.size(), [&](size_t i, size_t)
+        {
+          const auto &partSearch = partSearches[points[i].part];
+          pointsLabels[i] = generateLabel(partSearch.boneLength, points[i].rot, points[i].x, points[i].y, partSearch.bodyPart, workFrame.get(), detectorHelper);
+        });
+
+        vector <vector <uint32_t>> levelIndices(partSearches.size()); // indices of the points of the current level for every part
+        for (auto i = 0U; i < points.size(); ++i)
+        {
+          levelIndices[points[i].part].push_back(i);
+          if (labelsLimit > 0)
+            collectLabel(0, points[i].part, ++pointsOrder, pointsLabels[i]);
+          else
+            partsLabels[points[i].part].push_back(pointsLabels[i]);
+        }
+        if (level == 0)
+          break;
+
+        // Refine the best candidates with the steps of the next level
+        levelScale = static_cast <float> (pow(refineFactor, level - 1));
+        vector <SearchPoint> refinedPoints;
+        for (auto part = 0U; part < partSearches.size(); ++part)
+        {
+          auto &indices = levelIndices[part];
+          auto count = min(static_cast <size_t> (topK), indices.size());
+          partial_sort(indices.begin(), indices.begin() + count, indices.end(), [&](uint32_t a, uint32_t b) { return pointsLabels[a] < pointsLabels[b]; });
+          const auto &partSearch = partSearches[part];
+          auto step = partSearch.minDist * levelScale;
+          auto stepRot = stepTheta * levelScale;
+          for (auto k = 0U; k < count; ++k)
+          {
+            const auto &point = points[indices[k]];
+            for (auto dx = -refineRadius; dx <= refineRadius; ++dx)
             {
-              stringstream ss;
-              ss << "Can't get value in maskMat at " << "[" << (int)y << "][" << (int)x << "]";
-              if (debugLevelParam >= 1)
-                cerr << ERROR_HEADER << ss.str() << endl;
-              throw logic_error(ss.str());
-            }
-            auto blackPixel = mintensity < 10; // pixel is not significant if the mask value is less than this threshold
-            if (!blackPixel)
-            { // Scan the possible rotation zone
-              auto deltaTheta = abs(iteratorBodyPart.getRotationSearchRange());// + abs(rotationThreshold);
-              auto maxLocalTheta = iteratorBodyPart.getRotationSearchRange() == 0 ? maxTheta : deltaTheta;
-              auto minLocalTheta = iteratorBodyPart.getRotationSearchRange() == 0 ? minTheta : deltaTheta;
-              for (auto rot = theta - minLocalTheta; rot < theta + maxLocalTheta; rot += stepTheta)
+              auto x = point.x + dx * step;
+              if (x < partSearch.searchXMin || x >= partSearch.searchXMax)
+                continue;
+              for (auto dy = -refineRadius; dy <= refineRadius; ++dy)
               {
-                // build  the vector label
-                sortedLabels.push_back(generateLabel(boneLength, rot, x, y, iteratorBodyPart, workFrame)); // add label to current bodypart labels
+                auto y = point.y + dy * step;
+                if (y < partSearch.searchYMin || y >= partSearch.searchYMax || !isMaskPoint(x, y))
+                  continue;
+                for (auto dr = -refineRadius; dr <= refineRadius; ++dr)
+                {
+                  auto rot = point.rot + dr * stepRot;
+                  if (rot >= partSearch.theta - partSearch.minLocalTheta && rot < partSearch.theta + partSearch.maxLocalTheta)
+                    addPoint(refinedPoints, part, x, y, rot);
+                }
               }
             }
           }
         }
+        points = move(refinedPoints);
+      }
+    }
+
+    for (auto i = 0U; i < partSearches.size(); ++i)
+    {
+      const auto &partSearch = partSearches[i];
+      vector <LimbLabel> labels;
+      auto &sortedLabels = partsLabels[i];
+      vector <LimbLabel> unfilteredLabels;
+      if (labelsLimit > 0)
+      {
+        // The kept labels in the order of the scan, as they would be collected without the limit
+        auto &collector = collectors[0][i];
+        sort(collector.labels.begin(), collector.labels.end(), [](const pair <uint64_t, LimbLabel> &a, const pair <uint64_t, LimbLabel> &b) { return a.first < b.first; });
+        for (auto &label : collector.labels)
+          sortedLabels.push_back(move(label.second));
+        vector <pair <uint64_t, LimbLabel>>().swap(collector.labels);
+        for (auto &label : collector.unfiltered)
+          if (label.first != 0)
+            unfilteredLabels.push_back(move(label.second));
       }
       if (sortedLabels.size() == 0) // if labels for current body part is not builded
       {
-        for (auto rot = theta - minTheta; (rot < theta + maxTheta || (rot == theta - minTheta && rot >= theta + maxTheta)); rot += stepTheta)
+        for (auto rot = partSearch.theta - minTheta; (rot < partSearch.theta + maxTheta || (rot == partSearch.theta - minTheta && rot >= partSearch.theta + maxTheta)); rot += stepTheta)
         {
           // build  the vector label
-          sortedLabels.push_back(generateLabel(boneLength, rot, suggestStart.x, suggestStart.y, iteratorBodyPart, workFrame)); // add label to current bodypart labels
+          sortedLabels.push_back(generateLabel(partSearch.boneLength, rot, partSearch.suggestStart.x, partSearch.suggestStart.y, partSearch.bodyPart, workFrame.get(), detectorHelper)); // add label to current bodypart labels
         }
       }
       if (sortedLabels.size() > 0) // if labels vector is not empty
@@ -526,26 +878,26 @@ namespace SPEL
 
       spelHelper::RecalculateScoreIsWeak(labels, detectorName.str(), isWeakThreshold);
       if (labels.size() > 0)
-        tempLabelVector.insert(pair<uint32_t, vector <LimbLabel>>(iteratorBodyPart.getPartID(), labels)); // add current point labels
-      sortedLabelsMap.insert(pair <uint32_t, vector <LimbLabel>>(iteratorBodyPart.getPartID(), sortedLabels));
+        tempLabelVector.emplace(partSearch.bodyPart.getPartID(), move(labels)); // add current point labels
+      if (labelsLimit > 0 && unfilteredLabels.size() > 0) // the dropped candidates still give their scores to the labels of the previous detectors
+        unfilteredLabels.insert(unfilteredLabels.end(), make_move_iterator(sortedLabels.begin()), make_move_iterator(sortedLabels.end()));
+      else
+        unfilteredLabels = move(sortedLabels);
+      sortedLabelsMap.emplace(partSearch.bodyPart.getPartID(), move(unfilteredLabels));
     }
 
-    delete workFrame;
+    workFrame.reset();
 
     for (auto i = 0; i < tempLabelVector.size(); ++i)
     {
-      for (auto j = 0; j < tempLabelVector.at(i).size(); ++j)
-      {
-        LimbLabel label = tempLabelVector.at(i).at(j);
+      for (auto &label : tempLabelVector.at(i))
         label.Resize(pow(resizeFactor, -1));
-        tempLabelVector[i][j] = label;
-      }
     }
 
-    return merge(limbLabels, tempLabelVector, sortedLabelsMap);
+    return merge(move(limbLabels), move(tempLabelVector), sortedLabelsMap);
   }
 
-  LimbLabel Detector::generateLabel(float boneLength, float rotationAngle, float x, float y, BodyPart bodyPart, Frame *workFrame)
+  LimbLabel Detector::generateLabel(float boneLength, float rotationAngle, float x, float y, BodyPart bodyPart, const Frame *workFrame, DetectorHelper *detectorHelper) const
   {
     // Create a new label vector and build it label
     auto p0 = Point2f(0, 0); // the point of unit vector
@@ -556,100 +908,68 @@ namespace SPEL
     p1 = p1 + Point2f(x, y) - mid; // shift the vector to current point
     p0 = Point2f(x, y) - mid; // shift the vector to current point
 
-    return generateLabel(bodyPart, workFrame, p0, p1); // build  the vector label
+    return generateLabel(bodyPart, workFrame, p0, p1, detectorHelper); // build  the vector label
   }
 
-  vector<LimbLabel> Detector::filterLimbLabels(vector <LimbLabel> &sortedLabels, float uniqueLocationCandidates, float uniqueAngleCandidates)
+  vector<LimbLabel> Detector::filterLimbLabels(vector <LimbLabel> &sortedLabels, float uniqueLocationCandidates, float uniqueAngleCandidates) const
   {
     if (uniqueLocationCandidates<0 || uniqueLocationCandidates>1.0 || uniqueAngleCandidates< 0 || uniqueAngleCandidates>1.0)
       return sortedLabels;
 
-    map<float, map<float, vector<uint32_t> > > locationMap;
-    map<float, vector<uint32_t> > angleMap;
-
     sort(sortedLabels.begin(), sortedLabels.end()); // sort labels by "SumScore" ?
 
-    for (auto index = 0; index < sortedLabels.size(); ++index)
+    // Exact float keys, "+ 0.0f" merges -0 and 0 as the ordered map did
+    struct LocationHash
     {
-      Point2f location = sortedLabels[index].getCenter();
-      float angle = sortedLabels[index].getAngle();
-      if (locationMap.find(location.x) == locationMap.end()) //not found
-      {
-        map<float, vector<uint32_t> > yMap; //create the new map
-        vector<uint32_t> indices; //create the index vector
-        indices.push_back(index); //push the index
-        yMap.emplace(location.y, indices); //put in yMap
-        locationMap.emplace(location.x, yMap); //push the  yMap
-      }
-      else //found x coordinate
-      {
-        map<float, vector<uint32_t> > yMap = locationMap.at(location.x);
-        if (yMap.find(location.y) == yMap.end()) //not found
-        {
-          vector<uint32_t> indices; //read the existing vector
-          indices.push_back(index); //push back another index
-          yMap.emplace(location.y, indices); //set in map
-        }
-        else
-        {
-          vector<uint32_t> indices;
-          indices.push_back(index);
-          yMap.at(location.y) = indices;
-        }
-        //update the location map
-        locationMap.at(location.x) = yMap;
-      }
-      if (angleMap.find(angle) == angleMap.end()) //not found
+      size_t operator()(const pair <float, float> &location) const
       {
-        vector<uint32_t> indices;
-        indices.push_back(index);
-        angleMap.emplace(angle, indices);
-      }
-      else //found
-      {
-        vector<uint32_t> indices = angleMap.at(angle); //read the existing vector
-        indices.push_back(index); //push back another index
-        angleMap.at(angle) = indices; //set in map
+        auto h = hash <float>()(location.first);
+        return h ^ (hash <float>()(location.second) + 0x9e3779b9 + (h << 6) + (h >> 2));
       }
+    };
+    unordered_map <pair <float, float>, uint32_t, LocationHash> locationMap; // location -> the index of the last label there
+    unordered_map <float, uint32_t> angleMap; // angle -> count of the labels
+    locationMap.reserve(sortedLabels.size());
+    angleMap.reserve(sortedLabels.size());
+    vector <float> angles(sortedLabels.size());
+
+    for (auto index = 0U; index < sortedLabels.size(); ++index)
+    {
+      auto location = sortedLabels[index].getCenter();
+      angles[index] = sortedLabels[index].getAngle() + 0.0f;
+      // Only the last label of each location is kept, so the top of the location is always the single, worst scored label
+      locationMap[pair <float, float>(location.x + 0.0f, location.y + 0.0f)] = index;
+      ++angleMap[angles[index]];
     }
 
-    vector<uint32_t> bestByLocation;
-    vector<uint32_t> bestByAngle;
+    vector <bool> best(sortedLabels.size(), false);
+    for (const auto &location : locationMap) //take the top from every location
+      best[location.second] = true;
 
-    for (auto iter = locationMap.begin(); iter != locationMap.end(); ++iter) //take the top from every location
+    // Take the top from every angle: the labels are sorted, so these are the first ones of the angle
+    for (auto &angle : angleMap)
     {
-      map<float, vector<uint32_t> > yMap = iter->second;
-
-      for (auto yiter = yMap.begin(); yiter != yMap.end(); ++yiter) //take the top from every location
-      {
-        vector<uint32_t> indices = yiter->second;
-        uint32_t numToPush = indices.size()*uniqueLocationCandidates;
-        if (numToPush < 1) numToPush = 1;
-        for (auto i = 0; i < numToPush; ++i)
-          bestByLocation.push_back(indices[i]);
-      }
+      uint32_t numToPush = angle.second*uniqueAngleCandidates;
+      if (numToPush < 1) numToPush = 1;
+      angle.second = numToPush; // the remaining count to take
     }
-    for (auto iter = angleMap.begin(); iter != angleMap.end(); ++iter) //take the top from every angle
+    for (auto index = 0U; index < sortedLabels.size(); ++index)
     {
-      vector<uint32_t> indices = iter->second;
-      uint32_t numToPush = indices.size()*uniqueAngleCandidates;
-      if (numToPush < 1) numToPush = 1;
-      for (auto i = 0; i < numToPush; ++i)
-        bestByAngle.push_back(indices[i]);
+      auto &remaining = angleMap[angles[index]];
+      if (remaining > 0)
+      {
+        best[index] = true;
+        --remaining;
+      }
     }
-    //now intersect
-    sort(bestByLocation.begin(), bestByLocation.end());
-    sort(bestByAngle.begin(), bestByAngle.end());
-
-    vector<uint32_t> bestIntersect;
-    set_union(bestByLocation.begin(), bestByLocation.end(), bestByAngle.begin(), bestByAngle.end(), back_inserter(bestIntersect));
 
+    // The union of both, in the order of the score
     vector<LimbLabel> labels;
-    for (auto index : bestIntersect)
-      labels.push_back(sortedLabels.at(index));
+    for (auto index = 0U; index < sortedLabels.size(); ++index)
+      if (best[index])
+        labels.push_back(sortedLabels[index]);
 
     return labels;
-
   }
 
 }
@@ -10,10 +10,19 @@
 #include <math.h>
 #endif  // WINDOWS
 #include <vector>
+#include <algorithm>
+#include <iterator>
+#include <limits>
 #include <map>
+#include <unordered_map>
+#include <set>
+#include <tuple>
 #include <string>
 #include <exception>
 #include <functional>
+#include <future>
+#include <thread>
+#include <memory>
 
 #include "frame.hpp"
 #include "limbLabel.hpp"
@@ -22,9 +31,21 @@
 #include "keyframe.hpp"
 #include "lockframe.hpp"
 #include "interpolation.hpp"
+#include "rotatedImageBank.hpp"
+#include "resizedFrameCache.hpp"
 
 namespace SPEL
 {
+  // Per-call state of the single detect call (e.g. the pixel maps of the processed frame).
+  // Every detector creates its own helper, so the trained detector itself stays unchanged while detecting
+  class DetectorHelper
+  {
+  public:
+    DetectorHelper(void);
+    virtual ~DetectorHelper(void);
+    shared_ptr <RotatedImageBank> rotatedImageBank; // rotated tiles of the processed frame, empty if the bank is disabled
+  };
+
   class Detector
   {
   public:
@@ -33,22 +54,77 @@ namespace SPEL
     virtual int getID(void) const = 0;
     virtual void setID(int _id) = 0;
     virtual void train(vector <Frame*> frames, map <string, float> params) = 0;
-    virtual map <uint32_t, vector <LimbLabel> > detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels);
-    virtual map <uint32_t, vector <LimbLabel>> merge(map <uint32_t, vector <LimbLabel>> first, map <uint32_t, vector <LimbLabel>> second, map <uint32_t, vector <LimbLabel>> secondUnfiltered);
+    virtual map <uint32_t, vector <LimbLabel> > detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels) const;
+    virtual map <uint32_t, vector <LimbLabel>> merge(const map <uint32_t, vector <LimbLabel>> &first, const map <uint32_t, vector <LimbLabel>> &second, const map <uint32_t, vector <LimbLabel>> &secondUnfiltered) const;
+    // The labels of "first" and "second" are moved to the result
+    virtual map <uint32_t, vector <LimbLabel>> merge(map <uint32_t, vector <LimbLabel>> &&first, map <uint32_t, vector <LimbLabel>> &&second, const map <uint32_t, vector <LimbLabel>> &secondUnfiltered) const;
+    // Score of the single candidate, the helper of the frame is built for this call only
+    virtual float score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1) const;
+    virtual float score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const = 0;
   protected:
+    // Identity of the label for merge: the labels of the different detectors match when the limb and the polygon are the same
+    struct LabelKey
+    {
+      int limbID;
+      vector <Point2f> polygon;
+      LabelKey(const LimbLabel &label);
+      bool operator==(const LabelKey &key) const;
+    };
+    struct LabelKeyHash
+    {
+      size_t operator()(const LabelKey &key) const;
+    };
+    // Label key -> index of the first label with this key
+    typedef unordered_map <LabelKey, uint32_t, LabelKeyHash> LabelIndex;
+
     vector <Frame*> frames;
     uint32_t maxFrameHeight;
     uint8_t debugLevelParam = 0;
-    virtual Frame *getFrame(uint32_t frameId);
-    virtual float getBoneLength(Point2f begin, Point2f end);
-    virtual float getBoneWidth(float length, BodyPart bodyPart);
-    virtual POSERECT <Point2f> getBodyPartRect(BodyPart bodyPart, Point2f j0, Point2f j1, Size blockSize = Size(0, 0));
-    virtual Mat rotateImageToDefault(Mat imgSource, POSERECT <Point2f> &initialRect, float angle, Size size);
-    virtual LimbLabel generateLabel(BodyPart bodyPart, Point2f j0, Point2f j1, string detectorName, float _usedet);
-    virtual LimbLabel generateLabel(BodyPart bodyPart, Frame *workFrame, Point2f p0, Point2f p1) = 0;
-    virtual LimbLabel generateLabel(float boneLength, float rotationAngle, float x, float y, BodyPart bodyPart, Frame *workFrame);
-    virtual float compare(void) = 0;
-    virtual vector <LimbLabel> filterLimbLabels(vector <LimbLabel> &sortedLabels, float uniqueLocationCandidates, float uniqueAngleCandidates);
+    // "labelModelsRetention" train param: how many models of the scored candidates are kept for each part of the frame,
+    // -1 - all of them, 0 - none, K - the K best ones
+#ifdef DEBUG
+    int32_t labelModelsRetention = -1;
+#else
+    int32_t labelModelsRetention = 0;
+#endif  // DEBUG
+    // Scores of the retained label models, sorted from the best, used for the top K retention only
+    mutable map <uint32_t, map <uint32_t, vector <float>>> labelModelsScores;
+    virtual Frame *getFrame(uint32_t frameId) const;
+    virtual float getBoneLength(Point2f begin, Point2f end) const;
+    virtual float getBoneWidth(float length, BodyPart bodyPart) const;
+    virtual POSERECT <Point2f> getBodyPartRect(BodyPart bodyPart, Point2f j0, Point2f j1, Size blockSize = Size(0, 0)) const;
+    virtual Mat rotateImageToDefault(Mat imgSource, POSERECT <Point2f> &initialRect, float angle, Size size) const;
+    virtual DetectorHelper *createDetectorHelper(const Frame *frame, map <string, float> params) const = 0;
+    virtual map <uint32_t, vector <LimbLabel> > detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels, DetectorHelper *detectorHelper) const;
+    virtual LimbLabel generateLabel(BodyPart bodyPart, Point2f j0, Point2f j1, string detectorName, float _usedet, function <float(void)> comparer) const;
+    virtual LimbLabel generateLabel(BodyPart bodyPart, const Frame *workFrame, Point2f p0, Point2f p1, DetectorHelper *detectorHelper) const = 0;
+    virtual LimbLabel generateLabel(float boneLength, float rotationAngle, float x, float y, BodyPart bodyPart, const Frame *workFrame, DetectorHelper *detectorHelper) const;
+    // Saves the model of the scored candidate according to "labelModelsRetention", the caller locks the models
+    template <typename PartModel> void retainLabelModel(vector <PartModel> &models, vector <float> &scores, const PartModel &model, float score) const;
+    virtual vector <LimbLabel> filterLimbLabels(vector <LimbLabel> &sortedLabels, float uniqueLocationCandidates, float uniqueAngleCandidates) const;
   };
+
+  template <typename PartModel> void Detector::retainLabelModel(vector <PartModel> &models, vector <float> &scores, const PartModel &model, float score) const
+  {
+    if (labelModelsRetention == 0)
+      return;
+    if (labelModelsRetention < 0)
+    {
+      models.push_back(model);
+      return;
+    }
+    // the lower score is the better one, the failed comparison (-1) is the worst
+    auto rank = score < 0 ? numeric_limits <float>::max() : score;
+    auto pos = upper_bound(scores.begin(), scores.end(), rank) - scores.begin();
+    if (pos >= labelModelsRetention)
+      return;
+    scores.insert(scores.begin() + pos, rank);
+    models.insert(models.begin() + pos, model);
+    if (scores.size() > static_cast <size_t> (labelModelsRetention))
+    {
+      scores.pop_back();
+      models.pop_back();
+    }
+  }
 }
 #endif  // _LIBPOSE_DETECTOR_HPP_
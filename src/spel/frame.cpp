@@ -2,6 +2,7 @@
 
 namespace SPEL
 {
+  atomic <uint64_t> Frame::versionsCounter(0);
 
   Frame::Frame(void)
   {
@@ -46,6 +47,7 @@ namespace SPEL
     image.release();
     image = _image.clone();
     imageSize = newImageSize;
+    updateContentVersion();
   }
 
   Mat Frame::getMask(void) const
@@ -65,6 +67,7 @@ namespace SPEL
     mask.release();
     mask = _mask.clone();
     maskSize = newMaskSize;
+    updateContentVersion();
   }
 
   Skeleton Frame::getSkeleton(void) const
@@ -74,12 +77,14 @@ namespace SPEL
 
   Skeleton* Frame::getSkeletonPtr()
   {
+    updateContentVersion(); // the skeleton may be changed through the pointer
     return &skeleton;
   }
 
   void Frame::setSkeleton(Skeleton _skeleton)
   {
     skeleton = _skeleton;
+    updateContentVersion();
   }
 
   Point2f Frame::getGroundPoint(void) const
@@ -90,6 +95,7 @@ namespace SPEL
   void Frame::setGroundPoint(Point2f _groundPoint)
   {
     groundPoint = _groundPoint;
+    updateContentVersion();
   }
 
   vector <Point2f> Frame::getPartPolygon(int partID) const
@@ -118,6 +124,7 @@ namespace SPEL
     }
     skeleton.setJointTree(jointTree);
     skeleton.infer3D();
+    updateContentVersion();
   }
 
   int Frame::getParentFrameID(void) const
@@ -128,6 +135,7 @@ namespace SPEL
   void Frame::setParentFrameID(int _parentFrameID)
   {
     parentFrameID = _parentFrameID;
+    updateContentVersion();
   }
 
   float Frame::Resize(uint32_t maxHeight)
@@ -166,6 +174,7 @@ namespace SPEL
       mask.release();
       mask = newMask.clone();
     }
+    updateContentVersion();
     return factor;
   }
 
@@ -212,4 +221,14 @@ namespace SPEL
     return frametype;
   }
 
+  uint64_t Frame::getContentVersion(void) const
+  {
+    return contentVersion;
+  }
+
+  void Frame::updateContentVersion(void)
+  {
+    contentVersion = ++versionsCounter;
+  }
+
 }
@@ -6,6 +6,7 @@
 
 // STL
 #include <vector>
+#include <atomic>
 
 // OpenCV
 #include <opencv2/opencv.hpp>
@@ -53,8 +54,16 @@ namespace SPEL
     virtual Size getFrameSize(void) const;
     virtual Size getImageSize(void) const;
     virtual Size getMaskSize(void) const;
+    ///Version of the image, mask and skeleton, it is changed by every modification and is unique among all the frames,
+    ///so the copies of the frame with the same version have the same content.
+    ///Changes of the pixels through the Mat returned by getImage/getMask are not tracked, neither are the changes
+    ///made through the pointer of getSkeletonPtr after the call, the skeleton of the processed frame is changed by setSkeleton
+    virtual uint64_t getContentVersion(void) const;
     static bool FramePointerComparer(Frame *frame1, Frame *frame2);
   private:
+    static atomic <uint64_t> versionsCounter;
+    uint64_t contentVersion = ++versionsCounter;
+    void updateContentVersion(void);
     int id = -1;
     Mat image;
     Mat mask;
@@ -1,9 +1,41 @@
 #include "hogDetector.hpp"
+#include "hogDetectorAvx.hpp"
+
+#ifdef SPEL_AVX
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif  // _MSC_VER
+#endif  // SPEL_AVX
 
 #define ERROR_HEADER __FILE__ << ":" << __LINE__ << ": "
 
 namespace SPEL
 {
+  namespace
+  {
+    Mat convertToGray(const Mat &image)
+    {
+      Mat grayImage;
+#if OpenCV_VERSION_MAJOR == 2
+      cvtColor(image, grayImage, CV_BGR2GRAY);
+#elif OpenCV_VERSION_MAJOR >= 3
+      cvtColor(image, grayImage, COLOR_BGR2GRAY);
+#else
+#error "Unsupported version of OpenCV"
+#endif
+      return grayImage;
+    }
+  }
+
+  HogDetectorHelper::HogDetectorHelper(void)
+  {
+  }
+
+  HogDetectorHelper::~HogDetectorHelper(void)
+  {
+  }
+
   HogDetector::HogDetector(void)
   {
     id = 0x4844;
@@ -31,7 +63,7 @@ namespace SPEL
     id = _id;
   }
 
-  HogDetector::PartModel HogDetector::computeDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, Mat imgMat, int nbins, Size wndSize, Size blockSize, Size blockStride, Size cellSize, double wndSigma, double thresholdL2hys, bool gammaCorrection, int nlevels, int derivAperture, int histogramNormType)
+  HogDetector::PartModel HogDetector::computeDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, Mat imgMat, int nbins, Size wndSize, Size blockSize, Size blockStride, Size cellSize, double wndSigma, double thresholdL2hys, bool gammaCorrection, int nlevels, int derivAperture, int histogramNormType, RotatedImageBank *rotatedImageBank) const
   {
     float boneLength = getBoneLength(j0, j1);
     if (boneLength < blockSize.width)
@@ -60,18 +92,14 @@ namespace SPEL
     float rotationAngle = float(spelHelper::angle2D(1.0, 0, direction.x, direction.y) * (180.0 / M_PI));
     PartModel partModel;
     partModel.partModelRect = rect;
-    Mat partImage = rotateImageToDefault(imgMat, partModel.partModelRect, rotationAngle, originalSize);
-    Mat partImageResized = Mat(wndSize.height, wndSize.width, CV_8UC3, Scalar(255, 255, 255));
+    Mat partImage;
+    if (rotatedImageBank == 0 || !rotatedImageBank->getPartImage(partModel.partModelRect.GetCenter<Point2f>(), rotationAngle, originalSize, partImage))
+      partImage = rotateImageToDefault(imgMat, partModel.partModelRect, rotationAngle, originalSize);
+    Mat partImageResized = Mat(wndSize.height, wndSize.width, partImage.type(), Scalar(255, 255, 255));
     resize(partImage, partImageResized, wndSize);
-    if (bGrayImages)
+    if (bGrayImages && partImageResized.channels() == 3)
     {
-#if OpenCV_VERSION_MAJOR == 2
-      cvtColor(partImageResized, partModel.partImage, CV_BGR2GRAY);
-#elif OpenCV_VERSION_MAJOR >= 3
-      cvtColor(partImageResized, partModel.partImage, COLOR_BGR2GRAY);
-#else
-#error "Unsupported version of OpenCV"
-#endif
+      partModel.partImage = convertToGray(partImageResized);
     }
     else
     {
@@ -194,13 +222,243 @@ namespace SPEL
     return partModel;
   }
 
+  // Builds the orientation histograms of the image rotated around "center" by "angle", the tile has 2 * halfSize + 1 pixels on each side
+  // The gradients are taken from the channel with the largest magnitude as in HOGDescriptor, the magnitude is split between
+  // the two nearest unsigned orientation bins, the per-bin integral images give the histogram of any axis-aligned cell of the tile
+  shared_ptr <const HogGradientTile> HogDetector::buildGradientTile(const Mat &imgMat, Point2f center, float angle, int halfSize, int nbins, bool gammaCorrection) const
+  {
+    auto tile = make_shared <HogGradientTile>();
+    tile->angle = angle;
+    tile->origin = spelHelper::rotatePoint2D(center, Point2f(0, 0), -angle) - Point2f(static_cast <float> (halfSize), static_cast <float> (halfSize));
+    Mat rotated = RotatedImageBank::rotateImage(imgMat, tile->origin, angle, Size(2 * halfSize + 1, 2 * halfSize + 1));
+    if (bGrayImages && rotated.channels() == 3)
+      rotated = convertToGray(rotated);
+    Mat values;
+    rotated.convertTo(values, CV_32F);
+    if (gammaCorrection)
+      sqrt(values, values);
+    auto width = values.cols;
+    auto height = values.rows;
+    auto channels = values.channels();
+    vector <Mat> bins;
+    vector <float*> binRows(nbins);
+    for (auto b = 0; b < nbins; b++)
+      bins.push_back(Mat(height, width, CV_32FC1, Scalar(0)));
+    auto angleScale = static_cast <float> (nbins / CV_PI);
+    for (auto y = 0; y < height; y++)
+    {
+      auto row = values.ptr<float>(y);
+      auto prevRow = values.ptr<float>(max(y - 1, 0));
+      auto nextRow = values.ptr<float>(min(y + 1, height - 1));
+      for (auto b = 0; b < nbins; b++)
+        binRows[b] = bins[b].ptr<float>(y);
+      for (auto x = 0; x < width; x++)
+      {
+        auto prevX = max(x - 1, 0) * channels;
+        auto nextX = min(x + 1, width - 1) * channels;
+        float dx = 0, dy = 0, magnitude = -1;
+        for (auto c = 0; c < channels; c++)
+        {
+          auto cdx = row[nextX + c] - row[prevX + c];
+          auto cdy = nextRow[x * channels + c] - prevRow[x * channels + c];
+          auto cmagnitude = cdx * cdx + cdy * cdy;
+          if (cmagnitude > magnitude)
+          {
+            dx = cdx;
+            dy = cdy;
+            magnitude = cmagnitude;
+          }
+        }
+        magnitude = std::sqrt(magnitude);
+        auto orientation = atan2(dy, dx);
+        if (orientation < 0)
+          orientation += static_cast <float> (CV_PI);
+        auto position = orientation * angleScale - 0.5f;
+        auto bin = static_cast <int> (floor(position));
+        auto weight = position - bin;
+        if (bin < 0)
+          bin += nbins;
+        else if (bin >= nbins)
+          bin -= nbins;
+        auto nextBin = (bin + 1 < nbins) ? bin + 1 : 0;
+        binRows[bin][x] += magnitude * (1.0f - weight);
+        binRows[nextBin][x] += magnitude * weight;
+      }
+    }
+    tile->binIntegrals.resize(nbins);
+    for (auto b = 0; b < nbins; b++)
+      integral(bins[b], tile->binIntegrals[b], CV_64F);
+    return tile;
+  }
+
+  // Finds the gradient tile of the helper, which contains the part of "size" with the "center" rotated by "angle", or builds the new one.
+  // "offset" is the position of the part image in the tile. Without the helper the tile covers the single part
+  shared_ptr <const HogGradientTile> HogDetector::getGradientTile(HogDetectorHelper *helper, const Mat &imgMat, Point2f center, float angle, Size size, int nbins, bool gammaCorrection, Point &offset) const
+  {
+    const float angleTolerance = 0.001f; // angles of the same grid rotation differ only by the rounding error
+    auto rotatedCenter = spelHelper::rotatePoint2D(center, Point2f(0, 0), -angle);
+    auto newCenter = Point2f(0.5f * size.width, 0.5f * size.height);
+    auto fits = [&](const HogGradientTile &tile, Point &r) -> bool
+    {
+      if (static_cast <int> (tile.binIntegrals.size()) != nbins)
+        return false;
+      auto o = rotatedCenter - newCenter - tile.origin;
+      r = Point(cvRound(o.x), cvRound(o.y));
+      return r.x >= 0 && r.y >= 0 && r.x + size.width < tile.binIntegrals[0].cols && r.y + size.height < tile.binIntegrals[0].rows;
+    };
+    if (helper == 0 || helper->gradientTilesCapacity == 0)
+    {
+      auto tile = buildGradientTile(imgMat, center, angle, (max(size.width, size.height) + 1) / 2 + 1, nbins, gammaCorrection);
+      fits(*tile, offset);
+      return tile;
+    }
+    {
+      lock_guard <mutex> lock(helper->gradientTilesMutex);
+      for (auto t = helper->gradientTiles.begin(); t != helper->gradientTiles.end(); ++t)
+      {
+        if (abs((*t)->angle - angle) <= angleTolerance && fits(**t, offset))
+        {
+          auto tile = *t;
+          helper->gradientTiles.splice(helper->gradientTiles.begin(), helper->gradientTiles, t);
+          return tile;
+        }
+      }
+    }
+    // The tile covers the neighbourhood of the candidate, where the next candidates of this angle are searched
+    auto tile = buildGradientTile(imgMat, center, angle, 2 * max(size.width, size.height), nbins, gammaCorrection);
+    fits(*tile, offset);
+    lock_guard <mutex> lock(helper->gradientTilesMutex);
+    helper->gradientTiles.push_front(tile);
+    while (helper->gradientTiles.size() > helper->gradientTilesCapacity)
+      helper->gradientTiles.pop_back();
+    return tile;
+  }
+
+  // The same part geometry and cell layout as computeDescriptors, but the cell histograms are summed from the gradient tile
+  // of the part angle: the part image is scaled to the window, so each window cell takes the same share of the part image.
+  // The blocks are normalised by L2Hys as in HOGDescriptor, then each cell gets the average of its blocks.
+  // There is neither the Gaussian block window nor the spatial interpolation of HOGDescriptor, so the values are close to it, but not equal
+  HogDetector::PartModel HogDetector::computeDenseDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, const Mat &imgMat, int nbins, Size wndSize, Size blockSize, Size blockStride, Size cellSize, double thresholdL2hys, bool gammaCorrection, HogDetectorHelper *helper) const
+  {
+    float boneLength = getBoneLength(j0, j1);
+    if (boneLength < blockSize.width)
+    {
+      boneLength = static_cast <float> (blockSize.width);
+    }
+    else
+    {
+      boneLength = boneLength + blockSize.width - ((int)boneLength % blockSize.width);
+    }
+    float boneWidth = getBoneWidth(boneLength, bodyPart);
+    if (boneWidth < blockSize.height)
+    {
+      boneWidth = static_cast <float> (blockSize.height);
+    }
+    else
+    {
+      boneWidth = boneWidth + blockSize.width - ((int)boneWidth % blockSize.height);
+    }
+    Size originalSize = Size(static_cast <uint32_t> (boneLength), static_cast <uint32_t> (boneWidth));
+    POSERECT <Point2f> rect = getBodyPartRect(bodyPart, j0, j1, blockSize);
+    Point2f direction = j1 - j0;
+    float rotationAngle = float(spelHelper::angle2D(1.0, 0, direction.x, direction.y) * (180.0 / M_PI));
+    PartModel partModel;
+    partModel.partModelRect = rect;
+
+    auto cellsX = wndSize.width / cellSize.width;
+    auto cellsY = wndSize.height / cellSize.height;
+    auto blockCellsX = blockSize.width / cellSize.width;
+    auto blockCellsY = blockSize.height / cellSize.height;
+    if (cellsX < blockCellsX || cellsY < blockCellsY || blockCellsX == 0 || blockCellsY == 0)
+    {
+      stringstream ss;
+      ss << "Can't place the blocks of " << blockSize.width << "x" << blockSize.height << " into the window of " << wndSize.width << "x" << wndSize.height;
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
+    Point offset;
+    auto tile = getGradientTile(helper, imgMat, partModel.partModelRect.GetCenter<Point2f>(), rotationAngle, originalSize, nbins, gammaCorrection, offset);
+
+    vector <float> cells(static_cast <size_t> (cellsY) * cellsX * nbins);
+    for (auto cy = 0; cy < cellsY; cy++)
+    {
+      auto y0 = offset.y + cvRound(static_cast <double> (cy) * originalSize.height / cellsY);
+      auto y1 = offset.y + cvRound(static_cast <double> (cy + 1) * originalSize.height / cellsY);
+      for (auto cx = 0; cx < cellsX; cx++)
+      {
+        auto x0 = offset.x + cvRound(static_cast <double> (cx) * originalSize.width / cellsX);
+        auto x1 = offset.x + cvRound(static_cast <double> (cx + 1) * originalSize.width / cellsX);
+        auto cell = &cells[(static_cast <size_t> (cy) * cellsX + cx) * nbins];
+        for (auto b = 0; b < nbins; b++)
+        {
+          const Mat &binIntegral = tile->binIntegrals[b];
+          cell[b] = static_cast <float> (binIntegral.at<double>(y1, x1) - binIntegral.at<double>(y0, x1) - binIntegral.at<double>(y1, x0) + binIntegral.at<double>(y0, x0));
+        }
+      }
+    }
+
+    partModel.gradientStrengths.assign(cellsY, vector <vector <float>>(cellsX, vector <float>(nbins, 0.0f)));
+    vector <vector <uint32_t>> counter(cellsY, vector <uint32_t>(cellsX, 0));
+    vector <float> block(static_cast <size_t> (blockCellsY) * blockCellsX * nbins);
+    // window rows and cols, the same blocks as HOGDescriptor
+    for (auto n = 0; n + blockStride.height < wndSize.height; n += blockStride.height)
+    {
+      for (auto k = 0; k + blockStride.width < wndSize.width; k += blockStride.width)
+      {
+        auto cy0 = n / cellSize.height;
+        auto cx0 = k / cellSize.width;
+        if (cy0 + blockCellsY > cellsY || cx0 + blockCellsX > cellsX)
+          continue;
+        size_t d = 0;
+        for (auto r = 0; r < blockCellsY; r++)
+          for (auto c = 0; c < blockCellsX; c++)
+            for (auto b = 0; b < nbins; b++)
+              block[d++] = cells[((static_cast <size_t> (cy0 + r)) * cellsX + cx0 + c) * nbins + b];
+        // L2Hys: L2 normalisation, clipping by the threshold and the repeated normalisation
+        float sum = 0;
+        for (auto v : block)
+          sum += v * v;
+        auto scale = 1.0f / (std::sqrt(sum) + block.size() * 0.1f);
+        sum = 0;
+        for (auto &&v : block)
+        {
+          v = min(v * scale, static_cast <float> (thresholdL2hys));
+          sum += v * v;
+        }
+        scale = 1.0f / (std::sqrt(sum) + 1e-3f);
+        d = 0;
+        for (auto r = 0; r < blockCellsY; r++)
+          for (auto c = 0; c < blockCellsX; c++)
+          {
+            auto &cellStrengths = partModel.gradientStrengths[cy0 + r][cx0 + c];
+            for (auto b = 0; b < nbins; b++)
+              cellStrengths[b] += block[d++] * scale;
+            counter[cy0 + r][cx0 + c]++;
+          }
+      }
+    }
+    for (auto cy = 0; cy < cellsY; cy++)
+      for (auto cx = 0; cx < cellsX; cx++)
+        for (auto b = 0; b < nbins; b++)
+        {
+          if (counter[cy][cx] == 0)
+            partModel.gradientStrengths[cy][cx][b] = 0;
+          else
+            partModel.gradientStrengths[cy][cx][b] /= static_cast <float> (counter[cy][cx]);
+        }
+
+    return partModel;
+  }
+
   map <uint32_t, HogDetector::PartModel> HogDetector::computeDescriptors(Frame *frame, int nbins, Size blockSize, Size blockStride, Size cellSize, double wndSigma, double thresholdL2hys, bool gammaCorrection, int nlevels, int derivAperture, int histogramNormType)
   {
     map <uint32_t, PartModel> parts;
     Size wndSize;
     Skeleton skeleton = frame->getSkeleton();
     tree <BodyPart> partTree = skeleton.getPartTree();
-    Mat imgMat = frame->getImage();
+    RotatedImageBank *rotatedImageBank = 0;
+    Mat imgMat = getWorkImage(*frame, 0, rotatedImageBank);
     for (tree <BodyPart>::iterator part = partTree.begin(); part != partTree.end(); ++part)
     {
       try
@@ -242,7 +500,10 @@ namespace SPEL
       part->setRotationSearchRange(rotationAngle);
       try
       {
-        parts.insert(pair <uint32_t, PartModel>(part->getPartID(), computeDescriptors(*part, j0, j1, imgMat, nbins, wndSize, blockSize, blockStride, cellSize, wndSigma, thresholdL2hys, gammaCorrection, nlevels, derivAperture, histogramNormType)));
+        if (bDenseHog)
+          parts.insert(pair <uint32_t, PartModel>(part->getPartID(), computeDenseDescriptors(*part, j0, j1, imgMat, nbins, wndSize, blockSize, blockStride, cellSize, thresholdL2hys, gammaCorrection)));
+        else
+          parts.insert(pair <uint32_t, PartModel>(part->getPartID(), computeDescriptors(*part, j0, j1, imgMat, nbins, wndSize, blockSize, blockStride, cellSize, wndSigma, thresholdL2hys, gammaCorrection, nlevels, derivAperture, histogramNormType)));
       }
       catch (logic_error err)
       {
@@ -259,7 +520,7 @@ namespace SPEL
     return parts;
   }
 
-  map <uint32_t, Size> HogDetector::getMaxBodyPartHeightWidth(vector <Frame*> frames, Size blockSize, float resizeFactor)
+  map <uint32_t, Size> HogDetector::getMaxBodyPartHeightWidth(vector <Frame*> frames, Size blockSize, float resizeFactor) const
   {
     map <uint32_t, Size> result;
     for (vector <Frame*>::iterator frame = frames.begin(); frame != frames.end(); ++frame)
@@ -323,6 +584,7 @@ namespace SPEL
     partSize.clear();
     partModels.clear();
     labelModels.clear();
+    labelModelsScores.clear();
 
 #ifdef DEBUG
     const uint8_t debugLevel = 5;
@@ -335,10 +597,30 @@ namespace SPEL
 
     debugLevelParam = static_cast <uint8_t> (params.at(sDebugLevel));
 
+    const string sLabelModelsRetention = "labelModelsRetention"; // -1 - all the scored candidates, 0 - none, K - the K best candidates of each part
+
+    params.emplace(sLabelModelsRetention, static_cast <float> (labelModelsRetention));
+
+    labelModelsRetention = static_cast <int32_t> (params.at(sLabelModelsRetention));
+
     const string sGrayImages = "grayImages";
 
     params.emplace(sGrayImages, bGrayImages == true ? 1.0f : 0.0f);
 
+    bGrayImages = params.at(sGrayImages) != 0;
+
+    const string sDenseHog = "denseHog"; // 1 - the cell histograms of the models and the candidates are summed from the dense gradients of the frame
+
+    params.emplace(sDenseHog, bDenseHog == true ? 1.0f : 0.0f);
+
+    bDenseHog = params.at(sDenseHog) != 0;
+
+    const string sHogTemplates = "hogTemplates"; // templates of each part kept by the k-medoids clustering of the trained models, 0 - all the models
+
+    params.emplace(sHogTemplates, static_cast <float> (templatesBudget));
+
+    templatesBudget = static_cast <uint32_t> (max(0.0f, params.at(sHogTemplates)));
+
     const string sMaxFrameHeight = "maxFrameHeight";
 
     params.emplace(sMaxFrameHeight, frames.at(0)->getFrameSize().height);
@@ -387,135 +669,371 @@ namespace SPEL
 
       delete workFrame;
     }
+
+    partTemplates.clear();
+    for (auto &&framePartModels : partModels)
+      for (auto &&partModel : framePartModels.second)
+        if (partTemplates.find(partModel.first) == partTemplates.end())
+          partTemplates.emplace(partModel.first, buildPartTemplates(partModel.first, nbins));
+
+    if (templatesBudget > 0)
+    {
+      for (auto &&templates : partTemplates)
+        templates.second = compressPartTemplates(templates.second, templatesBudget);
+    }
   }
 
-  map <uint32_t, vector <LimbLabel> > HogDetector::detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels)
+  DetectorHelper *HogDetector::createDetectorHelper(const Frame *frame, map <string, float> params) const
   {
     const string sUseHoGdet = "useHoGdet";
 
-    const string sGrayImages = "grayImages";
-
     params.emplace(sUseHoGdet, useHoGdet);
-    params.emplace(sGrayImages, bGrayImages == true ? 1.0f : 0.0f);
 
-    useHoGdet = params.at(sUseHoGdet);
+    const string sDenseHogTiles = "denseHogTiles"; // count of the gradient tiles cached for the frame by the detector trained with "denseHog"
 
-    return Detector::detect(frame, params, limbLabels);
+    params.emplace(sDenseHogTiles, 8.0f);
+
+    auto detectorHelper = new HogDetectorHelper();
+    detectorHelper->useHoGdet = params.at(sUseHoGdet);
+    detectorHelper->gradientTilesCapacity = static_cast <uint32_t> (params.at(sDenseHogTiles));
+    return detectorHelper;
   }
 
-  LimbLabel HogDetector::generateLabel(BodyPart bodyPart, Frame *frame, Point2f j0, Point2f j1)
+  Size HogDetector::getPartSize(const BodyPart &bodyPart) const
   {
-    stringstream detectorName;
-    detectorName << getID();
-
-    comparer_bodyPart = &bodyPart;
-
-    Size size;
     try
     {
-      size = partSize.at(bodyPart.getPartID());
+      return partSize.at(bodyPart.getPartID());
     }
     catch (...)
     {
       stringstream ss;
       ss << "Can't get partSize for body part " << bodyPart.getPartID();
       if (debugLevelParam >= 1)
-      {
         cerr << ERROR_HEADER << ss.str() << endl;
-        throw logic_error(ss.str());
-      }
+      throw logic_error(ss.str());
     }
-    PartModel generatedPartModel = computeDescriptors(bodyPart, j0, j1, frame->getImage(), nbins, size, blockSize, blockStride, cellSize, wndSigma, thresholdL2hys, gammaCorrection, nlevels, derivAperture, histogramNormType);
+  }
+
+  // The frame image, converted to gray once per helper for the detector trained with the "grayImages" param,
+  // so the rotation, the resize and HOG of every candidate run on the single channel
+  Mat HogDetector::getWorkImage(const Frame &frame, DetectorHelper *detectorHelper, RotatedImageBank *&rotatedImageBank) const
+  {
+    auto image = frame.getImage();
+    rotatedImageBank = detectorHelper != 0 ? detectorHelper->rotatedImageBank.get() : 0;
+    if (!bGrayImages || image.type() != CV_8UC3)
+      return image;
+
+    auto helper = dynamic_cast <HogDetectorHelper*> (detectorHelper);
+    rotatedImageBank = 0;
+    if (helper == 0)
+      return convertToGray(image);
 
-    comparer_model = &generatedPartModel;
+    // The first candidate of the call converts the frame, the other workers wait for it only once and then read the copy without the lock
+    call_once(helper->grayImageOnce, [&]()
+    {
+      helper->grayImageSource = image;
+      helper->grayImage = convertToGray(image);
+      if (helper->rotatedImageBank)
+        helper->grayImageBank = RotatedImageBank::getBank(frame.getID(), helper->grayImage, helper->rotatedImageBank->getCapacity());
+    });
+    if (helper->grayImageSource.data != image.data || helper->grayImageSource.size() != image.size())
+      return convertToGray(image); // the helper of the other frame
+    rotatedImageBank = helper->grayImageBank.get();
+    return helper->grayImage;
+  }
+
+  float HogDetector::score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const
+  {
+    RotatedImageBank *rotatedImageBank = 0;
+    auto imgMat = getWorkImage(frame, detectorHelper, rotatedImageBank);
+    if (bDenseHog)
+      return compare(bodyPart, computeDenseDescriptors(bodyPart, j0, j1, imgMat, nbins, getPartSize(bodyPart), blockSize, blockStride, cellSize, thresholdL2hys, gammaCorrection, dynamic_cast <HogDetectorHelper*> (detectorHelper)), nbins);
+    auto generatedPartModel = computeDescriptors(bodyPart, j0, j1, imgMat, nbins, getPartSize(bodyPart), blockSize, blockStride, cellSize, wndSigma, thresholdL2hys, gammaCorrection, nlevels, derivAperture, histogramNormType, rotatedImageBank);
+    return compare(bodyPart, generatedPartModel, nbins);
+  }
+
+  LimbLabel HogDetector::generateLabel(BodyPart bodyPart, const Frame *frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const
+  {
+    stringstream detectorName;
+    detectorName << getID();
+
+    auto helper = dynamic_cast <HogDetectorHelper*> (detectorHelper);
+    if (helper == 0)
+    {
+      stringstream ss;
+      ss << "Wrong type of detectorHelper";
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
 
-    LimbLabel label = Detector::generateLabel(bodyPart, j0, j1, detectorName.str(), useHoGdet);
+    RotatedImageBank *rotatedImageBank = 0;
+    auto imgMat = getWorkImage(*frame, helper, rotatedImageBank);
+    PartModel generatedPartModel;
+    if (bDenseHog)
+      generatedPartModel = computeDenseDescriptors(bodyPart, j0, j1, imgMat, nbins, getPartSize(bodyPart), blockSize, blockStride, cellSize, thresholdL2hys, gammaCorrection, helper);
+    else
+      generatedPartModel = computeDescriptors(bodyPart, j0, j1, imgMat, nbins, getPartSize(bodyPart), blockSize, blockStride, cellSize, wndSigma, thresholdL2hys, gammaCorrection, nlevels, derivAperture, histogramNormType, rotatedImageBank);
 
-    labelModels[frame->getID()][bodyPart.getPartID()].push_back(generatedPartModel);
+    LimbLabel label = Detector::generateLabel(bodyPart, j0, j1, detectorName.str(), helper->useHoGdet, [&]() { return compare(bodyPart, generatedPartModel, nbins); });
 
-    comparer_bodyPart = 0;
-    comparer_model = 0;
+    if (labelModelsRetention != 0)
+    {
+      lock_guard <mutex> lock(labelModelsMutex); // labels of the different workers are generated concurrently
+      retainLabelModel(labelModels[frame->getID()][bodyPart.getPartID()], labelModelsScores[frame->getID()][bodyPart.getPartID()], generatedPartModel, label.getScores().front().getScore());
+    }
 
     return label;
   }
 
-  float HogDetector::compare(void)
+  // Cells of the model row after row, "nbins" strengths of each cell
+  void HogDetector::flattenGradientStrengths(const PartModel &partModel, uint8_t nbins, vector <float> &strengths) const
+  {
+    for (uint32_t i = 0; i < partModel.gradientStrengths.size(); i++)
+    {
+      const auto &row = partModel.gradientStrengths[i];
+      if (row.size() != partModel.gradientStrengths[0].size())
+      {
+        stringstream ss;
+        ss << "Invalid descriptor count. Need: " << partModel.gradientStrengths[0].size() << ". Have: " << row.size();
+        if (debugLevelParam >= 1)
+          cerr << ERROR_HEADER << ss.str() << endl;
+        throw logic_error(ss.str());
+      }
+      for (uint32_t j = 0; j < row.size(); j++)
+      {
+        if (row[j].size() < nbins)
+        {
+          stringstream ss;
+          ss << "Can't get some descriptor at [" << i << "][" << j << "][" << row[j].size() << "]";
+          if (debugLevelParam >= 1)
+            cerr << ERROR_HEADER << ss.str() << endl;
+          throw logic_error(ss.str());
+        }
+        strengths.insert(strengths.end(), row[j].begin(), row[j].begin() + nbins);
+      }
+    }
+  }
+
+  // The model of the part from each trained frame, in the order of the frames
+  HogDetector::PartTemplates HogDetector::buildPartTemplates(uint32_t partID, uint8_t nbins) const
+  {
+    PartTemplates templates;
+    for (auto &&framePartModels : partModels)
+    {
+      auto partModel = framePartModels.second.find(partID);
+      if (partModel == framePartModels.second.end())
+        continue;
+      const auto &gradientStrengths = partModel->second.gradientStrengths;
+      auto cols = gradientStrengths.empty() ? 0 : static_cast <uint32_t> (gradientStrengths[0].size());
+      if (templates.count == 0)
+      {
+        templates.rows = static_cast <uint32_t> (gradientStrengths.size());
+        templates.cols = cols;
+        templates.strengths.reserve(templates.rows * templates.cols * nbins * partModels.size());
+      }
+      else if (gradientStrengths.size() != templates.rows || cols != templates.cols)
+      {
+        stringstream ss;
+        ss << "Invalid descriptor count. Need: " << templates.rows << "x" << templates.cols << ". Have: " << gradientStrengths.size() << "x" << cols;
+        if (debugLevelParam >= 1)
+          cerr << ERROR_HEADER << ss.str() << endl;
+        throw logic_error(ss.str());
+      }
+      flattenGradientStrengths(partModel->second, nbins, templates.strengths);
+      templates.count++;
+    }
+    return templates;
+  }
+
+  // Sum of the absolute differences between the candidate and each of the templates, stored one after another.
+  // The differences of the template are multiplied by its weight, if the weights are given
+  float HogDetector::sumAbsDifferences(const float *candidate, const float *templates, uint32_t length, uint32_t count, const float *weights)
   {
-    if (comparer_bodyPart == 0 || comparer_model == 0)
+#ifdef SPEL_AVX
+    static const auto avx = isAvxSupported();
+    if (avx)
+      return sumAbsDifferencesAvx(candidate, templates, length, count, weights);
+#endif  // SPEL_AVX
+    return sumAbsDifferencesScalar(candidate, templates, length, count, weights);
+  }
+
+  float HogDetector::sumAbsDifferencesScalar(const float *candidate, const float *templates, uint32_t length, uint32_t count, const float *weights)
+  {
+    float total = 0;
+    for (uint32_t t = 0; t < count; t++, templates += length)
+    {
+      float templateSum = 0;
+      float &sum = (weights == 0) ? total : templateSum; // the unweighted differences are summed in the order of the models
+      for (uint32_t i = 0; i < length; i++)
+        sum += abs(candidate[i] - templates[i]);
+      if (weights != 0)
+        total += weights[t] * templateSum;
+    }
+    return total;
+  }
+
+  // The AVX kernel is built with the SPEL_AVX cmake option only, the CPU is checked at run time, so the library runs on the CPUs without AVX as well
+  bool HogDetector::isAvxSupported(void)
+  {
+#ifndef SPEL_AVX
+    return false;
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 28)) == 0 || (info[2] & (1 << 27)) == 0) // AVX and OSXSAVE
+      return false;
+    return (_xgetbv(0) & 6) == 6; // the OS saves the YMM registers
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    return __builtin_cpu_supports("avx") != 0;
+#else
+    return false;
+#endif  // SPEL_AVX
+  }
+
+  // Average absolute difference between the gradient strengths of the candidate and of the trained models of the part
+  float HogDetector::compare(BodyPart bodyPart, const PartModel &model, uint8_t nbins) const
+  {
+    auto partID = static_cast <uint32_t> (bodyPart.getPartID());
+    PartTemplates builtTemplates;
+    const PartTemplates *templates = &builtTemplates;
+    auto trainedTemplates = partTemplates.find(partID);
+    if (trainedTemplates != partTemplates.end())
+      templates = &trainedTemplates->second;
+    else
+      builtTemplates = buildPartTemplates(partID, nbins); // the models weren't set by train
+
+    if (templates->count == 0)
+      return numeric_limits <float>::quiet_NaN(); // the average of no models
+
+    if (model.gradientStrengths.size() != templates->rows)
+    {
+      stringstream ss;
+      ss << "Invalid descriptor count. Need: " << model.gradientStrengths.size() << ". Have: " << templates->rows;
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
+    vector <float> strengths;
+    strengths.reserve(templates->strengths.size() / templates->count);
+    flattenGradientStrengths(model, nbins, strengths);
+    if (strengths.size() * templates->count != templates->strengths.size())
     {
       stringstream ss;
-      ss << "Compare parameters are invalid: " << (comparer_bodyPart == 0 ? "comparer_bodyPart == 0 " : "") << (comparer_model == 0 ? "comparer_model == 0" : "") << endl;
+      ss << "Invalid descriptor count. Need: " << strengths.size() << ". Have: " << templates->strengths.size() / templates->count;
       if (debugLevelParam >= 1)
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
-    return compare(*comparer_bodyPart, *comparer_model, nbins);
+
+    auto length = static_cast <uint32_t> (strengths.size());
+    if (templates->weights.empty())
+      return sumAbsDifferences(strengths.data(), templates->strengths.data(), length, templates->count) / static_cast <float> (length * templates->count);
+
+    auto modelsCount = accumulate(templates->weights.begin(), templates->weights.end(), 0.0f);
+    return sumAbsDifferences(strengths.data(), templates->strengths.data(), length, templates->count, templates->weights.data()) / (length * modelsCount);
   }
 
-  float HogDetector::compare(BodyPart bodyPart, PartModel model, uint8_t nbins)
+  // k-medoids clustering of the models by the L1 distance, every medoid is weighted by the count of the models of its cluster,
+  // so the weighted average difference to the medoids approximates the average difference to all the models
+  HogDetector::PartTemplates HogDetector::compressPartTemplates(const PartTemplates &templates, uint32_t budget) const
   {
-    float score = 0;
-    uint32_t totalcount = 0;
-    for (map <uint32_t, map <uint32_t, PartModel>>::iterator framePartModels = partModels.begin(); framePartModels != partModels.end(); ++framePartModels)
+    if (budget == 0 || templates.count <= budget)
+      return templates;
+
+    const auto count = templates.count;
+    const auto length = static_cast <uint32_t> (templates.strengths.size() / count);
+    vector <float> distances(count * count, 0.0f);
+    for (uint32_t i = 0; i < count; i++)
+      for (uint32_t j = i + 1; j < count; j++)
+        distances[i * count + j] = distances[j * count + i] = sumAbsDifferences(&templates.strengths[i * length], &templates.strengths[j * length], length, 1);
+
+    // Greedy initialization: each next medoid decreases the total distance of the models to their nearest medoid the most
+    vector <uint32_t> medoids;
+    vector <float> nearest(count, numeric_limits <float>::max());
+    while (medoids.size() < budget)
     {
-      for (map <uint32_t, PartModel>::iterator partModel = framePartModels->second.begin(); partModel != framePartModels->second.end(); ++partModel)
+      auto bestCost = numeric_limits <float>::max();
+      uint32_t best = 0;
+      for (uint32_t c = 0; c < count; c++)
       {
-        if (partModel->first != static_cast <uint32_t> (bodyPart.getPartID()))
-        {
+        if (find(medoids.begin(), medoids.end(), c) != medoids.end())
           continue;
+        float cost = 0;
+        for (uint32_t i = 0; i < count; i++)
+          cost += min(nearest[i], distances[c * count + i]);
+        if (cost < bestCost)
+        {
+          bestCost = cost;
+          best = c;
         }
-        else
+      }
+      medoids.push_back(best);
+      for (uint32_t i = 0; i < count; i++)
+        nearest[i] = min(nearest[i], distances[best * count + i]);
+    }
+
+    // Alternate the assignment of the models to the nearest medoid and the choice of the medoid of each cluster
+    vector <uint32_t> clusters(count, 0);
+    auto assignClusters = [&]()
+    {
+      for (uint32_t i = 0; i < count; i++)
+      {
+        clusters[i] = 0;
+        for (uint32_t k = 1; k < medoids.size(); k++)
         {
-          if (model.gradientStrengths.size() != partModel->second.gradientStrengths.size())
-          {
-            stringstream ss;
-            ss << "Invalid descriptor count. Need: " << model.gradientStrengths.size() << ". Have: " << partModel->second.gradientStrengths.size();
-            if (debugLevelParam >= 1)
-              cerr << ERROR_HEADER << ss.str() << endl;
-            throw logic_error(ss.str());
-          }
-          uint32_t count = 0;
-          for (uint32_t i = 0; i < model.gradientStrengths.size(); i++)
+          if (distances[medoids[k] * count + i] < distances[medoids[clusters[i]] * count + i])
+            clusters[i] = k;
+        }
+      }
+    };
+    const uint32_t maxIterations = 100;
+    auto bChanged = true;
+    for (uint32_t iteration = 0; iteration < maxIterations && bChanged; iteration++)
+    {
+      assignClusters();
+      bChanged = false;
+      for (uint32_t k = 0; k < medoids.size(); k++)
+      {
+        auto bestCost = numeric_limits <float>::max();
+        auto best = medoids[k];
+        for (uint32_t c = 0; c < count; c++)
+        {
+          if (clusters[c] != k)
+            continue;
+          float cost = 0;
+          for (uint32_t i = 0; i < count; i++)
+            if (clusters[i] == k)
+              cost += distances[c * count + i];
+          if (cost < bestCost)
           {
-            if (model.gradientStrengths.at(i).size() != partModel->second.gradientStrengths.at(i).size())
-            {
-              stringstream ss;
-              ss << "Invalid descriptor count. Need: " << model.gradientStrengths.at(i).size() << ". Have: " << partModel->second.gradientStrengths.at(i).size();
-              if (debugLevelParam >= 1)
-                cerr << ERROR_HEADER << ss.str() << endl;
-              throw logic_error(ss.str());
-            }
-            for (uint32_t j = 0; j < model.gradientStrengths.at(i).size(); j++)
-            {
-              for (uint8_t b = 0; b < nbins; b++)
-              {
-                try
-                {
-                  count++;
-                  score += abs(model.gradientStrengths.at(i).at(j).at(b) - partModel->second.gradientStrengths.at(i).at(j).at(b));
-                  //score += sqrt(pow(model.gradientStrengths.at(i).at(j).at(b), 2) - pow(partModel->second.gradientStrengths.at(i).at(j).at(b), 2));
-                }
-                catch (...)
-                {
-                  stringstream ss;
-                  ss << "Can't get some descriptor at [" << i << "][" << j << "][" << b << "]";
-                  if (debugLevelParam >= 1)
-                    cerr << ERROR_HEADER << ss.str() << endl;
-                  throw logic_error(ss.str());
-                }
-              }
-            }
+            bestCost = cost;
+            best = c;
           }
-          totalcount += count;
-          break;
         }
+        bChanged = bChanged || best != medoids[k];
+        medoids[k] = best;
       }
     }
-    return (score / (float)totalcount);
+    if (bChanged)
+      assignClusters(); // the clusters of the last medoids
+
+    PartTemplates compressed;
+    compressed.rows = templates.rows;
+    compressed.cols = templates.cols;
+    compressed.count = static_cast <uint32_t> (medoids.size());
+    compressed.weights.assign(medoids.size(), 0.0f);
+    for (auto cluster : clusters)
+      compressed.weights[cluster]++;
+    for (auto medoid : medoids)
+      compressed.strengths.insert(compressed.strengths.end(), templates.strengths.begin() + medoid * length, templates.strengths.begin() + (medoid + 1) * length);
+    return compressed;
   }
 
   map <uint32_t, map <uint32_t, vector <HogDetector::PartModel>>> HogDetector::getLabelModels(void)
   {
+    lock_guard <mutex> lock(labelModelsMutex);
     return labelModels;
   }
 
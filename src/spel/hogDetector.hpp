@@ -8,6 +8,12 @@
 #include <gtest/gtest_prod.h>
 #endif  // DEBUG
 
+// STL
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
+
 // OpenCV
 #include <opencv2/opencv.hpp>
 
@@ -18,6 +24,31 @@ namespace SPEL
   using namespace std;
   using namespace cv;
 
+  // Dense orientation histograms of the frame, rotated to the angle of the candidates
+  struct HogGradientTile
+  {
+    float angle;
+    Point2f origin; // rotated coordinates of the tile pixel (0, 0) as in RotatedImageBank
+    vector <Mat> binIntegrals; // integral images of the gradient magnitudes of each orientation bin, CV_64F
+  };
+
+  class HogDetectorHelper : public DetectorHelper
+  {
+  public:
+    HogDetectorHelper(void);
+    virtual ~HogDetectorHelper(void);
+    float useHoGdet = 1.0f;
+    // Gradient tiles of the processed frame, used by the detector trained with the "denseHog" param
+    uint32_t gradientTilesCapacity = 8;
+    list <shared_ptr <const HogGradientTile>> gradientTiles; // the most recently used tile is the first
+    mutex gradientTilesMutex;
+    // Gray copy of the processed frame and its rotated tiles, converted once by the detector trained with the "grayImages" param
+    Mat grayImageSource;
+    Mat grayImage;
+    shared_ptr <RotatedImageBank> grayImageBank;
+    once_flag grayImageOnce;
+  };
+
   class HogDetector : public Detector
   {
   protected:
@@ -30,13 +61,23 @@ namespace SPEL
       vector<float> descriptors;
 #endif  // DEBUG
     };
+    // Gradient strengths of all the trained models of the part, flattened and stored one after another for the batch comparison
+    struct PartTemplates
+    {
+      uint32_t rows = 0; // cells of the model
+      uint32_t cols = 0;
+      uint32_t count = 0; // count of the templates
+      vector <float> strengths;
+      vector <float> weights; // count of the models represented by each template after the compression, empty if every template is the model
+    };
   public:
     HogDetector(void);
     virtual ~HogDetector(void);
     virtual int getID(void) const;
     virtual void setID(int _id);
     virtual void train(vector <Frame*> _frames, map <string, float> params);
-    virtual map <uint32_t, vector <LimbLabel>> detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels);
+    virtual float score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const;
+    using Detector::score;
     virtual map <uint32_t, map <uint32_t, vector <PartModel>>> getLabelModels(void);
     virtual map <uint32_t, map <uint32_t, PartModel>> getPartModels(void);
 
@@ -50,19 +91,29 @@ namespace SPEL
     FRIEND_TEST(HOGDetectorTests, train);
     FRIEND_TEST(HOGDetectorTests, generateLabel);
     FRIEND_TEST(HOGDetectorTests, detect);
+    FRIEND_TEST(HOGDetectorTests, detectPyramid);
+    FRIEND_TEST(HOGDetectorTests, labelModelsRetention);
     FRIEND_TEST(HOGDetectorTests, compare);
+    FRIEND_TEST(HOGDetectorTests, buildPartTemplates);
+    FRIEND_TEST(HOGDetectorTests, compressPartTemplates);
+    FRIEND_TEST(HOGDetectorTests, sumAbsDifferences);
+    FRIEND_TEST(HOGDetectorTests, getWorkImage);
     FRIEND_TEST(HOGDetectorTests, getLabelModels);
     FRIEND_TEST(HOGDetectorTests, getPartModels);
     FRIEND_TEST(HOGDetectorTests, getCellSize);
     FRIEND_TEST(HOGDetectorTests, getNBins);
+    FRIEND_TEST(HOGDetectorTests, computeDenseDescriptors);
 #endif  // DEBUG
     int id;
   protected:
     const uint8_t nbins = 9;
     map <uint32_t, Size> partSize;
     map <uint32_t, map <uint32_t, PartModel>> partModels;
-    map <uint32_t, map <uint32_t, vector <PartModel>>> labelModels;
+    map <uint32_t, PartTemplates> partTemplates; // built from "partModels" by train
+    mutable map <uint32_t, map <uint32_t, vector <PartModel>>> labelModels;
     bool bGrayImages = false;
+    uint32_t templatesBudget = 0; // templates of each part kept by the compression of the trained models, 0 - all the models
+    bool bDenseHog = false; // the cell histograms are summed from the dense gradient tiles instead of HOGDescriptor of each part image
     float useHoGdet = 1.0f;
     //TODO(Vitaliy Koshura): Make some of them as detector params
     Size blockSize = Size(16, 16);
@@ -77,17 +128,27 @@ namespace SPEL
     Size padding = Size(32, 32);
     int derivAperture = 1;
     int histogramNormType = HOGDescriptor::L2Hys;
-    // Variables for score comparer
-    BodyPart *comparer_bodyPart = 0;
-    PartModel *comparer_model = 0;
+    mutable mutex labelModelsMutex;
 
-    virtual LimbLabel generateLabel(BodyPart bodyPart, Frame *frame, Point2f j0, Point2f j1);
+    virtual DetectorHelper *createDetectorHelper(const Frame *frame, map <string, float> params) const;
+    virtual LimbLabel generateLabel(BodyPart bodyPart, const Frame *frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const;
 
-    virtual map <uint32_t, Size> getMaxBodyPartHeightWidth(vector <Frame*> frames, Size blockSize, float resizeFactor);
-    virtual PartModel computeDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, Mat imgMat, int nbins, Size wndSize, Size blockSize, Size blockStride, Size cellSize, double wndSigma, double thresholdL2hys, bool gammaCorrection, int nlevels, int derivAperture, int histogramNormType);
+    virtual map <uint32_t, Size> getMaxBodyPartHeightWidth(vector <Frame*> frames, Size blockSize, float resizeFactor) const;
+    virtual PartModel computeDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, Mat imgMat, int nbins, Size wndSize, Size blockSize, Size blockStride, Size cellSize, double wndSigma, double thresholdL2hys, bool gammaCorrection, int nlevels, int derivAperture, int histogramNormType, RotatedImageBank *rotatedImageBank = 0) const;
     virtual map <uint32_t, PartModel> computeDescriptors(Frame *frame, int nbins, Size blockSize, Size blockStride, Size cellSize, double wndSigma, double thresholdL2hys, bool gammaCorrection, int nlevels, int derivAperture, int histogramNormType);
-    virtual float compare(BodyPart bodyPart, PartModel partModel, uint8_t nbins);
-    virtual float compare(void);
+    virtual shared_ptr <const HogGradientTile> buildGradientTile(const Mat &imgMat, Point2f center, float angle, int halfSize, int nbins, bool gammaCorrection) const;
+    virtual shared_ptr <const HogGradientTile> getGradientTile(HogDetectorHelper *helper, const Mat &imgMat, Point2f center, float angle, Size size, int nbins, bool gammaCorrection, Point &offset) const;
+    virtual PartModel computeDenseDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, const Mat &imgMat, int nbins, Size wndSize, Size blockSize, Size blockStride, Size cellSize, double thresholdL2hys, bool gammaCorrection, HogDetectorHelper *helper = 0) const;
+    virtual Mat getWorkImage(const Frame &frame, DetectorHelper *detectorHelper, RotatedImageBank *&rotatedImageBank) const;
+    virtual Size getPartSize(const BodyPart &bodyPart) const;
+    virtual void flattenGradientStrengths(const PartModel &partModel, uint8_t nbins, vector <float> &strengths) const;
+    virtual PartTemplates buildPartTemplates(uint32_t partID, uint8_t nbins) const;
+    virtual PartTemplates compressPartTemplates(const PartTemplates &templates, uint32_t budget) const;
+    // L1 kernel of compare, the AVX version (hogDetectorAvx.hpp) is built with the SPEL_AVX cmake option and is used if the CPU supports it
+    static float sumAbsDifferences(const float *candidate, const float *templates, uint32_t length, uint32_t count, const float *weights = 0);
+    static float sumAbsDifferencesScalar(const float *candidate, const float *templates, uint32_t length, uint32_t count, const float *weights = 0);
+    static bool isAvxSupported(void);
+    virtual float compare(BodyPart bodyPart, const PartModel &partModel, uint8_t nbins) const;
   };
 }
 #endif  // _LIBPOSE_HOGDETECTOR_HPP_
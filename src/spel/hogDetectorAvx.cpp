@@ -0,0 +1,34 @@
+#include "hogDetectorAvx.hpp"
+
+#ifdef SPEL_AVX
+#include <immintrin.h>
+
+namespace SPEL
+{
+  // 8 differences at once, the sums of the lanes are added in the end, so the result may differ from the scalar one by the rounding
+  float sumAbsDifferencesAvx(const float *candidate, const float *templates, uint32_t length, uint32_t count, const float *weights)
+  {
+    const auto signMask = _mm256_set1_ps(-0.0f);
+    float total = 0;
+    for (uint32_t t = 0; t < count; t++, templates += length)
+    {
+      auto partialSums = _mm256_setzero_ps();
+      uint32_t i = 0;
+      for (; i + 8 <= length; i += 8)
+        partialSums = _mm256_add_ps(partialSums, _mm256_andnot_ps(signMask, _mm256_sub_ps(_mm256_loadu_ps(candidate + i), _mm256_loadu_ps(templates + i))));
+      float lanes[8];
+      _mm256_storeu_ps(lanes, partialSums);
+      float templateSum = 0;
+      for (auto lane : lanes)
+        templateSum += lane;
+      for (; i < length; i++)
+      {
+        auto difference = candidate[i] - templates[i];
+        templateSum += difference < 0 ? -difference : difference;
+      }
+      total += (weights == 0) ? templateSum : weights[t] * templateSum;
+    }
+    return total;
+  }
+}
+#endif  // SPEL_AVX
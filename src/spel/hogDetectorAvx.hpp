@@ -0,0 +1,18 @@
+#ifndef _LIBPOSE_HOGDETECTORAVX_HPP_
+#define _LIBPOSE_HOGDETECTORAVX_HPP_
+
+// SPEL definitions
+#include "predef.hpp"
+
+// STL
+#include <cstdint>
+
+namespace SPEL
+{
+#ifdef SPEL_AVX
+  // AVX version of HogDetector::sumAbsDifferences, it is the only code built with the AVX flag and may be called only if the CPU supports AVX.
+  // The header includes nothing else, so no inline function of the other headers is compiled with the AVX instructions
+  float sumAbsDifferencesAvx(const float *candidate, const float *templates, uint32_t length, uint32_t count, const float *weights = 0);
+#endif  // SPEL_AVX
+}
+#endif  // _LIBPOSE_HOGDETECTORAVX_HPP_
@@ -25,6 +25,10 @@ namespace SPEL
     isOccluded = ll.getIsOccluded();
   }
 
+  LimbLabel::LimbLabel(LimbLabel&& ll) : center(ll.center), limbID(ll.limbID), angle(ll.angle), scores(move(ll.scores)), polygon(move(ll.polygon)), isOccluded(ll.isOccluded)
+  {
+  }
+
   LimbLabel::LimbLabel(int _id, Point2f _centre, float _angle, vector<Point2f> _polygon, vector<Score> _scores, bool _isOccluded)
   {
     limbID = _id;
@@ -54,6 +58,21 @@ namespace SPEL
     return *this;
   }
 
+  LimbLabel &LimbLabel::operator=(LimbLabel &&ll)
+  {
+    if (this == &ll)
+    {
+      return *this;
+    }
+    this->limbID = ll.limbID;
+    this->center = ll.center;
+    this->angle = ll.angle;
+    this->scores = move(ll.scores);
+    this->polygon = move(ll.polygon);
+    this->isOccluded = ll.isOccluded;
+    return *this;
+  }
+
   bool LimbLabel::operator==(const LimbLabel &ll) const
   {
     return (this->limbID == ll.getLimbID() && this->center == ll.getCenter() && this->angle == ll.getAngle());
@@ -32,11 +32,13 @@ namespace SPEL
   public:
     LimbLabel();
     LimbLabel(const LimbLabel& ll);
+    LimbLabel(LimbLabel&& ll);
     LimbLabel(int _id, Point2f _centre, float _angle, vector<Point2f> _polygon, vector<Score> _scores, bool _isOccluded = false);
     virtual ~LimbLabel(void);
     /// output labels as printable string
     virtual string toString();
     virtual LimbLabel & operator = (const LimbLabel &ll);
+    virtual LimbLabel & operator = (LimbLabel &&ll);
     virtual bool operator == (const LimbLabel &ll) const;
     virtual bool operator != (const LimbLabel &ll) const;
     virtual bool operator < (const LimbLabel &ll) const;
@@ -34,6 +34,8 @@ vector<Solvlet> NSKPSolver::solve(Sequence& sequence, map<string, float> params)
 
 vector<Solvlet> NSKPSolver::solve(Sequence& sequence, map<string, float>  params, const ImageSimilarityMatrix& ism)//, function<float(float)> progressFunc) //inherited virtual
 {
+    ResizedFrameCache::Scope resizedFramesScope; //the detectors share the resized frames within the solve
+
     //parametrise the number of times frames get propagated
     params.emplace("nskpIters", 2); //set number of iterations, 0 to iterate until no new lockframes are introduced
 
@@ -50,6 +52,7 @@ vector<Solvlet> NSKPSolver::solve(Sequence& sequence, map<string, float>  params
     vector<int> ignore; //frames to ignore during propagation
 
     vector<MinSpanningTree> trees = buildFrameMSTs(ism, params);
+    colorHistModels.clear(); //the models of the previous solve are not used
 
     //progressFunc(0.0);
     for (uint32_t iteration = 0; iteration < nskpIters; ++iteration)
@@ -83,6 +86,8 @@ vector<Solvlet> NSKPSolver::solve(Sequence& sequence, map<string, float>  params
     //progressFunc(1.0);
 
 
+    colorHistModels.clear();
+
     sequence.setFrames(propagatedFrames); //set the new frames to sequence
 
     for(auto p : propagatedFrames) //delete the frame vector as it is no longer being used
@@ -117,6 +122,7 @@ vector<NSKPSolver::SolvletScore> NSKPSolver::propagateFrame(int frameId, const v
     params.emplace("useHoGdet", 0.0); //determine if HoG descriptor is used and with what coefficient
     params.emplace("useSURFdet", 0.0); //determine whether SURF detector is used and with what coefficient
     params.emplace("maxPartCandidates", 40); //set the max number of part candidates to allow into the solver
+    params.emplace("nskpIncrementalModels", 0); //grow the ColHist models of the lockframes from the models of their parent frames instead of retraining
 
     //detector search parameters
 
@@ -162,6 +168,7 @@ vector<NSKPSolver::SolvletScore> NSKPSolver::propagateFrame(int frameId, const v
     float useSURF = params.at("useSURFdet");
     uint32_t debugLevel = params.at("debugLevel");
     bool propagateFromLockframes=params.at("propagateFromLockframes");
+    bool incrementalModels=params.at("nskpIncrementalModels");
 
     bool isIgnored=false;
     for(uint32_t i=0; i<ignore.size(); ++i)
@@ -195,7 +202,24 @@ vector<NSKPSolver::SolvletScore> NSKPSolver::propagateFrame(int frameId, const v
 
         for(uint32_t i=0; i<detectors.size(); ++i)
         {
-            detectors[i]->train(trainingFrames, params);
+            ColorHistDetector *colorHistDetector = dynamic_cast<ColorHistDetector*>(detectors[i]);
+            if(incrementalModels && colorHistDetector!=0)
+            {
+                //a lockframe grows the models of the frame it was propagated from, instead of training from scratch
+                map<int, shared_ptr<ColorHistDetector> >::iterator parentModel = colorHistModels.find(frames[frameId]->getParentFrameID());
+                if(frames[frameId]->getFrametype()==LOCKFRAME && parentModel!=colorHistModels.end())
+                {
+                    colorHistDetector = new ColorHistDetector(*parentModel->second);
+                    delete detectors[i];
+                    detectors[i] = colorHistDetector;
+                    colorHistDetector->update(trainingFrames, params);
+                }
+                else
+                    colorHistDetector->train(trainingFrames, params);
+                colorHistModels[frames[frameId]->getID()] = make_shared<ColorHistDetector>(*colorHistDetector); //keep the models for the lockframes of this frame
+            }
+            else
+                detectors[i]->train(trainingFrames, params);
         }
 
 
@@ -1033,24 +1057,30 @@ float NSKPSolver::evaluateSolution(Frame* frame, vector<LimbLabel> labels, map<s
     int incorrectlyCoveredPixels = 0;
     int missedPixels = 0;
 
-    for (int i = 0; i < mask.cols; ++i) //at every col - x
+    //mark the pixels covered by the labels of the solution, the pixels on the edges are covered as in LimbLabel::containsPoint
+    Mat labelsHits(mask.rows, mask.cols, CV_8UC1, Scalar(0));
+    for (vector<LimbLabel>::iterator label = labels.begin(); label != labels.end(); ++label)
+    {
+        vector<Point2f> poly = label->getPolygon();
+        POSERECT<Point2f> rect(poly[0], poly[1], poly[2], poly[3]);
+        rect.ForEachRowSpan(Rect(0, 0, mask.cols, mask.rows), true, [&](int y, int xBegin, int xEnd)
+        {
+            uchar *hitsRow = labelsHits.ptr<uchar>(y);
+            fill(hitsRow + xBegin, hitsRow + xEnd, 1);
+        });
+    }
+
+    for (int j = 0; j < mask.rows; ++j) //at every row - y
     {
-        for (int j = 0; j < mask.rows; ++j) //and every row - y
+        const uchar *maskRow = mask.ptr<uchar>(j);
+        const uchar *hitsRow = labelsHits.ptr<uchar>(j);
+        for (int i = 0; i < mask.cols; ++i) //and every col - x
         {
-            //int test = labels[0].containsPoint(Point2f(480,100));
             //check whether pixel hit a label from solution
-            bool labelHit = false;
-            for (vector<LimbLabel>::iterator label = labels.begin(); label != labels.end(); ++label)
-            {
-                if (label->containsPoint(Point2f(i, j))) //this is done in x,y coords
-                {
-                    labelHit = true;
-                    //break;
-                }
-            }
+            bool labelHit = (hitsRow[i] != 0);
 
             //check pixel colour
-            int intensity = mask.at<uchar>(j, i); //this is done with reve
+            int intensity = maskRow[i];
             bool blackPixel = (intensity < 10);
 
             if (!blackPixel)
@@ -1087,33 +1117,26 @@ float NSKPSolver::evaluateSolution(Frame* frame, vector<LimbLabel> labels, map<s
     for (vector<LimbLabel>::iterator label = labels.begin(); label != labels.end(); ++label)
     {
         vector<Point2f> poly = label->getPolygon(); //get the label polygon
-        //compute min and max x and y
-        //float xMin, xMax, yMin, yMax;
-        vector<float> xS = { poly[0].x, poly[1].x, poly[2].x, poly[3].x };
-        vector<float> yS = { poly[0].y, poly[1].y, poly[2].y, poly[3].y };
-        auto xMin = min_element(xS.begin(), xS.end());
-        auto xMax = max_element(xS.begin(), xS.end());
-
-        auto yMin = min_element(yS.begin(), yS.end());
-        auto yMax = max_element(yS.begin(), yS.end());
+        POSERECT<Point2f> rect(poly[0], poly[1], poly[2], poly[3]);
+        //compute max x and y, the pixels on the max borders of the bounding box are not counted
+        float xMax = max(max(poly[0].x, poly[1].x), max(poly[2].x, poly[3].x));
+        float yMax = max(max(poly[0].y, poly[1].y), max(poly[2].y, poly[3].y));
+        Rect area(0, 0, max(0, min(mask.cols, (int)ceil(xMax))), max(0, min(mask.rows, (int)ceil(yMax))));
 
         int labelPixels = 0;
         int badLabelPixels = 0;
 
-        for (int x = *xMin; x < *xMax; ++x)
+        rect.ForEachRowSpan(area, true, [&](int y, int xBegin, int xEnd)
         {
-            for (int y = *yMin; y < *yMax; ++y)
+            const uchar *maskRow = mask.ptr<uchar>(y);
+            for (int x = xBegin; x < xEnd; ++x)
             {
-                if (label->containsPoint(Point2f(x, y)))
-                {
-                    int intensity = mask.at<uchar>(y, x); //this is done with reverse y,x
-                    bool blackPixel = (intensity < 10);
-                    labelPixels++;
-                    if (blackPixel)
-                        ++badLabelPixels;
-                }
+                bool blackPixel = (maskRow[x] < 10);
+                labelPixels++;
+                if (blackPixel)
+                    ++badLabelPixels;
             }
-        }
+        });
 
         float labelRatio = 1.0 - (float)badLabelPixels / (float)labelPixels; //high is good
 
@@ -10,6 +10,8 @@
 
 // STL
 #include <vector>
+#include <map>
+#include <memory>
 #include <limits>
 #include <opencv2/opencv.hpp>
 #include <tree.hh>
@@ -96,6 +98,8 @@ namespace SPEL
     virtual vector<NSKPSolver::SolvletScore> propagateFrame(int frameId, const vector<Frame *> frames, map<string, float> params, const ImageSimilarityMatrix& ism, const vector<MinSpanningTree> &trees, vector<int> &ignore);
     virtual int test(int frameId, const vector<Frame*>& frames, map<string, float> params, const ImageSimilarityMatrix &ism, const vector<MinSpanningTree> &trees, vector<int>& ignore); //test function
 
+    map<int, shared_ptr<ColorHistDetector> > colorHistModels; //trained ColHist models of the propagated frames by frame ID, used with "nskpIncrementalModels"
+
 //    vector<vector<Frame*> > slice(const vector<Frame*>& frames);
 
     //INHERITED
@@ -0,0 +1,103 @@
+#include "resizedFrameCache.hpp"
+#include "keyframe.hpp"
+#include "lockframe.hpp"
+#include "interpolation.hpp"
+
+namespace SPEL
+{
+  list <ResizedFrameCache::Entry> ResizedFrameCache::entries;
+  uint32_t ResizedFrameCache::capacity = 4; // all the detectors of the solver on the current frame and its neighbours
+  mutex ResizedFrameCache::entriesMutex;
+  uint32_t ResizedFrameCache::scopesCount = 0;
+
+  ResizedFrameCache::Scope::Scope(void)
+  {
+    lock_guard <mutex> lock(entriesMutex);
+    scopesCount++;
+  }
+
+  ResizedFrameCache::Scope::~Scope(void)
+  {
+    lock_guard <mutex> lock(entriesMutex);
+    if (--scopesCount == 0)
+      entries.clear(); // the copies stay valid for their current users
+  }
+
+  shared_ptr <const Frame> ResizedFrameCache::getFrame(Frame *frame, uint32_t maxHeight, float &resizeFactor)
+  {
+    auto frameId = frame->getID();
+    auto contentVersion = frame->getContentVersion();
+    {
+      lock_guard <mutex> lock(entriesMutex);
+      for (auto entry = entries.begin(); entry != entries.end(); ++entry)
+      {
+        if (entry->frameId == frameId && entry->maxHeight == maxHeight && entry->contentVersion == contentVersion)
+        {
+          entries.splice(entries.begin(), entries, entry);
+          resizeFactor = entries.front().resizeFactor;
+          return entries.front().frame;
+        }
+      }
+    }
+
+    // The copy is built without the lock, the resizing of the different frames runs in parallel
+    Frame *workFrame = 0;
+    if (frame->getFrametype() == KEYFRAME)
+      workFrame = new Keyframe();
+    else if (frame->getFrametype() == LOCKFRAME)
+      workFrame = new Lockframe();
+    else if (frame->getFrametype() == INTERPOLATIONFRAME)
+      workFrame = new Interpolation();
+    else
+      workFrame = new Frame();
+    shared_ptr <Frame> copy(frame->clone(workFrame));
+    Entry newEntry;
+    newEntry.frameId = frameId;
+    newEntry.maxHeight = maxHeight;
+    newEntry.contentVersion = contentVersion;
+    newEntry.resizeFactor = copy->Resize(maxHeight);
+    newEntry.frame = copy;
+
+    lock_guard <mutex> lock(entriesMutex);
+    resizeFactor = newEntry.resizeFactor;
+    for (const auto &entry : entries)
+    {
+      if (entry.frameId == frameId && entry.maxHeight == maxHeight && entry.contentVersion == contentVersion)
+        return entry.frame; // built by the other thread meanwhile
+    }
+    if (capacity > 0 && scopesCount > 0)
+    {
+      entries.push_front(newEntry);
+      while (entries.size() > capacity)
+        entries.pop_back();
+    }
+    return newEntry.frame;
+  }
+
+  void ResizedFrameCache::setCapacity(uint32_t _capacity)
+  {
+    lock_guard <mutex> lock(entriesMutex);
+    capacity = _capacity;
+    while (entries.size() > capacity)
+      entries.pop_back();
+  }
+
+  uint32_t ResizedFrameCache::getCapacity(void)
+  {
+    lock_guard <mutex> lock(entriesMutex);
+    return capacity;
+  }
+
+  uint32_t ResizedFrameCache::getFramesCount(void)
+  {
+    lock_guard <mutex> lock(entriesMutex);
+    return static_cast <uint32_t> (entries.size());
+  }
+
+  void ResizedFrameCache::clear(void)
+  {
+    lock_guard <mutex> lock(entriesMutex);
+    entries.clear();
+  }
+
+}
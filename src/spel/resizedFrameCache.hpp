@@ -0,0 +1,60 @@
+#ifndef _LIBPOSE_RESIZEDFRAMECACHE_HPP_
+#define _LIBPOSE_RESIZEDFRAMECACHE_HPP_
+
+// SPEL definitions
+#include "predef.hpp"
+
+// STL
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "frame.hpp"
+
+namespace SPEL
+{
+  using namespace std;
+
+  ///Shared cache of the frame working copies, resized to the frame height of the detectors.
+  ///The detectors and the solvers, that process the same frame one after another, share the copy,
+  ///so the frame is cloned and resized only once. The copy is released when it is evicted and no one uses it.
+  ///The copies are kept only while a Scope is open, so they aren't shared between the solves
+  class ResizedFrameCache
+  {
+  public:
+    ///Scope of the sharing, e.g. the single solve. The cache is cleared when the last scope is closed,
+    ///outside of the scopes every call makes the new copy
+    class Scope
+    {
+    public:
+      Scope(void);
+      ~Scope(void);
+    };
+    ///Returns the copy of the frame, resized to "maxHeight". The copy is shared and must not be changed
+    ///Arguments:
+    ///frame - the source frame
+    ///maxHeight - height of the copy
+    ///resizeFactor - the factor, returned by Frame::Resize
+    static shared_ptr <const Frame> getFrame(Frame *frame, uint32_t maxHeight, float &resizeFactor);
+    ///Count of the copies kept inside of the scope, 0 - every call makes the new copy
+    static void setCapacity(uint32_t capacity);
+    static uint32_t getCapacity(void);
+    static uint32_t getFramesCount(void);
+    static void clear(void);
+  private:
+    struct Entry
+    {
+      int frameId;
+      uint32_t maxHeight;
+      uint64_t contentVersion;
+      float resizeFactor;
+      shared_ptr <const Frame> frame;
+    };
+    static list <Entry> entries; // the most recently used copy is the first
+    static uint32_t capacity;
+    static uint32_t scopesCount;
+    static mutex entriesMutex;
+  };
+}
+
+#endif  // _LIBPOSE_RESIZEDFRAMECACHE_HPP_
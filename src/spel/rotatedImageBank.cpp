@@ -0,0 +1,166 @@
+#include "rotatedImageBank.hpp"
+
+#define ERROR_HEADER __FILE__ << ":" << __LINE__ << ": "
+
+namespace SPEL
+{
+  list <pair <RotatedImageBank::BankKey, shared_ptr <RotatedImageBank>>> RotatedImageBank::banks;
+  mutex RotatedImageBank::banksMutex;
+
+  bool RotatedImageBank::BankKey::operator==(const BankKey &key) const
+  {
+    return frameId == key.frameId && size == key.size && data == key.data;
+  }
+
+  RotatedImageBank::RotatedImageBank(Mat _image, uint32_t _capacity) : image(_image), capacity(_capacity)
+  {
+    if (image.type() != CV_8UC3 && image.type() != CV_8UC1)
+    {
+      stringstream ss;
+      ss << "Only CV_8UC3 and CV_8UC1 images can be rotated";
+#ifdef DEBUG
+      cerr << ERROR_HEADER << ss.str() << endl;
+#endif  // DEBUG
+      throw logic_error(ss.str());
+    }
+  }
+
+  RotatedImageBank::~RotatedImageBank(void)
+  {
+    tiles.clear();
+    image.release();
+  }
+
+  shared_ptr <RotatedImageBank> RotatedImageBank::getBank(int frameId, Mat image, uint32_t capacity)
+  {
+    BankKey key;
+    key.frameId = frameId;
+    key.size = image.size();
+    key.data = image.data; // frames with the same id may come from the different sequences, the cached bank holds the buffer, so it isn't reused
+
+    lock_guard <mutex> lock(banksMutex);
+    for (auto bank = banks.begin(); bank != banks.end(); ++bank)
+    {
+      if (bank->first == key && bank->second->getCapacity() == capacity)
+      {
+        banks.splice(banks.begin(), banks, bank);
+        return banks.front().second;
+      }
+    }
+    banks.push_front(pair <BankKey, shared_ptr <RotatedImageBank>>(key, make_shared <RotatedImageBank>(image, capacity)));
+    while (banks.size() > banksCount)
+      banks.pop_back();
+    return banks.front().second;
+  }
+
+  shared_ptr <const RotatedImageBank::Tile> RotatedImageBank::buildTile(Point2f center, float angle, int halfSize) const
+  {
+    auto tile = make_shared <Tile>();
+    tile->angle = angle;
+    tile->origin = spelHelper::rotatePoint2D(center, Point2f(0, 0), -angle) - Point2f(static_cast <float> (halfSize), static_cast <float> (halfSize));
+    tile->image = rotateImage(image, tile->origin, angle, Size(2 * halfSize + 1, 2 * halfSize + 1));
+    return tile;
+  }
+
+  namespace
+  {
+    template <typename Pixel> void sampleRotatedImage(const Mat &image, Point2f origin, float angle, Mat &rotated)
+    {
+      auto width = image.cols;
+      auto height = image.rows;
+      // The same float operations as spelHelper::rotatePoint2D around (0, 0), the trigonometry and the column parts are computed once
+      float radians = angle * M_PI / 180.0;
+      auto cosAngle = cosf(radians);
+      auto sinAngle = sinf(radians);
+      vector <float> xCos(rotated.cols), xSin(rotated.cols);
+      for (auto u = 0; u < rotated.cols; u++)
+      {
+        auto x = static_cast <float> (u) + origin.x;
+        xCos[u] = x * cosAngle;
+        xSin[u] = x * sinAngle;
+      }
+      // The same sampling as Detector::rotateImageToDefault: the nearest pixel, black outside the image
+      for (auto v = 0; v < rotated.rows; v++)
+      {
+        auto y = static_cast <float> (v) + origin.y;
+        auto ySin = y * sinAngle;
+        auto yCos = y * cosAngle;
+        auto row = rotated.ptr<Pixel>(v);
+        for (auto u = 0; u < rotated.cols; u++)
+        {
+          auto px = xCos[u] - ySin;
+          auto py = xSin[u] + yCos;
+          if (0 <= px && 0 <= py && px < width - 1 && py < height - 1)
+            row[u] = image.ptr<Pixel>(static_cast <int> (round(py)))[static_cast <int> (round(px))];
+        }
+      }
+    }
+  }
+
+  Mat RotatedImageBank::rotateImage(const Mat &image, Point2f origin, float angle, Size size)
+  {
+    Mat rotated = Mat(size, image.type() == CV_8UC1 ? CV_8UC1 : CV_8UC3, Scalar(0, 0, 0));
+    if (image.type() == CV_8UC1)
+      sampleRotatedImage<uint8_t>(image, origin, angle, rotated);
+    else
+      sampleRotatedImage<Vec3b>(image, origin, angle, rotated);
+    return rotated;
+  }
+
+  bool RotatedImageBank::getPartImage(Point2f center, float angle, Size size, Mat &partImage)
+  {
+    if (capacity == 0)
+      return false;
+
+    auto rotatedCenter = spelHelper::rotatePoint2D(center, Point2f(0, 0), -angle);
+    auto newCenter = Point2f(0.5f * size.width, 0.5f * size.height);
+    shared_ptr <const Tile> tile;
+    Point offset;
+    {
+      lock_guard <mutex> lock(tilesMutex);
+      for (auto t = tiles.begin(); t != tiles.end(); ++t)
+      {
+        if (abs((*t)->angle - angle) > angleTolerance)
+          continue;
+        auto o = rotatedCenter - newCenter - (*t)->origin;
+        auto r = Point(cvRound(o.x), cvRound(o.y));
+        if (r.x >= 0 && r.y >= 0 && r.x + size.width - 1 <= (*t)->image.cols && r.y + size.height - 1 <= (*t)->image.rows)
+        {
+          tile = *t;
+          offset = r;
+          tiles.splice(tiles.begin(), tiles, t);
+          break;
+        }
+      }
+    }
+    if (!tile)
+    {
+      // The tile covers the neighbourhood of the candidate, where the next candidates of this angle are searched
+      auto halfSize = 2 * max(size.width, size.height);
+      tile = buildTile(center, angle, halfSize);
+      auto o = rotatedCenter - newCenter - tile->origin;
+      offset = Point(cvRound(o.x), cvRound(o.y));
+      lock_guard <mutex> lock(tilesMutex);
+      tiles.push_front(tile);
+      while (tiles.size() > capacity)
+        tiles.pop_back();
+    }
+
+    partImage = Mat(size, image.type(), Scalar(0, 0, 0));
+    if (size.width > 1 && size.height > 1) // the last row and column stay black as in Detector::rotateImageToDefault
+      tile->image(Rect(offset.x, offset.y, size.width - 1, size.height - 1)).copyTo(partImage(Rect(0, 0, size.width - 1, size.height - 1)));
+    return true;
+  }
+
+  uint32_t RotatedImageBank::getCapacity(void) const
+  {
+    return capacity;
+  }
+
+  uint32_t RotatedImageBank::getTilesCount(void) const
+  {
+    lock_guard <mutex> lock(tilesMutex);
+    return static_cast <uint32_t> (tiles.size());
+  }
+
+}
@@ -0,0 +1,75 @@
+#ifndef _LIBPOSE_ROTATEDIMAGEBANK_HPP_
+#define _LIBPOSE_ROTATEDIMAGEBANK_HPP_
+
+// SPEL definitions
+#include "predef.hpp"
+
+// STL
+#include <list>
+#include <memory>
+#include <mutex>
+
+// OpenCV
+#include <opencv2/opencv.hpp>
+
+#include "spelHelper.hpp"
+
+namespace SPEL
+{
+  using namespace std;
+  using namespace cv;
+
+  ///Bounded cache of the image tiles, rotated to the search angles of the candidates.
+  ///The part image of the candidate is taken as the axis-aligned ROI of the tile instead of
+  ///the fresh warp, so one tile serves all the candidates of the same angle around the same place.
+  ///The part image may be shifted up to one pixel relatively to Detector::rotateImageToDefault
+  class RotatedImageBank
+  {
+  public:
+    RotatedImageBank(Mat image, uint32_t capacity);
+    virtual ~RotatedImageBank(void);
+    ///Returns the bank of the frame image, the banks of the recently used frames
+    ///are shared by all the detectors. The image is identified by its pixel buffer, without a pass over the pixels
+    static shared_ptr <RotatedImageBank> getBank(int frameId, Mat image, uint32_t capacity);
+    ///Builds the part image with the same layout as Detector::rotateImageToDefault
+    ///Arguments:
+    ///center - center of the part rectangle
+    ///angle - rotation angle of the part, degrees
+    ///size - size of the part image
+    ///Result:
+    ///false if the bank is disabled
+    virtual bool getPartImage(Point2f center, float angle, Size size, Mat &partImage);
+    ///Samples the image rotated by "angle" around the point (0, 0) on the pixel grid of "size", which starts at the rotated point "origin".
+    ///The nearest pixel is taken as in Detector::rotateImageToDefault, the points outside of the image are black.
+    ///The colour (CV_8UC3) and the gray (CV_8UC1) images are supported
+    static Mat rotateImage(const Mat &image, Point2f origin, float angle, Size size);
+    virtual uint32_t getCapacity(void) const;
+    virtual uint32_t getTilesCount(void) const;
+  private:
+    struct Tile
+    {
+      float angle;
+      Point2f origin; // rotated coordinates of the tile pixel (0, 0)
+      Mat image;
+    };
+    struct BankKey
+    {
+      int frameId;
+      Size size;
+      const uchar *data; // the pixels of the frame image
+      bool operator==(const BankKey &key) const;
+    };
+    const float angleTolerance = 0.001f; // angles of the same grid rotation differ only by the rounding error
+    static const uint32_t banksCount = 2; // count of the recent frames, whose banks are kept
+    Mat image;
+    uint32_t capacity;
+    list <shared_ptr <const Tile>> tiles; // the most recently used tile is the first
+    mutable mutex tilesMutex;
+    static list <pair <BankKey, shared_ptr <RotatedImageBank>>> banks;
+    static mutex banksMutex;
+
+    shared_ptr <const Tile> buildTile(Point2f center, float angle, int halfSize) const;
+  };
+}
+
+#endif  // _LIBPOSE_ROTATEDIMAGEBANK_HPP_
@@ -15,6 +15,8 @@
 #include "lockframe.hpp"
 #include "minspanningtree.hpp"
 #include "nskpsolver.hpp"
+#include "resizedFrameCache.hpp"
+#include "rotatedImageBank.hpp"
 #include "score.hpp"
 #include "sequence.hpp"
 #include "skeleton.hpp"
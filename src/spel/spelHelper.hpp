@@ -173,6 +173,62 @@ namespace SPEL
       maxy = max(max(point1.y, point2.y), max(point3.y, point4.y));
     }
 
+    ///find the segment, by which the horizontal line crosses the rectangle
+    ///Arguments:
+    ///y - ordinate of the line
+    ///left, right - ends of the segment
+    ///Result:
+    ///false if the line doesn't cross the rectangle
+    template <typename D>
+    bool GetRowSpan(D y, D &left, D &right) const
+    {
+      const T *points[] = { &point1, &point2, &point3, &point4 };
+      bool crossed = false;
+      for (auto k = 0; k < 4; k++)
+      {
+        const T &p = *points[k];
+        const T &q = *points[(k + 1) % 4];
+        if (y < min(p.y, q.y) || y > max(p.y, q.y))
+          continue;
+        D x0, x1;
+        if (p.y == q.y) // the edge lies on the line
+        {
+          x0 = static_cast <D> (min(p.x, q.x));
+          x1 = static_cast <D> (max(p.x, q.x));
+        }
+        else
+          x0 = x1 = p.x + (y - p.y) * (q.x - p.x) / (q.y - p.y);
+        left = crossed ? min(left, x0) : x0;
+        right = crossed ? max(right, x1) : x1;
+        crossed = true;
+      }
+      return crossed;
+    }
+
+    ///rasterize the rectangle row by row, the rectangle must be convex
+    ///Arguments:
+    ///area - only the pixels of this area are taken, usually the whole image
+    ///withEdges - take the pixels on the edges as well as containsPoint(...) != -1, otherwise only the inner pixels as containsPoint(...) > 0
+    ///spanFunction - called as spanFunction(y, xBegin, xEnd) for each row y, which has the pixels [xBegin, xEnd) in the rectangle
+    template <typename F>
+    void ForEachRowSpan(Rect area, bool withEdges, F spanFunction) const
+    {
+      double ymin = min(min(point1.y, point2.y), min(point3.y, point4.y));
+      double ymax = max(max(point1.y, point2.y), max(point3.y, point4.y));
+      auto yBegin = static_cast <int> (max<double>(area.y, withEdges ? ceil(ymin) : floor(ymin) + 1));
+      auto yEnd = static_cast <int> (min<double>(area.y + area.height, withEdges ? floor(ymax) + 1 : ceil(ymax)));
+      for (auto y = yBegin; y < yEnd; y++)
+      {
+        double left, right;
+        if (!GetRowSpan <double>(y, left, right))
+          continue;
+        auto xBegin = static_cast <int> (max<double>(area.x, withEdges ? ceil(left) : floor(left) + 1));
+        auto xEnd = static_cast <int> (min<double>(area.x + area.width, withEdges ? floor(right) + 1 : ceil(right)));
+        if (xBegin < xEnd)
+          spanFunction(y, xBegin, xEnd);
+      }
+    }
+
     template <typename D> 
     D GetCenter(void)
     {
@@ -4,6 +4,22 @@
 
 namespace SPEL
 {
+  list <pair <SurfDetector::FeaturesKey, shared_ptr <const SurfFrameFeatures>>> SurfDetector::framesFeatures;
+  mutex SurfDetector::framesFeaturesMutex;
+
+  SurfDetectorHelper::SurfDetectorHelper(void)
+  {
+  }
+
+  SurfDetectorHelper::~SurfDetectorHelper(void)
+  {
+    features.reset();
+  }
+
+  bool SurfDetector::FeaturesKey::operator==(const FeaturesKey &key) const
+  {
+    return frameId == key.frameId && size == key.size && imageData == key.imageData && maskData == key.maskData && minHessian == key.minHessian;
+  }
 
   SurfDetector::SurfDetector(void)
   {
@@ -42,6 +58,7 @@ namespace SPEL
 
     partModels.clear();
     labelModels.clear();
+    labelModelsScores.clear();
 
 #ifdef DEBUG
     const uint8_t debugLevel = 5;
@@ -64,6 +81,12 @@ namespace SPEL
 
     debugLevelParam = static_cast <uint8_t> (params.at(sDebugLevel));
 
+    const string sLabelModelsRetention = "labelModelsRetention"; // -1 - all the scored candidates, 0 - none, K - the K best candidates of each part
+
+    params.emplace(sLabelModelsRetention, static_cast <float> (labelModelsRetention));
+
+    labelModelsRetention = static_cast <int32_t> (params.at(sLabelModelsRetention));
+
     for (vector <Frame*>::iterator frameNum = frames.begin(); frameNum != frames.end(); ++frameNum)
     {
 
@@ -103,8 +126,8 @@ namespace SPEL
 
   }
 
-  //TODO (Vitaliy Koshura): Write real implementation here
-  map <uint32_t, vector <LimbLabel> > SurfDetector::detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels)
+  // Takes the features of the frame, that are shared by all the candidates of the current detect call
+  DetectorHelper *SurfDetector::createDetectorHelper(const Frame *frame, map <string, float> params) const
   {
     const string sMinHessian = "minHessian";
     const string sUseSURFdet = "useSURFdet";
@@ -115,28 +138,15 @@ namespace SPEL
     params.emplace(sUseSURFdet, useSURFdet);
     params.emplace(sKnnMatchCoeff, knnMatchCoeff);
 
-    //now set actual param values
-    minHessian = params.at(sMinHessian);
-    useSURFdet = params.at(sUseSURFdet);
-    knnMatchCoeff = params.at(sKnnMatchCoeff);
+    unique_ptr <SurfDetectorHelper> detectorHelper(new SurfDetectorHelper());
 
-    auto imgMat = frame->getImage();
+    //now set actual param values
+    auto minHessianParam = static_cast <uint32_t> (params.at(sMinHessian));
+    detectorHelper->useSURFdet = params.at(sUseSURFdet);
+    detectorHelper->knnMatchCoeff = params.at(sKnnMatchCoeff);
 
-#if OpenCV_VERSION_MAJOR == 3
-    Ptr <SurfFeatureDetector> detector = SurfFeatureDetector::create(minHessian);
-    detector->detect(imgMat, keyPoints);
-    if (keyPoints.empty())
-    {
-      stringstream ss;
-      ss << ERROR_HEADER << "Couldn't detect keypoints for frame " << frame->getID();
-      if (debugLevelParam >= 1)
-        cerr << ERROR_HEADER << ss.str() << endl;
-      throw logic_error(ss.str());
-    }
-#else
-    SurfFeatureDetector detector(minHessian);
-    detector.detect(imgMat, keyPoints);
-    if (keyPoints.empty())
+    detectorHelper->features = getFrameFeatures(frame, minHessianParam);
+    if (detectorHelper->features->keyPoints.empty())
     {
       stringstream ss;
       ss << ERROR_HEADER << "Couldn't detect keypoints for frame " << frame->getID();
@@ -144,13 +154,8 @@ namespace SPEL
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
-#endif
 
-    auto result = Detector::detect(frame, params, limbLabels);
-
-    keyPoints.clear();
-
-    return result;
+    return detectorHelper.release();
   }
 
   map <uint32_t, SurfDetector::PartModel> SurfDetector::computeDescriptors(Frame *frame, uint32_t minHessian)
@@ -158,24 +163,8 @@ namespace SPEL
     map <uint32_t, PartModel> parts;
     Skeleton skeleton = frame->getSkeleton();
     tree <BodyPart> partTree = skeleton.getPartTree();
-    Mat imgMat = frame->getImage();
-    vector <KeyPoint> keyPoints;
-
-#if OpenCV_VERSION_MAJOR == 3
-    Ptr <SurfFeatureDetector> detector = SurfFeatureDetector::create(minHessian);
-    detector->detect(imgMat, keyPoints);
-    if (keyPoints.empty())
-    {
-      stringstream ss;
-      ss << ERROR_HEADER << "Couldn't detect keypoints for frame " << frame->getID();
-      if (debugLevelParam >= 1)
-        cerr << ERROR_HEADER << ss.str() << endl;
-      throw logic_error(ss.str());
-    }
-#else
-    SurfFeatureDetector detector(minHessian);
-    detector.detect(imgMat, keyPoints);
-    if (keyPoints.empty())
+    auto features = getFrameFeatures(frame, minHessian);
+    if (features->keyPoints.empty())
     {
       stringstream ss;
       ss << ERROR_HEADER << "Couldn't detect keypoints for frame " << frame->getID();
@@ -183,7 +172,6 @@ namespace SPEL
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
-#endif
 
     for (tree <BodyPart>::iterator part = partTree.begin(); part != partTree.end(); ++part)
     {
@@ -214,7 +202,7 @@ namespace SPEL
       part->setRotationSearchRange(rotationAngle);
       try
       {
-        parts.insert(pair <uint32_t, PartModel>(part->getPartID(), computeDescriptors(*part, j0, j1, imgMat, minHessian, keyPoints)));
+        parts.insert(pair <uint32_t, PartModel>(part->getPartID(), computeDescriptors(*part, j0, j1, *features)));
       }
       catch (logic_error err)
       {
@@ -231,7 +219,8 @@ namespace SPEL
     return parts;
   }
 
-  SurfDetector::PartModel SurfDetector::computeDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, Mat imgMat, uint32_t minHessian, vector <KeyPoint> keyPoints)
+  // Selects the keypoints of the frame inside the part rectangle with their descriptors
+  SurfDetector::PartModel SurfDetector::computeDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, const SurfFrameFeatures &features) const
   {
     float boneLength = getBoneLength(j0, j1);
     float boneWidth = getBoneWidth(boneLength, bodyPart);
@@ -241,88 +230,162 @@ namespace SPEL
     PartModel partModel;
     partModel.partModelRect = rect;
 
-    for (vector <KeyPoint>::iterator kp = keyPoints.begin(); kp != keyPoints.end(); ++kp)
+    float xmin, ymin, xmax, ymax;
+    rect.GetMinMaxXY <float>(xmin, ymin, xmax, ymax);
+    vector <int> rows;
+    for (auto i = 0U; i < features.keyPoints.size(); i++)
     {
-      if (rect.containsPoint(kp->pt) > 0)
+      const auto &kp = features.keyPoints[i];
+      if (kp.pt.x < xmin || kp.pt.x > xmax || kp.pt.y < ymin || kp.pt.y > ymax)
+        continue;
+      if (rect.containsPoint(kp.pt) > 0)
       {
-        partModel.keyPoints.push_back(*kp);
+        partModel.keyPoints.push_back(kp);
+        rows.push_back(i);
       }
     }
 
-#if OpenCV_VERSION_MAJOR == 3
     if (partModel.keyPoints.empty())
     {
       if (debugLevelParam >= 2)
         cerr << ERROR_HEADER << "Couldn't detect keypoints of body part " << bodyPart.getPartID() << endl;
     }
-    else
-    {
-      Ptr <SurfDescriptorExtractor> extractor = SurfDescriptorExtractor::create();
-      extractor->compute(imgMat, partModel.keyPoints, partModel.descriptors);
-      if (partModel.descriptors.empty() && debugLevelParam >= 2)
-      {
-        cerr << ERROR_HEADER << "Couldn't compute descriptors of body part " << bodyPart.getPartID() << endl;
-      }
-    }
-#else
-    if (partModel.keyPoints.empty())
+    else if (features.descriptors.rows != static_cast <int> (features.keyPoints.size()))
     {
       if (debugLevelParam >= 2)
-        cerr << ERROR_HEADER << "Couldn't detect keypoints of body part " << bodyPart.getPartID() << endl;
+        cerr << ERROR_HEADER << "Couldn't compute descriptors of body part " << bodyPart.getPartID() << endl;
     }
     else
     {
-      SurfDescriptorExtractor extractor;
-      extractor.compute(imgMat, partModel.keyPoints, partModel.descriptors);
-      if (partModel.descriptors.empty() && debugLevelParam >= 2)
-      {
-        cerr << ERROR_HEADER << "Couldn't compute descriptors of body part " << bodyPart.getPartID() << endl;
-      }
+      partModel.descriptors = Mat(static_cast <int> (rows.size()), features.descriptors.cols, features.descriptors.type());
+      for (auto r = 0U; r < rows.size(); r++)
+        features.descriptors.row(rows[r]).copyTo(partModel.descriptors.row(r));
     }
-#endif
     return partModel;
   }
 
-  LimbLabel SurfDetector::generateLabel(BodyPart bodyPart, Frame *frame, Point2f j0, Point2f j1)
+  // The keypoints are detected inside the bounding box of the mask only, the mask is black where the value is less than 10
+  shared_ptr <const SurfFrameFeatures> SurfDetector::getFrameFeatures(const Frame *frame, uint32_t minHessian)
   {
-    stringstream detectorName;
-    detectorName << getID();
-
-    comparer_bodyPart = &bodyPart;
-
-    PartModel generatedPartModel = computeDescriptors(bodyPart, j0, j1, frame->getImage(), minHessian, keyPoints);
+    auto imgMat = frame->getImage();
+    auto maskMat = frame->getMask();
+    FeaturesKey key;
+    key.frameId = frame->getID();
+    key.size = imgMat.size();
+    key.imageData = imgMat.data;
+    key.maskData = maskMat.data;
+    key.minHessian = minHessian;
+    key.image = imgMat;
+    key.mask = maskMat;
 
-    comparer_model = &generatedPartModel;
-    comparer_j0 = &j0;
-    comparer_j1 = &j1;
+    {
+      lock_guard <mutex> lock(framesFeaturesMutex);
+      for (auto entry = framesFeatures.begin(); entry != framesFeatures.end(); ++entry)
+      {
+        if (entry->first == key)
+        {
+          framesFeatures.splice(framesFeatures.begin(), framesFeatures, entry);
+          return framesFeatures.front().second;
+        }
+      }
+    }
 
-    LimbLabel label = Detector::generateLabel(bodyPart, j0, j1, detectorName.str(), useSURFdet);
+    // The features are computed without the lock, the different frames are processed in parallel
+    auto features = make_shared <SurfFrameFeatures>();
+    auto maskBox = Rect(0, 0, imgMat.cols, imgMat.rows);
+    if (maskMat.type() == CV_8UC1 && maskMat.size() == imgMat.size())
+    {
+      vector <Point> foreground;
+      findNonZero(maskMat >= 10, foreground);
+      if (!foreground.empty())
+        maskBox = boundingRect(foreground);
+    }
+    Mat detectMask = Mat(imgMat.size(), CV_8UC1, Scalar(0));
+    detectMask(maskBox).setTo(Scalar(255));
+#if OpenCV_VERSION_MAJOR == 3
+    Ptr <SurfFeatureDetector> detector = SurfFeatureDetector::create(minHessian);
+    detector->detect(imgMat, features->keyPoints, detectMask);
+    if (!features->keyPoints.empty())
+    {
+      Ptr <SurfDescriptorExtractor> extractor = SurfDescriptorExtractor::create();
+      extractor->compute(imgMat, features->keyPoints, features->descriptors);
+    }
+#else
+    SurfFeatureDetector detector(minHessian);
+    detector.detect(imgMat, features->keyPoints, detectMask);
+    if (!features->keyPoints.empty())
+    {
+      SurfDescriptorExtractor extractor;
+      extractor.compute(imgMat, features->keyPoints, features->descriptors);
+    }
+#endif
 
-    labelModels[frame->getID()][bodyPart.getPartID()].push_back(generatedPartModel);
+    lock_guard <mutex> lock(framesFeaturesMutex);
+    for (const auto &entry : framesFeatures)
+    {
+      if (entry.first == key)
+        return entry.second; // computed by the other thread meanwhile
+    }
+    framesFeatures.push_front(pair <FeaturesKey, shared_ptr <const SurfFrameFeatures>>(key, features));
+    while (framesFeatures.size() > framesFeaturesCapacity)
+      framesFeatures.pop_back();
+    return features;
+  }
 
-    comparer_bodyPart = 0;
-    comparer_model->descriptors.release();
-    comparer_model = 0;
-    comparer_j0 = 0;
-    comparer_j1 = 0;
+  uint32_t SurfDetector::getFramesFeaturesCount(void)
+  {
+    lock_guard <mutex> lock(framesFeaturesMutex);
+    return static_cast <uint32_t> (framesFeatures.size());
+  }
 
-    return label;
+  float SurfDetector::score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const
+  {
+    auto helper = dynamic_cast <SurfDetectorHelper*> (detectorHelper);
+    if (helper == 0)
+    {
+      stringstream ss;
+      ss << "Wrong type of detectorHelper";
+      if (debugLevelParam >= 1)
+        cerr << ERROR_HEADER << ss.str() << endl;
+      throw logic_error(ss.str());
+    }
+    auto generatedPartModel = computeDescriptors(bodyPart, j0, j1, *helper->features);
+    auto result = compare(bodyPart, generatedPartModel, j0, j1, helper->knnMatchCoeff);
+    generatedPartModel.descriptors.release();
+    return result;
   }
 
-  float SurfDetector::compare(void)
+  LimbLabel SurfDetector::generateLabel(BodyPart bodyPart, const Frame *frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const
   {
-    if (comparer_bodyPart == 0 || comparer_model == 0 || comparer_j0 == 0 || comparer_j1 == 0)
+    stringstream detectorName;
+    detectorName << getID();
+
+    auto helper = dynamic_cast <SurfDetectorHelper*> (detectorHelper);
+    if (helper == 0)
     {
       stringstream ss;
-      ss << "Compare parameters are invalid: " << (comparer_bodyPart == 0 ? "comparer_bodyPart == 0 " : "") << (comparer_model == 0 ? "comparer_model == 0 " : "") << (comparer_j0 == 0 ? "comparer_j0 == 0 " : "") << (comparer_j1 == 0 ? "comparer_j1 == 0" : "") << endl;
+      ss << "Wrong type of detectorHelper";
       if (debugLevelParam >= 1)
         cerr << ERROR_HEADER << ss.str() << endl;
       throw logic_error(ss.str());
     }
-    return compare(*comparer_bodyPart, *comparer_model, *comparer_j0, *comparer_j1);
+
+    PartModel generatedPartModel = computeDescriptors(bodyPart, j0, j1, *helper->features);
+
+    LimbLabel label = Detector::generateLabel(bodyPart, j0, j1, detectorName.str(), helper->useSURFdet, [&]() { return compare(bodyPart, generatedPartModel, j0, j1, helper->knnMatchCoeff); });
+
+    if (labelModelsRetention != 0)
+    {
+      lock_guard <mutex> lock(labelModelsMutex); // labels of the different workers are generated concurrently
+      retainLabelModel(labelModels[frame->getID()][bodyPart.getPartID()], labelModelsScores[frame->getID()][bodyPart.getPartID()], generatedPartModel, label.getScores().front().getScore());
+    }
+
+    generatedPartModel.descriptors.release();
+
+    return label;
   }
 
-  float SurfDetector::compare(BodyPart bodyPart, PartModel model, Point2f j0, Point2f j1)
+  float SurfDetector::compare(BodyPart bodyPart, const PartModel &model, Point2f j0, Point2f j1, float knnMatchCoeff) const
   {
     if (model.descriptors.empty())
     {
@@ -340,9 +403,9 @@ namespace SPEL
     float width = getBoneWidth(length, bodyPart);
     float coeff = sqrt(pow(length, 2) + pow(width, 2));
 
-    for (map <uint32_t, map <uint32_t, PartModel>>::iterator framePartModels = partModels.begin(); framePartModels != partModels.end(); ++framePartModels)
+    for (map <uint32_t, map <uint32_t, PartModel>>::const_iterator framePartModels = partModels.begin(); framePartModels != partModels.end(); ++framePartModels)
     {
-      for (map <uint32_t, PartModel>::iterator partModel = framePartModels->second.begin(); partModel != framePartModels->second.end(); ++partModel)
+      for (map <uint32_t, PartModel>::const_iterator partModel = framePartModels->second.begin(); partModel != framePartModels->second.end(); ++partModel)
       {
         if (partModel->first != static_cast <uint32_t> (bodyPart.getPartID()))
         {
@@ -401,6 +464,7 @@ namespace SPEL
 
   map <uint32_t, map <uint32_t, vector <SurfDetector::PartModel>>> SurfDetector::getLabelModels(void)
   {
+    lock_guard <mutex> lock(labelModelsMutex);
     return labelModels;
   }
 
@@ -4,6 +4,11 @@
 // SPEL definitions
 #include "predef.hpp"
 
+// STL
+#include <list>
+#include <memory>
+#include <mutex>
+
 // OpenCV
 #include <opencv2/opencv.hpp>
 #include <opencv2/opencv_modules.hpp>
@@ -33,6 +38,23 @@ namespace SPEL
   using namespace std;
   using namespace cv;
 
+  // Keypoints of the frame inside the bounding box of its mask and their descriptors
+  struct SurfFrameFeatures
+  {
+    vector <KeyPoint> keyPoints;
+    Mat descriptors; // the row of each keypoint
+  };
+
+  class SurfDetectorHelper : public DetectorHelper
+  {
+  public:
+    SurfDetectorHelper(void);
+    virtual ~SurfDetectorHelper(void);
+    shared_ptr <const SurfFrameFeatures> features; // features of the processed frame, shared with the other calls on this frame
+    float useSURFdet = 1.0f;
+    float knnMatchCoeff = 0.8f;
+  };
+
   class SurfDetector : public Detector
   {
   protected:
@@ -48,9 +70,14 @@ namespace SPEL
     virtual int getID(void) const;
     virtual void setID(int _id);
     virtual void train(vector <Frame*> _frames, map <string, float>);
-    virtual map <uint32_t, vector <LimbLabel> > detect(Frame *frame, map <string, float> params, map <uint32_t, vector <LimbLabel>> limbLabels);
+    virtual float score(const BodyPart &bodyPart, const Frame &frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const;
+    using Detector::score;
     virtual map <uint32_t, map <uint32_t, PartModel>> getPartModels(void);
     virtual map <uint32_t, map <uint32_t, vector <PartModel>>> getLabelModels(void);
+    // Features of the frame image, detected once for each frame and "minHessian",
+    // the features of the recent frames are shared by train and detect of all the detectors
+    static shared_ptr <const SurfFrameFeatures> getFrameFeatures(const Frame *frame, uint32_t minHessian);
+    static uint32_t getFramesFeaturesCount(void);
 
   private:
 #ifdef DEBUG
@@ -61,25 +88,33 @@ namespace SPEL
     //FRIEND_TEST(surfDetectorTests, detect);
 #endif  // DEBUG
     int id;
+    struct FeaturesKey
+    {
+      int frameId;
+      Size size;
+      const uchar *imageData; // the pixels of the frame image and mask, frames with the same id may come from the different sequences
+      const uchar *maskData;
+      uint32_t minHessian;
+      Mat image, mask; // the entry holds the buffers, so their addresses can't be reused by the other frames while it is cached
+      bool operator==(const FeaturesKey &key) const;
+    };
+    static const uint32_t framesFeaturesCapacity = 16; // the keyframes of the trained slice and the detected frames
+    static list <pair <FeaturesKey, shared_ptr <const SurfFrameFeatures>>> framesFeatures; // the most recently used frame is the first
+    static mutex framesFeaturesMutex;
   protected:
     uint32_t minHessian = 500;
     float useSURFdet = 1.0f;
     float knnMatchCoeff = 0.8f;
-    vector <KeyPoint> keyPoints;
-    // Variables for score comparer
-    BodyPart *comparer_bodyPart = 0;
-    PartModel *comparer_model = 0;
-    Point2f *comparer_j0 = 0;
-    Point2f *comparer_j1 = 0;
+    mutable mutex labelModelsMutex;
 
     map <uint32_t, map <uint32_t, PartModel>> partModels;
-    map <uint32_t, map <uint32_t, vector <PartModel>>> labelModels;
+    mutable map <uint32_t, map <uint32_t, vector <PartModel>>> labelModels;
 
     virtual map <uint32_t, PartModel> computeDescriptors(Frame *frame, uint32_t minHessian);
-    virtual PartModel computeDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, Mat imgMat, uint32_t minHessian, vector <KeyPoint> keyPoints);
-    virtual LimbLabel generateLabel(BodyPart bodyPart, Frame *frame, Point2f j0, Point2f j1);
-    virtual float compare(BodyPart bodyPart, PartModel model, Point2f j0, Point2f j1);
-    virtual float compare(void);
+    virtual PartModel computeDescriptors(BodyPart bodyPart, Point2f j0, Point2f j1, const SurfFrameFeatures &features) const;
+    virtual DetectorHelper *createDetectorHelper(const Frame *frame, map <string, float> params) const;
+    virtual LimbLabel generateLabel(BodyPart bodyPart, const Frame *frame, Point2f j0, Point2f j1, DetectorHelper *detectorHelper) const;
+    virtual float compare(BodyPart bodyPart, const PartModel &model, Point2f j0, Point2f j1, float knnMatchCoeff) const;
   };
 
 }
@@ -43,6 +43,8 @@ vector<Solvlet> TLPSSolver::solve(Sequence &sequence, map<string, float> params)
     if (sequence.getFrames().size() == 0)
         return vector<Solvlet>();
 
+    ResizedFrameCache::Scope resizedFramesScope; //the detectors share the resized frames within the solve
+
     Mat image(sequence.getFrames()[0]->getImage());
     //the params vector should contain all necessary parameters, if a parameter is not present, default values should be used
     params.emplace("debugLevel", 1); //set up the lockframe accept threshold by mask coverage
@@ -695,24 +697,30 @@ float TLPSSolver::evaluateSolution(Frame* frame, vector<LimbLabel> labels, map<s
     int incorrectlyCoveredPixels = 0;
     int missedPixels = 0;
 
-    for (int i = 0; i < mask.cols; ++i) //at every col - x
+    //mark the pixels covered by the labels of the solution, the pixels on the edges are covered as in LimbLabel::containsPoint
+    Mat labelsHits(mask.rows, mask.cols, CV_8UC1, Scalar(0));
+    for (vector<LimbLabel>::iterator label = labels.begin(); label != labels.end(); ++label)
     {
-        for (int j = 0; j < mask.rows; ++j) //and every row - y
+        vector<Point2f> poly = label->getPolygon();
+        POSERECT<Point2f> rect(poly[0], poly[1], poly[2], poly[3]);
+        rect.ForEachRowSpan(Rect(0, 0, mask.cols, mask.rows), true, [&](int y, int xBegin, int xEnd)
+        {
+            uchar *hitsRow = labelsHits.ptr<uchar>(y);
+            fill(hitsRow + xBegin, hitsRow + xEnd, 1);
+        });
+    }
+
+    for (int j = 0; j < mask.rows; ++j) //at every row - y
+    {
+        const uchar *maskRow = mask.ptr<uchar>(j);
+        const uchar *hitsRow = labelsHits.ptr<uchar>(j);
+        for (int i = 0; i < mask.cols; ++i) //and every col - x
         {
-            //int test = labels[0].containsPoint(Point2f(480,100));
             //check whether pixel hit a label from solution
-            bool labelHit = false;
-            for (vector<LimbLabel>::iterator label = labels.begin(); label != labels.end(); ++label)
-            {
-                if (label->containsPoint(Point2f(i, j))) //this is done in x,y coords
-                {
-                    labelHit = true;
-                    //break;
-                }
-            }
+            bool labelHit = (hitsRow[i] != 0);
 
             //check pixel colour
-            int intensity = mask.at<uchar>(j, i); //this is done with reve
+            int intensity = maskRow[i];
             bool blackPixel = (intensity < 10);
 
             if (!blackPixel)
@@ -749,33 +757,26 @@ float TLPSSolver::evaluateSolution(Frame* frame, vector<LimbLabel> labels, map<s
     for (vector<LimbLabel>::iterator label = labels.begin(); label != labels.end(); ++label)
     {
         vector<Point2f> poly = label->getPolygon(); //get the label polygon
-        //compute min and max x and y
-        //float xMin, xMax, yMin, yMax;
-        vector<float> xS = { poly[0].x, poly[1].x, poly[2].x, poly[3].x };
-        vector<float> yS = { poly[0].y, poly[1].y, poly[2].y, poly[3].y };
-        auto xMin = min_element(xS.begin(), xS.end());
-        auto xMax = max_element(xS.begin(), xS.end());
-
-        auto yMin = min_element(yS.begin(), yS.end());
-        auto yMax = max_element(yS.begin(), yS.end());
+        POSERECT<Point2f> rect(poly[0], poly[1], poly[2], poly[3]);
+        //compute max x and y, the pixels on the max borders of the bounding box are not counted
+        float xMax = max(max(poly[0].x, poly[1].x), max(poly[2].x, poly[3].x));
+        float yMax = max(max(poly[0].y, poly[1].y), max(poly[2].y, poly[3].y));
+        Rect area(0, 0, max(0, min(mask.cols, (int)ceil(xMax))), max(0, min(mask.rows, (int)ceil(yMax))));
 
         int labelPixels = 0;
         int badLabelPixels = 0;
 
-        for (int x = *xMin; x < *xMax; ++x)
+        rect.ForEachRowSpan(area, true, [&](int y, int xBegin, int xEnd)
         {
-            for (int y = *yMin; y < *yMax; ++y)
+            const uchar *maskRow = mask.ptr<uchar>(y);
+            for (int x = xBegin; x < xEnd; ++x)
             {
-                if (label->containsPoint(Point2f(x, y)))
-                {
-                    int intensity = mask.at<uchar>(y, x); //this is done with reverse y,x
-                    bool blackPixel = (intensity < 10);
-                    labelPixels++;
-                    if (blackPixel)
-                        ++badLabelPixels;
-                }
+                bool blackPixel = (maskRow[x] < 10);
+                labelPixels++;
+                if (blackPixel)
+                    ++badLabelPixels;
             }
-        }
+        });
 
         float labelRatio = 1.0 - (float)badLabelPixels / (float)labelPixels; //high is good
 
@@ -149,23 +149,23 @@ namespace SPEL
   }
 
   //Normalization of the  histogram
-  void  Normalize(vector <vector <vector <float>>> &Histogramm, int nBins, int pixelsCount)
+  void  Normalize(vector <float> &Histogramm, int nBins, int pixelsCount)
   {
     for (int r = 0; r < nBins; r++)
       for (int g = 0; g < nBins; g++)
         for (int b = 0; b < nBins; b++)
-          Histogramm[b][g][r] = Histogramm[b][g][r] / pixelsCount;
+          Histogramm[(b * nBins + g) * nBins + r] = Histogramm[(b * nBins + g) * nBins + r] / pixelsCount;
   }
 
   //Output histogram into text file
-  void PutHistogram(ofstream &fout, vector <vector <vector <float>>> &Histogramm, int sizeFG)
+  void PutHistogram(ofstream &fout, vector <float> &Histogramm, int sizeFG)
   {
     int nBins = 8;
     for (int r = 0; r < nBins; r++)
       for (int g = 0; g < nBins; g++)
         for (int b = 0; b < nBins; b++)
-          if (Histogramm[b][g][r]>0)
-            fout << "Histogram[" << r << "," << g << "," << b << "] = " << Histogramm[b][g][r] * sizeFG << ";\n";
+          if (Histogramm[(b * nBins + g) * nBins + r]>0)
+            fout << "Histogram[" << r << "," << g << "," << b << "] = " << Histogramm[(b * nBins + g) * nBins + r] * sizeFG << ";\n";
   }
 
   //Loading frames from project
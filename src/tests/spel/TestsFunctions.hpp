@@ -18,8 +18,8 @@ namespace SPEL
   bool IsCrossed(POSERECT<Point2f> rect1, POSERECT<Point2f> rect2); // Returns "true" if "rect1" is crossed (occluded) by "rect2"
   vector<vector<pair<int, int>>> CrossingsList(map<int, POSERECT<Point2f>> Rects, map<int, int> depth); // For the each polygon select all polygons, which crossed it 
   vector <Point3i> GetPartColors(Mat image, Mat mask, POSERECT < Point2f > rect); // Build set of the rect pixels colours 
-  void  Normalize(vector <vector <vector <float>>> &Histogramm, int nBins, int pixelsCount); // Normalization of the  histogram
-  void PutHistogram(ofstream &fout, vector <vector <vector <float>>> &Histogramm, int sizeFG); // Output histogram into text file
+  void  Normalize(vector <float> &Histogramm, int nBins, int pixelsCount); // Normalization of the  histogram
+  void PutHistogram(ofstream &fout, vector <float> &Histogramm, int sizeFG); // Output histogram into text file
   vector<Frame*> LoadTestProject(string FilePath, string FileName); // Loading frames from project
   map <string, float> SetParams(vector<Frame*> frames, Sequence **seq); // Set parameters from the frames sequence 
   int keyFramesCount(vector<Frame*> frames); // Counting of keyframes in set of frames 
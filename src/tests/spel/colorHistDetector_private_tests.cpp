@@ -58,10 +58,14 @@ namespace SPEL
     uint8_t _nBins = 10;
     const int maxIndex = _nBins - 1;
     SPEL::ColorHistDetector::PartModel x0(_nBins);
-    EXPECT_EQ(0.0f, x0.partHistogram[maxIndex][maxIndex][maxIndex]);
-    EXPECT_EQ(x0.nBins, x0.partHistogram[maxIndex][maxIndex].size());
-    EXPECT_EQ(0.0f, x0.bgHistogram[maxIndex][maxIndex][maxIndex]);
-    EXPECT_EQ(x0.nBins, x0.bgHistogram[maxIndex][maxIndex].size());
+    EXPECT_EQ(0.0f, x0.partHistogram[x0.getBinIndex(maxIndex, maxIndex, maxIndex)]);
+    EXPECT_EQ(x0.nBins * x0.nBins * x0.nBins, x0.partHistogram.size());
+    EXPECT_EQ(0.0f, x0.bgHistogram[x0.getBinIndex(maxIndex, maxIndex, maxIndex)]);
+    EXPECT_EQ(x0.nBins * x0.nBins * x0.nBins, x0.bgHistogram.size());
+    // The bins are stored contiguously in [r][g][b] order
+    EXPECT_EQ(static_cast <size_t> (maxIndex), x0.getBinIndex(0, 0, maxIndex));
+    EXPECT_EQ(static_cast <size_t> (x0.nBins), x0.getBinIndex(0, 1, 0));
+    EXPECT_EQ(static_cast <size_t> (x0.nBins * x0.nBins), x0.getBinIndex(1, 0, 0));
 
     //Testing "ColorHistDetector" constructor with parameter "_nBins"
     ColorHistDetector chd1(_nBins);
@@ -77,8 +81,8 @@ namespace SPEL
     uint8_t t = i / _factor;
     ColorHistDetector chd2(nBins);
     ColorHistDetector::PartModel z(nBins);
-    z.partHistogram[t][t][t] = 3.14f;
-    EXPECT_EQ(z.partHistogram[t][t][t], chd2.computePixelBelongingLikelihood(z, i, i, i));
+    z.partHistogram[z.getBinIndex(t, t, t)] = 3.14f;
+    EXPECT_EQ(z.partHistogram[z.getBinIndex(t, t, t)], chd2.computePixelBelongingLikelihood(z, i, i, i));
     EXPECT_EQ(0.f, chd2.computePixelBelongingLikelihood(z, outside, outside, outside));
   }
 
@@ -106,6 +110,82 @@ namespace SPEL
     EXPECT_EQ(x.fgBlankSizes, y.fgBlankSizes);
   }
 
+  TEST(colorHistDetectorTest, buildPartsOwnership)
+  {
+    ColorHistDetector chd(8);
+    Size size(60, 40);
+    vector <pair <int32_t, POSERECT <Point2f>>> polygons;
+    polygons.push_back(pair <int32_t, POSERECT <Point2f>>(3, POSERECT <Point2f>(Point2f(5.5f, 5.5f), Point2f(5.5f, 30.5f), Point2f(40.5f, 30.5f), Point2f(40.5f, 5.5f))));
+    polygons.push_back(pair <int32_t, POSERECT <Point2f>>(1, POSERECT <Point2f>(Point2f(30.0f, -10.0f), Point2f(10.0f, 20.0f), Point2f(40.0f, 45.0f), Point2f(70.0f, 15.0f))));
+    polygons.push_back(pair <int32_t, POSERECT <Point2f>>(7, POSERECT <Point2f>(Point2f(20.0f, 10.0f), Point2f(20.0f, 20.0f), Point2f(50.0f, 20.0f), Point2f(50.0f, 10.0f))));
+    vector <float> polyDepth = { 1.0f, 0.0f, 0.0f };
+
+    Mat actual = chd.buildPartsOwnership(polygons, polyDepth, size);
+    ASSERT_EQ(size, actual.size());
+    ASSERT_EQ(CV_32SC1, actual.type());
+    // Per-pixel search of the owner
+    for (int y = 0; y < size.height; y++)
+      for (int x = 0; x < size.width; x++)
+      {
+        int32_t expected = -1;
+        float depth = 0;
+        for (size_t p = 0; p < polygons.size(); p++)
+          if (polygons[p].second.containsPoint(Point2f((float)x, (float)y)) > 0 && (expected == -1 || polyDepth[p] < depth))
+          {
+            expected = polygons[p].first;
+            depth = polyDepth[p];
+          }
+        EXPECT_EQ(expected, actual.at<int32_t>(y, x)) << "[" << y << "][" << x << "]";
+      }
+    // The lower polygon takes the pixel, the first polygon keeps it at the same depth
+    EXPECT_EQ(1, actual.at<int32_t>(15, 25));
+    EXPECT_EQ(1, actual.at<int32_t>(15, 45));
+    EXPECT_EQ(3, actual.at<int32_t>(28, 8));
+
+    polyDepth.pop_back();
+    EXPECT_THROW(chd.buildPartsOwnership(polygons, polyDepth, size), logic_error);
+  }
+
+  TEST(colorHistDetectorTest, addHistogramBins)
+  {
+    const uint8_t nBins = 8;
+    const int factor = static_cast <int> (ceil(pow(2, 8) / nBins));
+    ColorHistDetector chd(nBins);
+    ColorHistDetector::PartModel expected(nBins), actual(nBins);
+    for (int sample = 0; sample < 2; sample++)
+    {
+      vector <Point3i> colors;
+      vector <uint32_t> bins(expected.partHistogram.size(), 0);
+      for (int i = 0; i < 300 + 100 * sample; i++)
+      {
+        Point3i color((i * 7 + sample) % 256, (i * 13) % 256, (i * 29 + 5 * sample) % 256);
+        colors.push_back(color);
+        bins[expected.getBinIndex(color.x / factor, color.y / factor, color.z / factor)]++;
+      }
+      chd.addPartHistogram(expected, colors, 10 + sample);
+      chd.addPartHistogram(actual, bins, static_cast <uint32_t> (colors.size()), 10 + sample);
+      chd.addBackgroundHistogram(expected, colors);
+      chd.addBackgroundHistogram(actual, bins, static_cast <uint32_t> (colors.size()));
+    }
+    for (size_t i = 0; i < expected.partHistogram.size(); i++)
+    {
+      EXPECT_FLOAT_EQ(expected.partHistogram[i], actual.partHistogram[i]) << i;
+      EXPECT_FLOAT_EQ(expected.bgHistogram[i], actual.bgHistogram[i]) << i;
+    }
+    EXPECT_EQ(expected.sizeFG, actual.sizeFG);
+    EXPECT_EQ(expected.sizeBG, actual.sizeBG);
+    EXPECT_EQ(expected.fgNumSamples, actual.fgNumSamples);
+    EXPECT_EQ(expected.bgNumSamples, actual.bgNumSamples);
+    EXPECT_EQ(expected.fgSampleSizes, actual.fgSampleSizes);
+    EXPECT_EQ(expected.bgSampleSizes, actual.bgSampleSizes);
+    EXPECT_EQ(expected.fgBlankSizes, actual.fgBlankSizes);
+
+    // Empty sample is not added
+    chd.addPartHistogram(actual, vector <uint32_t>(actual.partHistogram.size(), 0), 0, 5);
+    EXPECT_EQ(expected.fgBlankSizes, actual.fgBlankSizes);
+    EXPECT_THROW(chd.addBackgroundHistogram(actual, vector <uint32_t>(3, 1), 3), logic_error);
+  }
+
   TEST(colorHistDetectorTest, setPartHistogram)
   {
     //Load the input data
@@ -140,11 +220,11 @@ namespace SPEL
     partModel_expected.fgNumSamples = 1;
     partModel_expected.fgSampleSizes.push_back(static_cast <uint32_t> (Colors.size()));
     for (uint32_t i = 0; i < Colors.size(); i++)
-      partModel_expected.partHistogram[Colors[i].x / Factor][Colors[i].y / Factor][Colors[i].z / Factor]++;
+      partModel_expected.partHistogram[partModel_expected.getBinIndex(Colors[i].x / Factor, Colors[i].y / Factor, Colors[i].z / Factor)]++;
     for (uint8_t r = 0; r < partModel_expected.nBins; r++)
       for (uint8_t g = 0; g < partModel_expected.nBins; g++)
         for (uint8_t b = 0; b < partModel_expected.nBins; b++)
-          partModel_expected.partHistogram[r][g][b] /= Colors.size();
+          partModel_expected.partHistogram[partModel_expected.getBinIndex(r, g, b)] /= Colors.size();
 
     //Create actual value
     detector.train(vFrames, params);
@@ -169,16 +249,16 @@ namespace SPEL
     for (uint8_t r = 0; r < partModel_expected.nBins; r++)
       for (uint8_t g = 0; g < partModel_expected.nBins; g++)
         for (uint8_t b = 0; b < partModel_expected.nBins; b++)
-          partModel_expected.partHistogram[r][g][b] *= partModel_expected.sizeFG;
+          partModel_expected.partHistogram[partModel_expected.getBinIndex(r, g, b)] *= partModel_expected.sizeFG;
     partModel_expected.sizeFG += static_cast <uint32_t> (Colors.size());
     partModel_expected.fgNumSamples++;
     partModel_expected.fgSampleSizes.push_back(Colors.size());
     for (uint32_t i = 0; i < Colors.size(); i++)
-      partModel_expected.partHistogram[Colors[i].x / Factor][Colors[i].y / Factor][Colors[i].z / Factor]++;
+      partModel_expected.partHistogram[partModel_expected.getBinIndex(Colors[i].x / Factor, Colors[i].y / Factor, Colors[i].z / Factor)]++;
     for (uint8_t r = 0; r < partModel_expected.nBins; r++)
       for (uint8_t g = 0; g < partModel_expected.nBins; g++)
         for (uint8_t b = 0; b < partModel_expected.nBins; b++)
-          partModel_expected.partHistogram[r][g][b] /= partModel_expected.sizeFG;
+          partModel_expected.partHistogram[partModel_expected.getBinIndex(r, g, b)] /= partModel_expected.sizeFG;
     partModel_expected.fgBlankSizes.push_back(nBlankPixels);
 
     //Create actual value
@@ -222,7 +302,7 @@ namespace SPEL
     for (uint8_t r = 0; r < partModel_expected.nBins; r++)
       for (uint8_t g = 0; g < partModel_expected.nBins; g++)
         for (uint8_t b = 0; b < partModel_expected.nBins; b++)
-          distance += pow(partModel_expected.partHistogram[r][g][b] - partModel_expected.partHistogram[r][g][b], 2.0f);
+          distance += pow(partModel_expected.partHistogram[partModel_expected.getBinIndex(r, g, b)] - partModel_expected.partHistogram[partModel_expected.getBinIndex(r, g, b)], 2.0f);
     float f = detector.matchPartHistogramsED(partModel_expected, partModel_expected);
     EXPECT_EQ(sqrt(distance), f);
   }
@@ -234,16 +314,16 @@ namespace SPEL
     for (uint8_t r = 0; r < partModel_expected.nBins; r++)
       for (uint8_t g = 0; g < partModel_expected.nBins; g++)
         for (uint8_t b = 0; b < partModel_expected.nBins; b++)
-          partModel_expected.bgHistogram[r][g][b] *= partModel_expected.sizeBG;
+          partModel_expected.bgHistogram[partModel_expected.getBinIndex(r, g, b)] *= partModel_expected.sizeBG;
     partModel_expected.sizeBG += static_cast <uint32_t> (Colors.size());
     partModel_expected.bgNumSamples++;
     partModel_expected.bgSampleSizes.push_back(static_cast <uint32_t> (Colors.size()));
     for (uint32_t i = 0; i < Colors.size(); i++)
-      partModel_expected.bgHistogram[Colors[i].x / Factor][Colors[i].y / Factor][Colors[i].z / Factor]++;
+      partModel_expected.bgHistogram[partModel_expected.getBinIndex(Colors[i].x / Factor, Colors[i].y / Factor, Colors[i].z / Factor)]++;
     for (uint8_t r = 0; r < partModel_expected.nBins; r++)
       for (uint8_t g = 0; g < partModel_expected.nBins; g++)
         for (uint8_t b = 0; b < partModel_expected.nBins; b++)
-          partModel_expected.bgHistogram[r][g][b] /= (float)partModel_expected.sizeBG;
+          partModel_expected.bgHistogram[partModel_expected.getBinIndex(r, g, b)] /= (float)partModel_expected.sizeBG;
 
     detector.addBackgroundHistogram(partModel_actual, cEmpty);
     EXPECT_NE(partModel_expected.bgHistogram, partModel_actual.bgHistogram);
@@ -273,7 +353,7 @@ namespace SPEL
         uint8_t mintensity = mask.at<uint8_t>(y, x);
         bool blackPixel = mintensity < 10;
 
-        t.at<float>(y, x) = blackPixel ? 0 : partModel.partHistogram.at(red / Factor).at(green / Factor).at(blue / Factor); // (x, y)  or (y, x) !? ?
+        t.at<float>(y, x) = blackPixel ? 0 : partModel.partHistogram.at(partModel.getBinIndex(red / Factor, green / Factor, blue / Factor)); // (x, y)  or (y, x) !? ?
         //Matrix "PixelDistributions" - transposed relative to the matrix "Image"
       }
 
@@ -281,9 +361,70 @@ namespace SPEL
     for (int x = 0; x < t.cols; x++)
       for (int y = 0; y < t.rows; y++)
         EXPECT_EQ(t.at<float>(y, x), pixelDistributions[partID].at<float>(y, x));
+  }
+
+  TEST(colorHistDetectorTest, buildPixelDistributionsThreads)
+  {
+    vector <int32_t> partIDs = { partID, 0 };
+    auto likelihoodTable = detector.buildLikelihoodTable(partIDs);
+    ASSERT_EQ(2 * detector.partModels[partID].partHistogram.size(), likelihoodTable.size());
+    for (size_t bin = 0; bin < detector.partModels[partID].partHistogram.size(); bin++)
+    {
+      EXPECT_EQ(detector.partModels[partID].partHistogram[bin], likelihoodTable[2 * bin]);
+      EXPECT_EQ(detector.partModels[0].partHistogram[bin], likelihoodTable[2 * bin + 1]);
+    }
+    EXPECT_THROW(detector.buildLikelihoodTable(vector <int32_t>(1, -1)), logic_error);
 
-    // we need to save pixelDistibutions in private class member
-    detector.pixelDistributions = pixelDistributions;
+    // The bands of the rows give the same maps
+    auto expected = detector.buildPixelDistributions(vFrames[FirstKeyframe]);
+    for (uint32_t threadsCount = 2; threadsCount <= 5; threadsCount += 3)
+    {
+      auto actual = detector.buildPixelDistributions(vFrames[FirstKeyframe], threadsCount);
+      ASSERT_EQ(expected.size(), actual.size());
+      for (auto &&p : expected)
+        EXPECT_EQ(0, norm(p.second, actual.at(p.first), NORM_INF)) << "part: " << p.first << ", threads: " << threadsCount;
+    }
+  }
+
+  TEST(colorHistDetectorTest, update)
+  {
+    vector <Frame*> markedFrames;
+    for (auto f : vFrames)
+      if (f->getFrametype() == KEYFRAME || f->getFrametype() == LOCKFRAME)
+        markedFrames.push_back(f);
+    ASSERT_FALSE(markedFrames.empty());
+    vector <Frame*> first = { markedFrames.front() }, second = { markedFrames.back() };
+    map <string, float> params;
+    params.emplace("maxFrameHeight", markedFrames.front()->getFrameSize().height);
+
+    ColorHistDetector expected, actual;
+    expected.train({ markedFrames.front(), markedFrames.back() }, params);
+    actual.train(first, params);
+    actual.update(second, params);
+
+    EXPECT_EQ(2, actual.getFrames().size());
+    ASSERT_EQ(expected.partModels.size(), actual.partModels.size());
+    for (auto &&e : expected.partModels)
+    {
+      const auto &a = actual.partModels.at(e.first);
+      EXPECT_EQ(e.second.sizeFG, a.sizeFG);
+      EXPECT_EQ(e.second.sizeBG, a.sizeBG);
+      EXPECT_EQ(e.second.fgNumSamples, a.fgNumSamples);
+      EXPECT_EQ(e.second.bgNumSamples, a.bgNumSamples);
+      EXPECT_EQ(e.second.fgSampleSizes, a.fgSampleSizes);
+      EXPECT_EQ(e.second.bgSampleSizes, a.bgSampleSizes);
+      EXPECT_EQ(e.second.fgBlankSizes, a.fgBlankSizes);
+      for (size_t i = 0; i < e.second.partHistogram.size(); i++)
+      {
+        EXPECT_FLOAT_EQ(e.second.partHistogram[i], a.partHistogram[i]) << "part: " << e.first << ", bin: " << i;
+        EXPECT_FLOAT_EQ(e.second.bgHistogram[i], a.bgHistogram[i]) << "part: " << e.first << ", bin: " << i;
+      }
+    }
+
+    // The untrained detector is trained by the update
+    ColorHistDetector untrained;
+    untrained.update(first, params);
+    EXPECT_EQ(expected.partModels.size(), untrained.partModels.size());
   }
 
   // Testing function "BuildPixelLabels"
@@ -317,9 +458,6 @@ namespace SPEL
     for (int x = 0; x < p.cols; x++)
       for (int y = 0; y < p.rows; y++)
         EXPECT_EQ(p.at<float>(y, x), pixelLabels[partID].at<float>(y, x)) << q++ << ": " << x << ", " << y;
-
-    // we need to save pixelLabels in private class member
-    detector.pixelLabels = pixelLabels;
   }
   
   // Testing function generateLabel
@@ -376,7 +514,11 @@ namespace SPEL
       limbLabel_e = LimbLabel(partID, boxCenter, rot, rect.asVector(), s);
     }
 
-    LimbLabel limbLabel_a = detector.generateLabel(*skeleton.getBodyPart(partID), vFrames[0], p0, p1);
+    ColorHistDetectorHelper detectorHelper;
+    detectorHelper.pixelDistributions = pixelDistributions;
+    detectorHelper.pixelLabels = pixelLabels;
+    LimbLabel limbLabel_a = detector.generateLabel(*skeleton.getBodyPart(partID), vFrames[0], p0, p1, &detectorHelper);
+    EXPECT_EQ(limbLabel_a.getScores().at(0).getScore(), detector.score(*skeleton.getBodyPart(partID), *vFrames[0], p0, p1, &detectorHelper));
 
     EXPECT_EQ(limbLabel_e.getLimbID(), limbLabel_a.getLimbID());
     EXPECT_EQ(limbLabel_e.getCenter(), limbLabel_a.getCenter());
@@ -415,6 +557,121 @@ namespace SPEL
     EXPECT_EQ(model.bgHistogram, detector.partModels[partID].bgHistogram);
   }
 
+  // Testing function "compare" with the row integrals
+  TEST(colorHistDetectorTest, compareIntegrals)
+  {
+    ColorHistDetectorHelper detectorHelper;
+    detectorHelper.pixelDistributions = pixelDistributions;
+    detectorHelper.pixelLabels = pixelLabels;
+    detector.buildIntegrals(vFrames[FirstKeyframe], pixelLabels, detectorHelper.maskIntegral, detectorHelper.pixelLabelsIntegrals);
+    ASSERT_EQ(pixelLabels.size(), detectorHelper.pixelLabelsIntegrals.size());
+
+    Point2f p0 = j0->getImageLocation(), p1 = j1->getImageLocation();
+    Point2f center = 0.5 * (p0 + p1);
+    BodyPart testPart = *skeleton.getBodyPart(partID);
+    int comparedCount = 0;
+    for (float angle = 0; angle < 360; angle += 15)
+    {
+      Point2f a = spelHelper::rotatePoint2D(p0, center, angle);
+      Point2f b = spelHelper::rotatePoint2D(p1, center, angle);
+      float expected = 0;
+      try
+      {
+        expected = detector.compare(testPart, vFrames[FirstKeyframe], pixelDistributions, pixelLabels, a, b);
+      }
+      catch (logic_error)
+      {
+        continue;
+      }
+      float actual = detector.compare(testPart, vFrames[FirstKeyframe], detectorHelper, a, b);
+      EXPECT_NEAR(expected, actual, 0.005) << "angle: " << angle;
+      comparedCount++;
+    }
+    EXPECT_GT(comparedCount, 0);
+  }
+
+  TEST(colorHistDetectorTest, compactPixelMaps)
+  {
+    Frame *frame = vFrames[FirstKeyframe];
+    map <string, float> params;
+    unique_ptr <ColorHistDetectorHelper> floatHelper(dynamic_cast <ColorHistDetectorHelper*> (detector.createDetectorHelper(frame, params)));
+    params["compactPixelMaps"] = 1.0f;
+    params["detectThreads"] = 3.0f;
+    unique_ptr <ColorHistDetectorHelper> compactHelper(dynamic_cast <ColorHistDetectorHelper*> (detector.createDetectorHelper(frame, params)));
+    ASSERT_NE(nullptr, floatHelper.get());
+    ASSERT_NE(nullptr, compactHelper.get());
+
+    // Every value is rounded to the nearest fraction
+    ASSERT_EQ(floatHelper->pixelLabels.size(), compactHelper->pixelLabels.size());
+    const float valueTolerance = 0.5f / ColorHistDetector::compactMapScale + 1e-7f;
+    for (auto &&p : floatHelper->pixelLabels)
+    {
+      const Mat &compactLabels = compactHelper->pixelLabels.at(p.first);
+      const Mat &compactDistributions = compactHelper->pixelDistributions.at(p.first);
+      ASSERT_EQ(CV_16UC1, compactLabels.type());
+      ASSERT_EQ(CV_16UC1, compactDistributions.type());
+      EXPECT_EQ(CV_32SC1, compactHelper->pixelLabelsIntegrals.at(p.first).type());
+      for (int y = 0; y < p.second.rows; y++)
+        for (int x = 0; x < p.second.cols; x++)
+        {
+          EXPECT_NEAR(p.second.at<float>(y, x), ColorHistDetector::getPixelMapValue(compactLabels, y, x), valueTolerance);
+          EXPECT_NEAR(floatHelper->pixelDistributions.at(p.first).at<float>(y, x), ColorHistDetector::getPixelMapValue(compactDistributions, y, x), valueTolerance);
+        }
+    }
+
+    // The scores stay within the documented tolerance
+    Point2f p0 = j0->getImageLocation(), p1 = j1->getImageLocation();
+    Point2f center = 0.5 * (p0 + p1);
+    BodyPart testPart = *skeleton.getBodyPart(partID);
+    int comparedCount = 0;
+    for (float angle = 0; angle < 360; angle += 15)
+    {
+      Point2f a = spelHelper::rotatePoint2D(p0, center, angle);
+      Point2f b = spelHelper::rotatePoint2D(p1, center, angle);
+      float expected = 0;
+      try
+      {
+        expected = detector.compare(testPart, frame, *floatHelper, a, b);
+      }
+      catch (logic_error)
+      {
+        continue;
+      }
+      EXPECT_NEAR(expected, detector.compare(testPart, frame, *compactHelper, a, b), 2e-5) << "angle: " << angle;
+      // The per-pixel scan reads the compact maps as well
+      expected = detector.compare(testPart, frame, floatHelper->pixelDistributions, floatHelper->pixelLabels, a, b);
+      EXPECT_NEAR(expected, detector.compare(testPart, frame, compactHelper->pixelDistributions, compactHelper->pixelLabels, a, b), 2e-5) << "angle: " << angle;
+      comparedCount++;
+    }
+    EXPECT_GT(comparedCount, 0);
+  }
+
+  // Testing function "quantizeRow"
+  TEST(colorHistDetectorTest, quantizeRow)
+  {
+    vector <Vec3b> pixels;
+    for (int i = 0; i < 300; i++)
+      pixels.push_back(Vec3b((uint8_t)((i * 7) % 256), (uint8_t)((i * 13 + 5) % 256), (uint8_t)((i * 29 + 11) % 256)));
+    pixels.push_back(Vec3b(0, 0, 0));
+    pixels.push_back(Vec3b(255, 255, 255));
+    // The specialised kernels and the lookup table of the other bin counts
+    vector <uint8_t> binCounts = { 8, 16, 32, 5, 10, 64 };
+    for (auto nBins : binCounts)
+    {
+      ColorHistDetector chd(nBins);
+      ColorHistDetector::PartModel partModel(nBins);
+      const int factor = static_cast <int> (ceil(pow(2, 8) / nBins));
+      vector <uint32_t> bins(pixels.size());
+      chd.quantizeRow(pixels.data(), static_cast <uint32_t> (pixels.size()), bins.data());
+      for (size_t i = 0; i < pixels.size(); i++)
+      {
+        auto expected = partModel.getBinIndex(pixels[i][2] / factor, pixels[i][1] / factor, pixels[i][0] / factor);
+        EXPECT_EQ(expected, bins[i]) << "nBins: " << (int)nBins << ", pixel: " << i;
+        EXPECT_LT(bins[i], partModel.partHistogram.size());
+      }
+    }
+  }
+
   // Testing function "detect"
   TEST(colorHistDetectorTest, detect)
   {
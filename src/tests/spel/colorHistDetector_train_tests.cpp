@@ -82,7 +82,7 @@ namespace SPEL
               int c = 50 + i * 10;
               image1.at<Vec3b>(y, x) = Vec3b(c, c, c);
               Vec3b color = image.at<Vec3b>(y, x);
-              Model.partHistogram[color[0] / Factor][color[1] / Factor][color[2] / Factor]++;
+              Model.partHistogram[Model.getBinIndex(color[0] / Factor, color[1] / Factor, color[2] / Factor)]++;
               Model.sizeFG++;
             }
           }
@@ -106,8 +106,8 @@ namespace SPEL
         for (int g = 0; g < nBins; g++)
           for (int b = 0; b < nBins; b++)
           {
-            int expected = int(partModels[i].partHistogram[b][g][r]);
-            int actual = int(detector.partModels[i].partHistogram[r][g][b] * detector.partModels[i].sizeFG / KeyframesCount);
+            int expected = int(partModels[i].partHistogram[partModels[i].getBinIndex(b, g, r)]);
+            int actual = int(detector.partModels[i].partHistogram[detector.partModels[i].getBinIndex(r, g, b)] * detector.partModels[i].sizeFG / KeyframesCount);
             if (abs(expected - actual) > delta)
             {
               cout << "Part[" << i << "]." << "Histogram[" << r << ", " << g << ", " << b << "]:    Expected = " << expected << ",   Actual = " << actual << endl;
@@ -16,6 +16,7 @@ namespace SPEL
     Mat DeRotate(Mat imgSource, POSERECT <Point2f> &initialRect, float angle, Size size);
     float GetBoneLength(Point2f begin, Point2f end);
     float GetBoneWidth(float length, BodyPart bodyPart);
+    vector <LimbLabel> FilterLimbLabels(vector <LimbLabel> &sortedLabels, float uniqueLocationCandidates, float uniqueAngleCandidates);
   };
 
   Mat TestingDetector::DeRotate(Mat imgSource, POSERECT <Point2f> &initialRect, float angle, Size size)
@@ -33,6 +34,11 @@ namespace SPEL
     return  TestingDetector::getBoneWidth(length, bodyPart);
   }
 
+  vector <LimbLabel> TestingDetector::FilterLimbLabels(vector <LimbLabel> &sortedLabels, float uniqueLocationCandidates, float uniqueAngleCandidates)
+  {
+    return TestingDetector::filterLimbLabels(sortedLabels, uniqueLocationCandidates, uniqueAngleCandidates);
+  }
+
   POSERECT<Point2f> CreateRect(float x1, float x2, float y1, float y2)
   {
     Point2f a(x1, y1), b(x2, y1), c(x2, y2), d(x1, y2), E(0, 0);
@@ -413,6 +419,36 @@ namespace SPEL
     X4.release();
   }
 
+  TEST(DetectorTests, rotateImageToDefault_PerPixelReference)
+  {
+    Mat image = Mat(Size(120, 90), CV_8UC3);
+    randu(image, Scalar(0, 0, 0), Scalar(255, 255, 255));
+    TestingDetector chd;
+    Size size(31, 17);
+    for (float angle = -180.0f; angle <= 180.0f; angle += 22.5f)
+      for (float x = -10.0f; x < 130.0f; x += 17.3f)
+      {
+        POSERECT <Point2f> initialRect = CreateRect(x - 15.0f, x + 15.0f, 37.0f, 53.0f);
+        POSERECT <Point2f> rect = RotateRect(initialRect, angle);
+        Mat actual = chd.DeRotate(image, rect, angle, size);
+
+        // The per-pixel warp, nearest pixel and the black border
+        Mat expected = Mat(size, CV_8UC3, Scalar(0, 0, 0));
+        Point2f center = rect.GetCenter<Point2f>();
+        Point2f newCenter = Point2f(0.5f * size.width, 0.5f * size.height);
+        for (int i = 0; i < size.width - 1; i++)
+          for (int j = 0; j < size.height - 1; j++)
+          {
+            Point2f p = spelHelper::rotatePoint2D(Point2f((float)i, (float)j), newCenter, angle) + center - newCenter;
+            if (0 <= p.x && 0 <= p.y && p.x < image.cols - 1 && p.y < image.rows - 1)
+              expected.at<Vec3b>(j, i) = image.at<Vec3b>((int)round(p.y), (int)round(p.x));
+          }
+
+        ASSERT_EQ(expected.size(), actual.size());
+        EXPECT_EQ(0, norm(expected, actual, NORM_L1)) << "angle: " << angle << ", x: " << x;
+      }
+  }
+
   TEST(DetectorTests, getBoneLength)
   {
     const int nBins = 8;
@@ -438,6 +474,61 @@ namespace SPEL
     EXPECT_EQ(length / lwRatio, width);
   }
 
+  TEST(DetectorTests, filterLimbLabels)
+  {
+    // 4 locations x 5 angles, every candidate is scored twice, all the scores are different
+    vector <LimbLabel> labels;
+    for (int i = 0; i < 40; i++)
+    {
+      float score = (float)((i * 7) % 40) / 40.0f;
+      Point2f center((float)(i % 4), 0.0f);
+      float angle = 10.0f * ((i / 4) % 5);
+      labels.push_back(LimbLabel(0, center, angle, vector <Point2f> { center }, vector <Score> { Score(score, "", 1.0f) }));
+    }
+
+    TestingDetector detector;
+    float uniqueAngleCandidates = 0.5f;
+    vector <LimbLabel> actual = detector.FilterLimbLabels(labels, 0.1f, uniqueAngleCandidates);
+
+    // Labels are sorted by score now
+    vector <bool> expected(labels.size(), false);
+    for (int i = 0; i < (int)labels.size(); i++)
+    {
+      // The worst label of the location
+      bool isLast = true;
+      for (int j = i + 1; j < (int)labels.size(); j++)
+        if (labels[j].getCenter() == labels[i].getCenter())
+          isLast = false;
+      // The best labels of the angle
+      int rank = 0, count = 0;
+      for (int j = 0; j < (int)labels.size(); j++)
+        if (labels[j].getAngle() == labels[i].getAngle())
+        {
+          count++;
+          if (j < i)
+            rank++;
+        }
+      int numToPush = max(1, (int)(count * uniqueAngleCandidates));
+      expected[i] = isLast || rank < numToPush;
+    }
+
+    int k = 0;
+    for (int i = 0; i < (int)labels.size(); i++)
+    {
+      if (!expected[i])
+        continue;
+      ASSERT_LT(k, (int)actual.size());
+      EXPECT_EQ(labels[i].getAvgScore(), actual[k].getAvgScore());
+      EXPECT_EQ(labels[i].getAngle(), actual[k].getAngle());
+      EXPECT_EQ(labels[i].getCenter(), actual[k].getCenter());
+      k++;
+    }
+    EXPECT_EQ(k, (int)actual.size());
+
+    // Out of range parameters turn the filter off
+    EXPECT_EQ(labels.size(), detector.FilterLimbLabels(labels, 1.5f, 0.1f).size());
+  }
+
   //Output limbLabels set into text file
   void PutLimbLabels(ofstream &fout, string S, map <uint32_t, vector <LimbLabel>> X)
   {
@@ -794,4 +885,51 @@ namespace SPEL
 
   }
 
+
+  TEST(DetectorTests, merge_Unfiltered)
+  {
+    vector <Point2f> polygon0 { Point2f(0, 0), Point2f(1, 0) };
+    vector <Point2f> polygon1 { Point2f(0, 1), Point2f(1, 1) };
+    vector <Point2f> polygon2 { Point2f(0, 2), Point2f(1, 2) };
+    map <uint32_t, vector <LimbLabel>> first, second, secondUnfiltered;
+    first[0] = vector <LimbLabel> {
+      LimbLabel(0, Point2f(0, 0), 0, polygon0, vector <Score> { Score(0.1f, "a", 1) }),
+      LimbLabel(0, Point2f(0, 1), 0, polygon1, vector <Score> { Score(0.2f, "a", 1) }) };
+    // The second label of "second" repeats the first one and is dropped
+    second[0] = vector <LimbLabel> {
+      LimbLabel(0, Point2f(0, 0), 0, polygon0, vector <Score> { Score(0.4f, "b", 1) }),
+      LimbLabel(0, Point2f(0, 0), 0, polygon0, vector <Score> { Score(0.5f, "b", 1) }),
+      LimbLabel(0, Point2f(0, 2), 0, polygon2, vector <Score> { Score(0.6f, "b", 1) }) };
+    // The label filtered out from "second" keeps its unfiltered score
+    secondUnfiltered[0] = second[0];
+    secondUnfiltered[0].push_back(LimbLabel(0, Point2f(0, 1), 0, polygon1, vector <Score> { Score(0.3f, "b", 1) }));
+
+    ColorHistDetector d;
+    auto result = d.merge(first, second, secondUnfiltered);
+    ASSERT_EQ(1, result.size());
+    ASSERT_EQ(3, result[0].size());
+    map <float, float> scores; // score "a" -> score "b"
+    for (auto &label : result[0])
+    {
+      vector <Score> s = label.getScores();
+      ASSERT_EQ(2, s.size());
+      if (s[0].getDetName() == "b") // the label of "second" only
+        swap(s[0], s[1]);
+      EXPECT_EQ("a", s[0].getDetName());
+      EXPECT_EQ("b", s[1].getDetName());
+      scores[s[0].getScore()] = s[1].getScore();
+    }
+    EXPECT_FLOAT_EQ(0.4f, scores[0.1f]);
+    EXPECT_FLOAT_EQ(0.3f, scores[0.2f]);
+    EXPECT_FLOAT_EQ(0.6f, scores[1.0f]); // missing score of "a" is 1.0
+
+    // The moving overload gives the same result
+    auto moved = d.merge(map <uint32_t, vector <LimbLabel>>(first), map <uint32_t, vector <LimbLabel>>(second), secondUnfiltered);
+    ASSERT_EQ(result[0].size(), moved[0].size());
+    for (int i = 0; i < (int)result[0].size(); i++)
+    {
+      EXPECT_EQ(result[0][i].getPolygon(), moved[0][i].getPolygon());
+      EXPECT_EQ(result[0][i].getScores(), moved[0][i].getScores());
+    }
+  }
 }
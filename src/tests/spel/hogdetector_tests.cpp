@@ -9,6 +9,7 @@
 #include <gtest/gtest.h>
 #include <detector.hpp>
 #include <hogDetector.hpp>
+#include <hogDetectorAvx.hpp>
 #include "projectLoader.hpp"
 #include "limbLabel.hpp"
 #include "spelHelper.hpp"
@@ -158,6 +159,75 @@ namespace SPEL
           EXPECT_EQ(G[i][k][n], partModel.gradientStrengths[i][k][n]);
   }
 
+  TEST(HOGDetectorTests, computeDenseDescriptors)
+  {
+    // Stripes across the part, so all the gradients are along the part axis
+    Mat vertical(200, 200, CV_8UC3), horizontal(200, 200, CV_8UC3);
+    for (int y = 0; y < 200; y++)
+      for (int x = 0; x < 200; x++)
+      {
+        vertical.at<Vec3b>(y, x) = ((x / 4) % 2) ? Vec3b(200, 200, 200) : Vec3b(20, 20, 20);
+        horizontal.at<Vec3b>(y, x) = ((y / 4) % 2) ? Vec3b(200, 200, 200) : Vec3b(20, 20, 20);
+      }
+    Skeleton skeleton = HFrames[0]->getSkeleton();
+    BodyPart bodyPart = *skeleton.getBodyPart(6);
+    Size blockSize(16, 16), blockStride(8, 8), cellSize(8, 8), wndSize(64, 32);
+    const int nbins = 9;
+    double thresholdL2hys = 0.2;
+    bool gammaCorrection = true;
+    HogDetector D;
+
+    auto horizontalPart = D.computeDenseDescriptors(bodyPart, Point2f(60, 100), Point2f(140, 100), vertical, nbins, wndSize, blockSize, blockStride, cellSize, thresholdL2hys, gammaCorrection);
+    ASSERT_EQ(wndSize.height / cellSize.height, horizontalPart.gradientStrengths.size());
+    for (auto &&row : horizontalPart.gradientStrengths)
+    {
+      ASSERT_EQ(wndSize.width / cellSize.width, row.size());
+      for (auto &&cell : row)
+      {
+        ASSERT_EQ(nbins, cell.size());
+        // The horizontal gradient is split between the first and the last bins
+        EXPECT_GT(cell[0], 0.1f);
+        EXPECT_GT(cell[nbins - 1], 0.1f);
+        for (int b = 1; b < nbins - 1; b++)
+          EXPECT_NEAR(0.0f, cell[b], 1e-3f);
+      }
+    }
+
+    // The gradients are taken in the axes of the part
+    auto verticalPart = D.computeDenseDescriptors(bodyPart, Point2f(100, 60), Point2f(100, 140), horizontal, nbins, wndSize, blockSize, blockStride, cellSize, thresholdL2hys, gammaCorrection);
+    for (int i = 0; i < horizontalPart.gradientStrengths.size(); i++)
+      for (int k = 0; k < horizontalPart.gradientStrengths[i].size(); k++)
+        for (int b = 0; b < nbins; b++)
+          EXPECT_NEAR(horizontalPart.gradientStrengths[i][k][b], verticalPart.gradientStrengths[i][k][b], 0.02f) << "[" << i << "][" << k << "][" << b << "]";
+
+    // The candidates of the same angle share the gradient tile of the helper
+    HogDetectorHelper helper;
+    for (float x = 90.0f; x < 110.0f; x += 4.0f)
+    {
+      Point2f j0(x - 40.0f, 100.0f), j1(x + 40.0f, 100.0f);
+      auto expected = D.computeDenseDescriptors(bodyPart, j0, j1, vertical, nbins, wndSize, blockSize, blockStride, cellSize, thresholdL2hys, gammaCorrection);
+      auto actual = D.computeDenseDescriptors(bodyPart, j0, j1, vertical, nbins, wndSize, blockSize, blockStride, cellSize, thresholdL2hys, gammaCorrection, &helper);
+      for (int i = 0; i < expected.gradientStrengths.size(); i++)
+        for (int k = 0; k < expected.gradientStrengths[i].size(); k++)
+          for (int b = 0; b < nbins; b++)
+            EXPECT_NEAR(expected.gradientStrengths[i][k][b], actual.gradientStrengths[i][k][b], 1e-4f) << "x: " << x;
+    }
+    EXPECT_EQ(1, helper.gradientTiles.size());
+
+    // The dense models and candidates
+    HogDetector denseD;
+    map<string, float> params;
+    params.emplace("denseHog", 1.0f);
+    denseD.train(HFrames, params);
+    HFrames[1]->setSkeleton(HFrames[0]->getSkeleton());
+    map<uint32_t, vector<LimbLabel>> limbLabels;
+    map <string, float> detectParams;
+    limbLabels = denseD.detect(HFrames[1], detectParams, limbLabels);
+    EXPECT_EQ(skeleton.getPartTree().size(), limbLabels.size());
+    for (auto &&part : limbLabels)
+      EXPECT_GT(part.second.size(), 0);
+  }
+
   TEST(HOGDetectorTests, computeDescriptors)
   {
     //Counting a keyframes
@@ -372,7 +442,9 @@ namespace SPEL
     D.train(HFrames, params);
     bool useHOGDet = true;
     HogDetector::PartModel partModel = D.getPartModels()[0][partID];
-    LimbLabel label_actual = D.generateLabel(bodyPart, HFrames[FirstKeyframe], p0, p1);
+    HogDetectorHelper detectorHelper;
+    LimbLabel label_actual = D.generateLabel(bodyPart, HFrames[FirstKeyframe], p0, p1, &detectorHelper);
+    EXPECT_EQ(label_actual.getScores()[0].getScore(), D.score(bodyPart, *HFrames[FirstKeyframe], p0, p1));
 
 
     //Create expected LimbLabel value
@@ -562,6 +634,162 @@ namespace SPEL
         delete frames[i];	*/
   }
 
+  TEST(HOGDetectorTests, detectThreads)
+  {
+    // Copy skeleton from keyframe to frames[1] 
+    HFrames[1]->setSkeleton(HFrames[0]->getSkeleton());
+
+    HogDetector D;
+    map<string, float> params;
+    D.train(HFrames, params);
+
+    // Run serial "detect"
+    map<uint32_t, vector<LimbLabel>> expected_limbLabels;
+    map <string, float> detectParams;
+    detectParams.emplace("detectThreads", 1);
+    expected_limbLabels = D.detect(HFrames[1], detectParams, expected_limbLabels);
+
+    // Run parallel "detect"
+    map<uint32_t, vector<LimbLabel>> actual_limbLabels;
+    detectParams["detectThreads"] = 4;
+    actual_limbLabels = D.detect(HFrames[1], detectParams, actual_limbLabels);
+
+    // Compare
+    ASSERT_EQ(expected_limbLabels.size(), actual_limbLabels.size());
+    for (auto &&part : expected_limbLabels)
+    {
+      ASSERT_EQ(part.second.size(), actual_limbLabels[part.first].size());
+      for (int i = 0; i < part.second.size(); i++)
+      {
+        EXPECT_EQ(part.second[i].getPolygon(), actual_limbLabels[part.first][i].getPolygon());
+        EXPECT_EQ(part.second[i].getAngle(), actual_limbLabels[part.first][i].getAngle());
+        EXPECT_EQ(part.second[i].getAvgScore(), actual_limbLabels[part.first][i].getAvgScore());
+      }
+    }
+  }
+
+  TEST(HOGDetectorTests, detectPyramid)
+  {
+    // Copy skeleton from keyframe to frames[1] 
+    HFrames[1]->setSkeleton(HFrames[0]->getSkeleton());
+
+    HogDetector D;
+    map<string, float> params;
+    D.train(HFrames, params);
+
+    // Every scored candidate is saved in "labelModels"
+    auto countCandidates = [&]()
+    {
+      uint32_t count = 0;
+      for (auto &&part : D.labelModels[HFrames[1]->getID()])
+        count += part.second.size();
+      return count;
+    };
+
+    // Run full grid "detect"
+    map<uint32_t, vector<LimbLabel>> expected_limbLabels;
+    map <string, float> detectParams;
+    detectParams.emplace("searchDistCoeff", 2.0f);
+    expected_limbLabels = D.detect(HFrames[1], detectParams, expected_limbLabels);
+    auto expected_count = countCandidates();
+
+    // Run coarse-to-fine "detect"
+    D.labelModels.clear();
+    map<uint32_t, vector<LimbLabel>> actual_limbLabels;
+    detectParams.emplace("pyramidLevels", 3);
+    detectParams.emplace("pyramidTopK", 3);
+    actual_limbLabels = D.detect(HFrames[1], detectParams, actual_limbLabels);
+    auto actual_count = countCandidates();
+
+    // Compare
+    EXPECT_LT(actual_count, expected_count);
+    ASSERT_EQ(expected_limbLabels.size(), actual_limbLabels.size());
+    for (auto &&part : expected_limbLabels)
+      EXPECT_GT(actual_limbLabels[part.first].size(), 0);
+  }
+
+  TEST(HOGDetectorTests, labelModelsRetention)
+  {
+    // Copy skeleton from keyframe to frames[1] 
+    HFrames[1]->setSkeleton(HFrames[0]->getSkeleton());
+
+    // All the scored candidates
+    HogDetector D;
+    map<string, float> params;
+    params.emplace("labelModelsRetention", -1.0f);
+    D.train(HFrames, params);
+    map<uint32_t, vector<LimbLabel>> limbLabels;
+    limbLabels = D.detect(HFrames[1], map<string, float>(), limbLabels);
+    auto allModels = D.getLabelModels()[HFrames[1]->getID()];
+    ASSERT_GT(allModels.size(), 0);
+
+    // The best candidates of each part
+    const int32_t K = 3;
+    params["labelModelsRetention"] = static_cast<float>(K);
+    D.train(HFrames, params);
+    limbLabels.clear();
+    limbLabels = D.detect(HFrames[1], map<string, float>(), limbLabels);
+    auto bestModels = D.getLabelModels()[HFrames[1]->getID()];
+    ASSERT_EQ(allModels.size(), bestModels.size());
+    for (auto &&part : allModels)
+    {
+      auto &scores = D.labelModelsScores[HFrames[1]->getID()][part.first];
+      EXPECT_EQ(min<size_t>(K, part.second.size()), bestModels[part.first].size());
+      EXPECT_EQ(scores.size(), bestModels[part.first].size());
+      EXPECT_TRUE(is_sorted(scores.begin(), scores.end()));
+      // The best detected label is among the retained candidates
+      vector<float> labelScores;
+      for (auto &&label : limbLabels[part.first])
+      {
+        auto score = label.getScores().front().getScore();
+        labelScores.push_back(score < 0 ? numeric_limits<float>::max() : score);
+      }
+      sort(labelScores.begin(), labelScores.end());
+      if (!scores.empty() && !labelScores.empty())
+        EXPECT_LE(scores.front(), labelScores.front());
+    }
+
+    // Nothing is kept
+    params["labelModelsRetention"] = 0.0f;
+    D.train(HFrames, params);
+    limbLabels.clear();
+    limbLabels = D.detect(HFrames[1], map<string, float>(), limbLabels);
+    EXPECT_EQ(0, D.getLabelModels().size());
+  }
+
+  TEST(HOGDetectorTests, detectPartLabelsLimit)
+  {
+    // Copy skeleton from keyframe to frames[1] 
+    HFrames[1]->setSkeleton(HFrames[0]->getSkeleton());
+
+    HogDetector D;
+    map<string, float> params;
+    D.train(HFrames, params);
+
+    // Run "detect" with all the candidates
+    map<uint32_t, vector<LimbLabel>> expected_limbLabels;
+    map <string, float> detectParams;
+    detectParams.emplace("searchDistCoeff", 2.0f);
+    expected_limbLabels = D.detect(HFrames[1], detectParams, expected_limbLabels);
+
+    // Run "detect" with the bounded candidates collection
+    const uint32_t limit = 5;
+    map<uint32_t, vector<LimbLabel>> actual_limbLabels;
+    detectParams.emplace("partLabelsLimit", limit);
+    actual_limbLabels = D.detect(HFrames[1], detectParams, actual_limbLabels);
+
+    // Compare: the best label of every part is kept
+    ASSERT_EQ(expected_limbLabels.size(), actual_limbLabels.size());
+    for (auto &&part : expected_limbLabels)
+    {
+      auto &actual = actual_limbLabels[part.first];
+      ASSERT_GT(actual.size(), 0);
+      EXPECT_LE(actual.size(), limit);
+      EXPECT_EQ(part.second.front().getAvgScore(), actual.front().getAvgScore());
+      EXPECT_EQ(part.second.front().getPolygon(), actual.front().getPolygon());
+    }
+  }
+
   TEST(HOGDetectorTests, compare)
   {
     int DescriptorLength = 3780;
@@ -610,6 +838,172 @@ namespace SPEL
     EXPECT_EQ(x, score);
   }
 
+  TEST(HOGDetectorTests, buildPartTemplates)
+  {
+    HogDetector D;
+    map<string, float> params;
+    D.train(HFrames, params);
+    ASSERT_GT(D.partTemplates.size(), 0);
+
+    Skeleton skeleton = HFrames[0]->getSkeleton();
+    for (auto &&templates : D.partTemplates)
+    {
+      auto partID = templates.first;
+      // The models of all the trained frames, one after another
+      uint32_t count = 0;
+      for (auto &&framePartModels : D.partModels)
+      {
+        auto partModel = framePartModels.second.find(partID);
+        if (partModel == framePartModels.second.end())
+          continue;
+        vector<float> expected;
+        for (auto &&row : partModel->second.gradientStrengths)
+          for (auto &&cell : row)
+            expected.insert(expected.end(), cell.begin(), cell.begin() + D.nbins);
+        ASSERT_EQ(templates.second.rows * templates.second.cols * D.nbins, expected.size());
+        for (uint32_t i = 0; i < expected.size(); i++)
+          EXPECT_EQ(expected[i], templates.second.strengths[count * expected.size() + i]) << "part: " << partID << ", model: " << count;
+        count++;
+      }
+      EXPECT_EQ(count, templates.second.count);
+
+      // The trained templates give the same score as the models flattened for the single comparison
+      BodyPart *bodyPart = skeleton.getBodyPart(partID);
+      if (bodyPart == 0)
+        continue;
+      auto model = D.partModels.begin()->second.find(partID);
+      if (model == D.partModels.begin()->second.end())
+        continue;
+      auto candidate = model->second;
+      candidate.gradientStrengths[0][0][0] += 1.0f;
+      auto expected = D.compare(*bodyPart, candidate, D.nbins);
+      HogDetector untrained;
+      untrained.partModels = D.partModels;
+      EXPECT_EQ(expected, untrained.compare(*bodyPart, candidate, D.nbins));
+    }
+  }
+
+  TEST(HOGDetectorTests, sumAbsDifferences)
+  {
+    // The length isn't a multiple of the vector width, so the tail of the template is summed too
+    const uint32_t length = 9 * 13;
+    const uint32_t count = 3;
+    RNG rng(5);
+    vector<float> candidate(length), templates(length * count), weights = { 1.0f, 2.0f, 0.5f };
+    rng.fill(candidate, RNG::UNIFORM, 0.0f, 1.0f);
+    rng.fill(templates, RNG::UNIFORM, 0.0f, 1.0f);
+
+    double expected = 0, expectedWeighted = 0;
+    for (uint32_t t = 0; t < count; t++)
+    {
+      double templateSum = 0;
+      for (uint32_t i = 0; i < length; i++)
+        templateSum += abs(candidate[i] - templates[t * length + i]);
+      expected += templateSum;
+      expectedWeighted += weights[t] * templateSum;
+    }
+
+    EXPECT_NEAR(expected, HogDetector::sumAbsDifferencesScalar(candidate.data(), templates.data(), length, count), 1e-3);
+    EXPECT_NEAR(expectedWeighted, HogDetector::sumAbsDifferencesScalar(candidate.data(), templates.data(), length, count, weights.data()), 1e-3);
+#ifdef SPEL_AVX
+    if (HogDetector::isAvxSupported())
+    {
+      EXPECT_NEAR(expected, sumAbsDifferencesAvx(candidate.data(), templates.data(), length, count), 1e-3);
+      EXPECT_NEAR(expectedWeighted, sumAbsDifferencesAvx(candidate.data(), templates.data(), length, count, weights.data()), 1e-3);
+      EXPECT_EQ(sumAbsDifferencesAvx(candidate.data(), templates.data(), length, count), HogDetector::sumAbsDifferences(candidate.data(), templates.data(), length, count));
+      return;
+    }
+#endif  // SPEL_AVX
+    EXPECT_EQ(HogDetector::sumAbsDifferencesScalar(candidate.data(), templates.data(), length, count), HogDetector::sumAbsDifferences(candidate.data(), templates.data(), length, count));
+  }
+
+  TEST(HOGDetectorTests, compressPartTemplates)
+  {
+    // Three groups of the equal models: 3 x A, 2 x B, 1 x C
+    const int rows = 2, cols = 3;
+    const int nbins = 9;
+    vector<float> groups = { 0.0f, 0.5f, 1.0f };
+    vector<int> modelGroups = { 0, 1, 0, 2, 1, 0 };
+    HogDetector D;
+    for (uint32_t f = 0; f < modelGroups.size(); f++)
+    {
+      HogDetector::PartModel model;
+      model.gradientStrengths.assign(rows, vector<vector<float>>(cols, vector<float>(nbins, groups[modelGroups[f]])));
+      D.partModels[f][0] = model;
+    }
+    auto templates = D.buildPartTemplates(0, nbins);
+    ASSERT_EQ(modelGroups.size(), templates.count);
+
+    // The budget isn't exceeded
+    auto same = D.compressPartTemplates(templates, 10);
+    EXPECT_EQ(templates.count, same.count);
+    EXPECT_TRUE(same.weights.empty());
+
+    auto compressed = D.compressPartTemplates(templates, 3);
+    ASSERT_EQ(3, compressed.count);
+    ASSERT_EQ(3, compressed.weights.size());
+    EXPECT_EQ(rows, compressed.rows);
+    EXPECT_EQ(cols, compressed.cols);
+    map<float, float> weights;
+    for (uint32_t k = 0; k < compressed.count; k++)
+      weights[compressed.strengths[k * rows * cols * nbins]] = compressed.weights[k];
+    EXPECT_EQ(3.0f, weights[groups[0]]);
+    EXPECT_EQ(2.0f, weights[groups[1]]);
+    EXPECT_EQ(1.0f, weights[groups[2]]);
+
+    // The weighted medoids of the equal models give the score of all the models
+    BodyPart bodyPart;
+    bodyPart.setPartID(0);
+    HogDetector::PartModel candidate;
+    candidate.gradientStrengths.assign(rows, vector<vector<float>>(cols, vector<float>(nbins, 0.2f)));
+    auto expected = D.compare(bodyPart, candidate, nbins);
+    D.partTemplates[0] = compressed;
+    EXPECT_NEAR(expected, D.compare(bodyPart, candidate, nbins), 1e-6f);
+  }
+
+  TEST(HOGDetectorTests, getWorkImage)
+  {
+    HogDetector D;
+    map<string, float> params;
+    params.emplace("grayImages", 1.0f);
+    D.train(HFrames, params);
+
+    // The frame is converted once for all the candidates of the helper
+    HogDetectorHelper detectorHelper;
+    RotatedImageBank *rotatedImageBank = 0;
+    Mat grayImage = D.getWorkImage(*HFrames[1], &detectorHelper, rotatedImageBank);
+    ASSERT_EQ(CV_8UC1, grayImage.type());
+    EXPECT_EQ(nullptr, rotatedImageBank);
+    Mat expected;
+    cvtColor(HFrames[1]->getImage(), expected, COLOR_BGR2GRAY);
+    EXPECT_EQ(0, countNonZero(expected != grayImage));
+    EXPECT_EQ(grayImage.data, D.getWorkImage(*HFrames[1], &detectorHelper, rotatedImageBank).data);
+
+    // The gray bank is built from the bank size of the helper
+    detectorHelper.rotatedImageBank = make_shared<RotatedImageBank>(HFrames[1]->getImage(), 4);
+    HogDetectorHelper bankHelper;
+    bankHelper.rotatedImageBank = detectorHelper.rotatedImageBank;
+    D.getWorkImage(*HFrames[1], &bankHelper, rotatedImageBank);
+    ASSERT_NE(nullptr, rotatedImageBank);
+    EXPECT_NE(detectorHelper.rotatedImageBank.get(), rotatedImageBank);
+    EXPECT_EQ(4, rotatedImageBank->getCapacity());
+
+    // The whole candidate chain runs on the gray patches
+    Skeleton skeleton = HFrames[1]->getSkeleton();
+    BodyPart bodyPart = *skeleton.getBodyPart(7);
+    Point2f p0 = skeleton.getBodyJoint(bodyPart.getParentJoint())->getImageLocation();
+    Point2f p1 = skeleton.getBodyJoint(bodyPart.getChildJoint())->getImageLocation();
+    auto partModel = D.computeDescriptors(bodyPart, p0, p1, grayImage, D.nbins, D.getPartSize(bodyPart), D.blockSize, D.blockStride, D.cellSize, D.wndSigma, D.thresholdL2hys, D.gammaCorrection, D.nlevels, D.derivAperture, D.histogramNormType);
+    EXPECT_EQ(CV_8UC1, partModel.partImage.type());
+
+    // The colour frame is used as it is without "grayImages"
+    HogDetector colourDetector;
+    params["grayImages"] = 0.0f;
+    colourDetector.train(HFrames, params);
+    EXPECT_EQ(CV_8UC3, colourDetector.getWorkImage(*HFrames[1], &detectorHelper, rotatedImageBank).type());
+    EXPECT_EQ(detectorHelper.rotatedImageBank.get(), rotatedImageBank);
+  }
+
   TEST(HOGDetectorTests, getLabelModels)
   {
     // Create "LabelModels"
@@ -0,0 +1,108 @@
+#include <gtest/gtest.h>
+#include <resizedFrameCache.hpp>
+#include <keyframe.hpp>
+#include <lockframe.hpp>
+
+namespace SPEL
+{
+  TEST(ResizedFrameCacheTests, getFrame)
+  {
+    ResizedFrameCache::clear();
+    ResizedFrameCache::Scope scope;
+    Keyframe frame;
+    frame.setID(3);
+    frame.setImage(Mat(Size(100, 200), CV_8UC3, Scalar(10, 20, 30)));
+    frame.setMask(Mat(Size(100, 200), CV_8UC1, Scalar(255)));
+
+    float factor = 0;
+    auto copy = ResizedFrameCache::getFrame(&frame, 100, factor);
+    EXPECT_FLOAT_EQ(0.5f, factor);
+    EXPECT_EQ(KEYFRAME, copy->getFrametype());
+    EXPECT_EQ(3, copy->getID());
+    EXPECT_EQ(100, copy->getImage().rows);
+    EXPECT_EQ(50, copy->getMask().cols);
+    // The source frame is not changed
+    EXPECT_EQ(200, frame.getImage().rows);
+
+    // The same frame shares the copy
+    factor = 0;
+    EXPECT_EQ(copy, ResizedFrameCache::getFrame(&frame, 100, factor));
+    EXPECT_FLOAT_EQ(0.5f, factor);
+    // The other height gets the other copy
+    EXPECT_NE(copy, ResizedFrameCache::getFrame(&frame, 50, factor));
+    EXPECT_FLOAT_EQ(0.25f, factor);
+
+    // The changed frame gets the new copy
+    frame.setImage(Mat(Size(100, 200), CV_8UC3, Scalar(40, 50, 60)));
+    auto changed = ResizedFrameCache::getFrame(&frame, 100, factor);
+    EXPECT_NE(copy, changed);
+    EXPECT_EQ(Vec3b(40, 50, 60), changed->getImage().at<Vec3b>(0, 0));
+    // The previous copy is still valid for its users
+    EXPECT_EQ(Vec3b(10, 20, 30), copy->getImage().at<Vec3b>(0, 0));
+
+    // The other frame with the same id and content gets the other copy
+    Lockframe other;
+    other.setID(3);
+    other.setImage(frame.getImage());
+    other.setMask(frame.getMask());
+    auto otherCopy = ResizedFrameCache::getFrame(&other, 100, factor);
+    EXPECT_NE(changed, otherCopy);
+    EXPECT_EQ(LOCKFRAME, otherCopy->getFrametype());
+    ResizedFrameCache::clear();
+  }
+
+  TEST(ResizedFrameCacheTests, Capacity)
+  {
+    ResizedFrameCache::clear();
+    ResizedFrameCache::Scope scope;
+    auto capacity = ResizedFrameCache::getCapacity();
+    ResizedFrameCache::setCapacity(2);
+    vector <Keyframe> frames(3);
+    float factor = 0;
+    for (int i = 0; i < (int)frames.size(); i++)
+    {
+      frames[i].setID(i);
+      frames[i].setImage(Mat(Size(20, 20), CV_8UC3, Scalar(i, i, i)));
+      frames[i].setMask(Mat(Size(20, 20), CV_8UC1, Scalar(255)));
+      ResizedFrameCache::getFrame(&frames[i], 10, factor);
+    }
+    EXPECT_EQ(2, ResizedFrameCache::getFramesCount());
+
+    // Disabled cache
+    ResizedFrameCache::setCapacity(0);
+    EXPECT_EQ(0, ResizedFrameCache::getFramesCount());
+    EXPECT_NE(ResizedFrameCache::getFrame(&frames[0], 10, factor), ResizedFrameCache::getFrame(&frames[0], 10, factor));
+    EXPECT_EQ(0, ResizedFrameCache::getFramesCount());
+
+    ResizedFrameCache::setCapacity(capacity);
+  }
+
+  TEST(ResizedFrameCacheTests, Scope)
+  {
+    ResizedFrameCache::clear();
+    Keyframe frame;
+    frame.setID(5);
+    frame.setImage(Mat(Size(20, 20), CV_8UC3, Scalar(1, 2, 3)));
+    frame.setMask(Mat(Size(20, 20), CV_8UC1, Scalar(255)));
+    float factor = 0;
+
+    // Outside of the scopes the copies aren't kept
+    EXPECT_NE(ResizedFrameCache::getFrame(&frame, 10, factor), ResizedFrameCache::getFrame(&frame, 10, factor));
+    EXPECT_EQ(0, ResizedFrameCache::getFramesCount());
+
+    shared_ptr <const Frame> copy;
+    {
+      ResizedFrameCache::Scope solveScope;
+      copy = ResizedFrameCache::getFrame(&frame, 10, factor);
+      {
+        // The nested scope shares the copies of the outer one
+        ResizedFrameCache::Scope nestedScope;
+        EXPECT_EQ(copy, ResizedFrameCache::getFrame(&frame, 10, factor));
+      }
+      EXPECT_EQ(1, ResizedFrameCache::getFramesCount());
+    }
+    // The last closed scope releases the copies, the copy stays valid for its user
+    EXPECT_EQ(0, ResizedFrameCache::getFramesCount());
+    EXPECT_EQ(10, copy->getImage().rows);
+  }
+}
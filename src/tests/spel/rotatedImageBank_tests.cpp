@@ -0,0 +1,102 @@
+#include <gtest/gtest.h>
+#include <rotatedImageBank.hpp>
+
+namespace SPEL
+{
+  // Part image as it is built by Detector::rotateImageToDefault
+  Mat DeRotatePart(Mat image, Point2f center, float angle, Size size)
+  {
+    Mat partImage = Mat(size, CV_8UC3, Scalar(0, 0, 0));
+    Point2f newCenter = Point2f(0.5f * size.width, 0.5f * size.height);
+    for (int x = 0; x < size.width - 1; x++)
+      for (int y = 0; y < size.height - 1; y++)
+      {
+        Point2f p = spelHelper::rotatePoint2D(Point2f((float)x, (float)y), newCenter, angle) + center - newCenter;
+        if (0 <= p.x && 0 <= p.y && p.x < image.cols - 1 && p.y < image.rows - 1)
+          partImage.at<Vec3b>(y, x) = image.at<Vec3b>((int)round(p.y), (int)round(p.x));
+      }
+    return partImage;
+  }
+
+  TEST(RotatedImageBankTests, getPartImage)
+  {
+    // Smooth image, so the subpixel shift of the tile changes the colour slightly
+    Mat image = Mat(Size(300, 200), CV_8UC3);
+    for (int x = 0; x < image.cols; x++)
+      for (int y = 0; y < image.rows; y++)
+        image.at<Vec3b>(y, x) = Vec3b((uint8_t)(x / 2), (uint8_t)y, 128);
+
+    RotatedImageBank bank(image, 4);
+    Size size(40, 16);
+    float angle = 30.0f;
+    for (float x = 120.0f; x < 180.0f; x += 7.5f)
+    {
+      Point2f center(x, 100.0f);
+      Mat actual;
+      ASSERT_TRUE(bank.getPartImage(center, angle, size, actual));
+      Mat expected = DeRotatePart(image, center, angle, size);
+      ASSERT_EQ(expected.size(), actual.size());
+      for (int i = 0; i < size.width; i++)
+        for (int j = 0; j < size.height; j++)
+          for (int c = 0; c < 3; c++)
+            EXPECT_LE(abs(expected.at<Vec3b>(j, i)[c] - actual.at<Vec3b>(j, i)[c]), 2) << "x: " << x << " [" << j << "][" << i << "]";
+    }
+    // All the candidates of the same angle around the same place share the tile
+    EXPECT_EQ(1, bank.getTilesCount());
+  }
+
+  TEST(RotatedImageBankTests, GrayImage)
+  {
+    Mat image = Mat(Size(300, 200), CV_8UC3);
+    for (int x = 0; x < image.cols; x++)
+      for (int y = 0; y < image.rows; y++)
+        image.at<Vec3b>(y, x) = Vec3b((uint8_t)(x / 2), (uint8_t)y, 128);
+    Mat grayImage;
+    cvtColor(image, grayImage, COLOR_BGR2GRAY);
+
+    // The gray image is rotated as each of its colour channels
+    RotatedImageBank bank(grayImage, 4);
+    Size size(40, 16);
+    Point2f center(150.0f, 100.0f);
+    float angle = 30.0f;
+    Mat actual;
+    ASSERT_TRUE(bank.getPartImage(center, angle, size, actual));
+    ASSERT_EQ(CV_8UC1, actual.type());
+    Mat expected;
+    cvtColor(DeRotatePart(image, center, angle, size), expected, COLOR_BGR2GRAY);
+    for (int i = 0; i < size.width; i++)
+      for (int j = 0; j < size.height; j++)
+        EXPECT_LE(abs(expected.at<uint8_t>(j, i) - actual.at<uint8_t>(j, i)), 2) << "[" << j << "][" << i << "]";
+
+    Mat rotated = RotatedImageBank::rotateImage(grayImage, Point2f(0, 0), 0.0f, Size(10, 10));
+    ASSERT_EQ(CV_8UC1, rotated.type());
+    EXPECT_EQ(0, countNonZero(rotated != grayImage(Rect(0, 0, 10, 10))));
+  }
+
+  TEST(RotatedImageBankTests, Capacity)
+  {
+    Mat image = Mat(Size(100, 100), CV_8UC3, Scalar(0, 0, 255));
+    RotatedImageBank bank(image, 3);
+    Mat partImage;
+    for (float angle = 0; angle < 90; angle += 10)
+      EXPECT_TRUE(bank.getPartImage(Point2f(50, 50), angle, Size(20, 10), partImage));
+    EXPECT_EQ(3, bank.getTilesCount());
+
+    // Disabled bank
+    RotatedImageBank disabled(image, 0);
+    EXPECT_FALSE(disabled.getPartImage(Point2f(50, 50), 0, Size(20, 10), partImage));
+    EXPECT_EQ(0, disabled.getTilesCount());
+  }
+
+  TEST(RotatedImageBankTests, getBank)
+  {
+    Mat image = Mat(Size(100, 100), CV_8UC3, Scalar(0, 255, 0));
+    auto bank = RotatedImageBank::getBank(7, image, 8);
+    // The same frame image shares the bank
+    EXPECT_EQ(bank, RotatedImageBank::getBank(7, image, 8));
+    // The other frame image with the same id gets the new bank
+    Mat other = Mat(Size(100, 100), CV_8UC3, Scalar(255, 0, 0));
+    EXPECT_NE(bank, RotatedImageBank::getBank(7, other, 8));
+    EXPECT_NE(bank, RotatedImageBank::getBank(7, image.clone(), 8));
+  }
+}
@@ -133,6 +133,41 @@ namespace SPEL
     EXPECT_EQ(Point2f(1.0, 1.0), rectSize);
   }
 
+  TEST_F(PoseRectTest, ForEachRowSpan)
+  {
+    Rect area(0, 0, 40, 30);
+    vector <POSERECT <Point2f>> rects;
+    rects.push_back(POSERECT <Point2f>(Point2f(5.5f, 3.25f), Point2f(30.75f, 12.5f), Point2f(24.0f, 31.0f), Point2f(-1.25f, 21.75f))); // crosses the area border
+    rects.push_back(POSERECT <Point2f>(Point2f(2.0f, 2.0f), Point2f(12.0f, 2.0f), Point2f(12.0f, 8.0f), Point2f(2.0f, 8.0f))); // the edges pass through the pixels
+    rects.push_back(rect1);
+    for (auto rect : rects)
+    {
+      for (auto withEdges : { false, true })
+      {
+        Mat covered(area.size(), CV_8UC1, Scalar(0));
+        int lastRow = -1;
+        rect.ForEachRowSpan(area, withEdges, [&](int y, int xBegin, int xEnd)
+        {
+          EXPECT_LT(lastRow, y);
+          lastRow = y;
+          for (int x = xBegin; x < xEnd; x++)
+            covered.at<uint8_t>(y, x)++;
+        });
+        for (int y = 0; y < area.height; y++)
+          for (int x = 0; x < area.width; x++)
+          {
+            auto test = rect.containsPoint(Point2f((float)x, (float)y));
+            EXPECT_EQ(withEdges ? test != -1 : test > 0, covered.at<uint8_t>(y, x) == 1) << "withEdges: " << withEdges << " [" << y << "][" << x << "]";
+          }
+      }
+    }
+    float left, right;
+    EXPECT_TRUE(rect1.GetRowSpan(1.5f, left, right));
+    EXPECT_EQ(1.0f, left);
+    EXPECT_EQ(2.0f, right);
+    EXPECT_FALSE(rect1.GetRowSpan(2.5f, left, right));
+  }
+
   TEST(spelHelperTests_, CopyTree)
   {
     //Loading part tree from existing project
@@ -11,4 +11,59 @@ namespace SPEL
 
     EXPECT_EQ(id, sd.getID());
   }
+
+  TEST(surfDetectorTest, getFrameFeatures)
+  {
+    Mat image = Mat(Size(200, 150), CV_8UC3);
+    RNG rng(17);
+    rng.fill(image, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+    Mat mask = Mat(image.size(), CV_8UC1, Scalar(0));
+    Rect maskBox(40, 30, 100, 80);
+    mask(maskBox).setTo(Scalar(255));
+    Keyframe frame;
+    frame.setID(11);
+    frame.setImage(image);
+    frame.setMask(mask);
+
+    auto features = SurfDetector::getFrameFeatures(&frame, 500);
+    ASSERT_FALSE(features->keyPoints.empty());
+    EXPECT_EQ(static_cast<int>(features->keyPoints.size()), features->descriptors.rows);
+    // The keypoints are detected inside the bounding box of the mask only
+    for (auto &&kp : features->keyPoints)
+      EXPECT_TRUE(maskBox.contains(Point(static_cast<int>(kp.pt.x), static_cast<int>(kp.pt.y)))) << kp.pt;
+
+    // The same frame image shares the features, the copy of the image and the other "minHessian" get their own features
+    EXPECT_EQ(features, SurfDetector::getFrameFeatures(&frame, 500));
+    Keyframe copy;
+    copy.setID(11);
+    copy.setImage(image);
+    copy.setMask(mask);
+    EXPECT_NE(features, SurfDetector::getFrameFeatures(&copy, 500));
+    EXPECT_NE(features, SurfDetector::getFrameFeatures(&frame, 300));
+    EXPECT_GE(SurfDetector::getFramesFeaturesCount(), 3);
+  }
+
+  TEST(surfDetectorTest, getFrameFeaturesOfReplacedFrame)
+  {
+    Mat image = Mat(Size(160, 120), CV_8UC3);
+    RNG rng(23);
+    rng.fill(image, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+    Mat mask = Mat(image.size(), CV_8UC1, Scalar(255));
+    auto frame = new Keyframe();
+    frame->setID(12);
+    frame->setImage(image);
+    frame->setMask(mask);
+    auto features = SurfDetector::getFrameFeatures(frame, 500);
+    delete frame;
+
+    // The new frame with the same id and size but the other pixels doesn't get the features of the deleted one
+    rng.fill(image, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+    frame = new Keyframe();
+    frame->setID(12);
+    frame->setImage(image);
+    frame->setMask(mask);
+    auto newFeatures = SurfDetector::getFrameFeatures(frame, 500);
+    EXPECT_NE(features, newFeatures);
+    delete frame;
+  }
 }